@@ -0,0 +1,135 @@
+//***************************************************************************************
+// MeshStats.cpp
+//
+// Headless report on the vertex cache use of i4CastleApp's meshes.  It generates the
+// shape meshes with the same parameters as i4CastleApp::BuildShapeGeometry and the
+// water grids with the sizes of its water bodies, and measures each on a FIFO cache
+// as generated and after the optimisation the application applies to it: the full
+// OptimizeMesh for the shapes, and OptimizeVertexCache alone for the water, whose
+// vertices have to stay in grid order.
+//
+// ACMR is the number of vertices transformed per triangle, ATVR per vertex; see
+// MeshOptimizer.h.  The results are written as JSON so they can be compared per commit.
+//
+// Usage: MeshStats [-o results.json] [-cache 16]
+//***************************************************************************************
+
+#include "../../Common/MeshOptimizer.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+	struct Result
+	{
+		std::string Name;
+		int Triangles = 0;
+		int Vertices = 0;
+		VertexCacheStats Before;
+		VertexCacheStats After;
+		double Ms = 0.0;
+	};
+
+	Result Measure(const char* name, GeometryGenerator::MeshData mesh, bool waterGrid, int cacheSize)
+	{
+		Result r;
+		r.Name = name;
+		r.Triangles = (int)mesh.Indices32.size()/3;
+		r.Vertices = (int)mesh.Vertices.size();
+		r.Before = AnalyzeVertexCache(mesh.Indices32.data(), mesh.Indices32.size(), mesh.Vertices.size(), cacheSize);
+
+		auto start = std::chrono::steady_clock::now();
+		if(waterGrid)
+			OptimizeVertexCache(mesh.Indices32.data(), mesh.Indices32.size(), mesh.Vertices.size());
+		else
+			OptimizeMesh(mesh);
+		r.Ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		r.After = AnalyzeVertexCache(mesh.Indices32.data(), mesh.Indices32.size(), mesh.Vertices.size(), cacheSize);
+		return r;
+	}
+
+	void WriteJson(FILE* f, int cacheSize, const std::vector<Result>& results)
+	{
+		std::fprintf(f, "{\n");
+		std::fprintf(f, "  \"benchmark\": \"MeshStats\",\n");
+		std::fprintf(f, "  \"cache_size\": %d,\n", cacheSize);
+		std::fprintf(f, "  \"results\": [\n");
+		for(size_t k = 0; k < results.size(); ++k)
+		{
+			const Result& r = results[k];
+			std::fprintf(f,
+				"    { \"mesh\": \"%s\", \"triangles\": %d, \"vertices\": %d, "
+				"\"acmr_before\": %.4f, \"acmr_after\": %.4f, \"atvr_before\": %.4f, \"atvr_after\": %.4f, "
+				"\"ms\": %.3f }%s\n",
+				r.Name.c_str(), r.Triangles, r.Vertices,
+				r.Before.Acmr, r.After.Acmr, r.Before.Atvr, r.After.Atvr, r.Ms,
+				k + 1 < results.size() ? "," : "");
+		}
+		std::fprintf(f, "  ]\n");
+		std::fprintf(f, "}\n");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const char* output = nullptr;
+	int cacheSize = 16;
+	for(int k = 1; k < argc; ++k)
+	{
+		bool hasValue = k + 1 < argc;
+		if(std::strcmp(argv[k], "-o") == 0 && hasValue)
+			output = argv[++k];
+		else if(std::strcmp(argv[k], "-cache") == 0 && hasValue)
+			cacheSize = std::atoi(argv[++k]);
+		else
+			cacheSize = 0;
+	}
+	if(cacheSize < 3)
+	{
+		std::fprintf(stderr, "usage: MeshStats [-o results.json] [-cache 16]\n");
+		return 1;
+	}
+
+	GeometryGenerator geoGen;
+	std::vector<Result> results;
+	results.push_back(Measure("box", geoGen.CreateBox(1.5f, 0.5f, 1.5f, 3), false, cacheSize));
+	results.push_back(Measure("grid", geoGen.CreateGrid(20.0f, 30.0f, 60, 40), false, cacheSize));
+	results.push_back(Measure("sphere", geoGen.CreateSphere(0.5f, 20, 20), false, cacheSize));
+	results.push_back(Measure("cylinder", geoGen.CreateCylinder(0.5f, 0.5f, 3.0f, 20, 20), false, cacheSize));
+	results.push_back(Measure("diamond", geoGen.CreateDiamond(1.f, 1.f), false, cacheSize));
+	results.push_back(Measure("wedge", geoGen.CreateWedge(1.5f, 1.5f, 1.5f, 3), false, cacheSize));
+	results.push_back(Measure("octahedron", geoGen.CreateOctahedron(0.5f), false, cacheSize));
+	results.push_back(Measure("triangularPrism", geoGen.CreateTriangularPrism(1.f, 1.f, 1.f, 3), false, cacheSize));
+	results.push_back(Measure("hexagon", geoGen.CreateHexagon(1.5f, 1.5f, 3), false, cacheSize));
+	results.push_back(Measure("octagon", geoGen.CreateOctagon(1.5f, 1.5f, 3), false, cacheSize));
+	results.push_back(Measure("cone", geoGen.CreateCone(1.0f, 1.0f, 20, 20), false, cacheSize));
+	results.push_back(Measure("pyramid", geoGen.CreatePyramid(1.f, 1.f, 0.f, 0.f, 1.f, 3), false, cacheSize));
+	results.push_back(Measure("container", geoGen.CreateHexagonContainer(1.f, 1.f, 3), false, cacheSize));
+
+	// The water bodies' grids are indexed like GeometryGenerator's.
+	results.push_back(Measure("lake", geoGen.CreateGrid(256.0f, 256.0f, 257, 257), true, cacheSize));
+	results.push_back(Measure("moat", geoGen.CreateGrid(8.0f, 40.0f, 33, 161), true, cacheSize));
+	results.push_back(Measure("fountain", geoGen.CreateGrid(4.0f, 4.0f, 33, 33), true, cacheSize));
+
+	for(const Result& r : results)
+	{
+		std::fprintf(stderr, "%-16s %7d tris %7d verts  ACMR %.3f -> %.3f  ATVR %.3f -> %.3f  %8.3f ms\n",
+			r.Name.c_str(), r.Triangles, r.Vertices, r.Before.Acmr, r.After.Acmr, r.Before.Atvr, r.After.Atvr, r.Ms);
+	}
+
+	FILE* f = stdout;
+	if(output != nullptr && (f = std::fopen(output, "w")) == nullptr)
+	{
+		std::fprintf(stderr, "MeshStats: cannot open %s\n", output);
+		return 1;
+	}
+	WriteJson(f, cacheSize, results);
+	if(f != stdout)
+		std::fclose(f);
+	return 0;
+}
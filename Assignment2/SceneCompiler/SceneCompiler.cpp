@@ -0,0 +1,188 @@
+//***************************************************************************************
+// SceneCompiler.cpp
+//
+// Compiles a scene described in text (see i4CastleApp/Scene/Castle.scene.txt) into the
+// binary SceneFile i4CastleApp maps at startup.  The transforms are composed here, so
+// the application never parses a number.  The meshes, materials and layers are listed
+// in the file in the order the objects first use them.
+//
+// With -dump it loads a compiled scene through SceneFile and prints it back.
+//
+// Usage: SceneCompiler input.scene.txt output.scene
+//        SceneCompiler -dump input.scene
+//***************************************************************************************
+
+#include "../../Common/SceneFile.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace DirectX;
+
+namespace
+{
+	// The index of name in names, which it is added to if it is not there yet.
+	std::uint32_t Intern(std::vector<std::string>& names, const std::string& name)
+	{
+		for(size_t i = 0; i < names.size(); ++i)
+		{
+			if(names[i] == name)
+				return (std::uint32_t)i;
+		}
+		names.push_back(name);
+		return (std::uint32_t)names.size() - 1;
+	}
+
+	// Reads the transform that follows "world" or "tex" on a line.
+	XMFLOAT4X4 ParseTransform(std::istringstream& line, const std::string& where)
+	{
+		auto number = [&]()
+		{
+			float f;
+			if(!(line >> f))
+				throw std::runtime_error(where + ": expected a number");
+			return f;
+		};
+
+		XMMATRIX M = XMMatrixIdentity();
+		std::string op;
+		while(line >> op)
+		{
+			XMMATRIX T;
+			if(op == "scale")
+			{
+				float x = number(), y = number(), z = number();
+				T = XMMatrixScaling(x, y, z);
+			}
+			else if(op == "translate")
+			{
+				float x = number(), y = number(), z = number();
+				T = XMMatrixTranslation(x, y, z);
+			}
+			else if(op == "rotateX")
+				T = XMMatrixRotationX(XMConvertToRadians(number()));
+			else if(op == "rotateY")
+				T = XMMatrixRotationY(XMConvertToRadians(number()));
+			else if(op == "rotateZ")
+				T = XMMatrixRotationZ(XMConvertToRadians(number()));
+			else
+				throw std::runtime_error(where + ": unknown transform '" + op + "'");
+
+			M = XMMatrixMultiply(M, T);
+		}
+
+		XMFLOAT4X4 result;
+		XMStoreFloat4x4(&result, M);
+		return result;
+	}
+
+	std::vector<std::uint8_t> Compile(const char* filename)
+	{
+		std::ifstream fin(filename);
+		if(!fin)
+			throw std::runtime_error(std::string("cannot open ") + filename);
+
+		XMFLOAT4X4 identity;
+		XMStoreFloat4x4(&identity, XMMatrixIdentity());
+
+		std::vector<std::string> meshes;
+		std::vector<std::string> materials;
+		std::vector<std::string> layers;
+		std::vector<SceneFileObject> objects;
+
+		std::string text;
+		for(int lineNumber = 1; std::getline(fin, text); ++lineNumber)
+		{
+			std::string where = std::string(filename) + "(" + std::to_string(lineNumber) + ")";
+			std::istringstream line(text.substr(0, text.find('#')));
+			std::string keyword;
+			if(!(line >> keyword))
+				continue;
+
+			if(keyword == "object")
+			{
+				std::string mesh, material, layer, extra;
+				if(!(line >> mesh >> material >> layer) || (line >> extra))
+					throw std::runtime_error(where + ": expected object <mesh> <material> <layer>");
+
+				SceneFileObject object;
+				object.World = identity;
+				object.TexTransform = identity;
+				object.Mesh = Intern(meshes, mesh);
+				object.Material = Intern(materials, material);
+				object.Layer = Intern(layers, layer);
+				objects.push_back(object);
+			}
+			else if(keyword == "world" || keyword == "tex")
+			{
+				if(objects.empty())
+					throw std::runtime_error(where + ": " + keyword + " before the first object");
+
+				XMFLOAT4X4 transform = ParseTransform(line, where);
+				if(keyword == "world")
+					objects.back().World = transform;
+				else
+					objects.back().TexTransform = transform;
+			}
+			else
+				throw std::runtime_error(where + ": unknown keyword '" + keyword + "'");
+		}
+
+		return SceneFile::Build(meshes, materials, layers, objects);
+	}
+
+	void Dump(const char* filename)
+	{
+		SceneFile scene(filename);
+		std::printf("%d objects, %d meshes, %d materials, %d layers\n",
+			scene.ObjectCount(), scene.MeshCount(), scene.MaterialCount(), scene.LayerCount());
+
+		for(int i = 0; i < scene.ObjectCount(); ++i)
+		{
+			const SceneFileObject& o = scene.Objects()[i];
+			std::printf("object %s %s %s\n", scene.MeshName(o.Mesh), scene.MaterialName(o.Material),
+				scene.LayerName(o.Layer));
+			std::printf("    world %g %g %g  %g %g %g  %g %g %g  %g %g %g\n",
+				o.World._11, o.World._12, o.World._13, o.World._21, o.World._22, o.World._23,
+				o.World._31, o.World._32, o.World._33, o.World._41, o.World._42, o.World._43);
+			std::printf("    tex   %g %g  %g %g  %g %g\n",
+				o.TexTransform._11, o.TexTransform._12, o.TexTransform._21, o.TexTransform._22,
+				o.TexTransform._41, o.TexTransform._42);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if(argc != 3)
+	{
+		std::fprintf(stderr, "usage: SceneCompiler input.scene.txt output.scene\n"
+			"       SceneCompiler -dump input.scene\n");
+		return 1;
+	}
+
+	try
+	{
+		if(std::strcmp(argv[1], "-dump") == 0)
+		{
+			Dump(argv[2]);
+			return 0;
+		}
+
+		std::vector<std::uint8_t> file = Compile(argv[1]);
+		std::ofstream fout(argv[2], std::ios::binary);
+		if(!fout.write(reinterpret_cast<const char*>(file.data()), file.size()))
+			throw std::runtime_error(std::string("cannot write ") + argv[2]);
+	}
+	catch(const std::exception& e)
+	{
+		std::fprintf(stderr, "SceneCompiler: %s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
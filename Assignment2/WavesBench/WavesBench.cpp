@@ -0,0 +1,836 @@
+//***************************************************************************************
+// WavesBench.cpp
+//
+// Headless benchmark for the wave simulation.  For every grid size and thread count it
+// times one full simulation step, fused and in two passes (see Waves::SetFusedUpdate),
+// the stencil and normal row kernels on their own, and
+// the vertex packing done by i4CastleApp::UpdateWaves, both into cached memory and with
+// the streaming stores used for the mapped vertex buffer, and reports each in
+// nanoseconds per grid cell.  The results are written as JSON so they can be compared per commit.
+// The fused and two-pass steps are also run side by side from the same state, and the
+// checksums of their heights, normals and tangents compared; the run exits with 1 if
+// they differ.
+//
+// It can also time the replay of a recorded run (a Waves checkpoint plus a WavesLog,
+// see i4CastleApp's R key), and write a reproducible heavy-splash recording to replay.
+//
+// With -frame it times the CPU side of i4CastleApp's frames instead: the same
+// FrameUpdater calls the app makes, on a HostRenderDevice, for the castle's water
+// bodies and the given number of objects, with the water run synchronously and
+// asynchronously.
+//
+// With -verify it runs the water of the -frame workload through a synchronous and an
+// asynchronous AsyncWaves side by side, swapping their modes halfway, and exits with 1
+// if the frames they hand to the renderer ever differ.
+//
+// With -check it compares every kernel set the CPU supports (see WavesKernels) to the
+// scalar kernels, on rows of several widths, and exits with 1 if any of them differs.
+//
+// Usage: WavesBench [-o results.json] [-min-size 128] [-max-size 4096] [-threads N]
+//                   [-time seconds]
+//        WavesBench -replay checkpoint.bin log.bin [-o results.json] [-threads N]
+//        WavesBench -scenario checkpoint.bin log.bin [-seed N]
+//        WavesBench -frame [-objects N] [-o results.json] [-threads N] [-time seconds]
+//        WavesBench -verify [-seed N] [-threads N]
+//        WavesBench -check
+//***************************************************************************************
+
+#include "../i4CastleApp/Waves.h"
+#include "../i4CastleApp/WavesKernels.h"
+#include "../i4CastleApp/FrameUpdater.h"
+#include "../../Common/HostRenderDevice.h"
+#include "../../Common/TaskScheduler.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Same as i4CastleApp.
+const int gNumFrameResources = 3;
+
+namespace
+{
+	// Same constants as the water in i4CastleApp.
+	const float kSpatialStep = 1.0f;
+	const float kTimeStep = 0.03f;
+	const float kSpeed = 4.0f;
+	const float kDamping = 0.2f;
+
+	struct Result
+	{
+		int Rows = 0;
+		int Cols = 0;
+		int Threads = 0;
+		double StepNs = 0.0;
+		double TwoPassNs = 0.0;
+		std::uint64_t FusedChecksum = 0;
+		std::uint64_t TwoPassChecksum = 0;
+		double StencilNs = 0.0;
+		double NormalsNs = 0.0;
+		double PackNs = 0.0;
+		double StreamNs = 0.0;
+	};
+
+	struct Options
+	{
+		const char* Output = nullptr;
+		int MinSize = 128;
+		int MaxSize = 4096;
+		int MaxThreads = 0;
+		double SecondsPerCase = 0.25;
+
+		// -replay or -scenario: the checkpoint and log to read or write.
+		const char* Checkpoint = nullptr;
+		const char* Log = nullptr;
+		bool WriteScenario = false;
+		unsigned Seed = 1;
+
+		// -frame, and the number of objects in the scene.
+		bool Frame = false;
+		int Objects = 64;
+
+		// -verify and -check.
+		bool Verify = false;
+		bool Check = false;
+	};
+
+	// Average microseconds per frame spent in each update, and in the whole frame.
+	struct FrameResult
+	{
+		bool Asynchronous = false;
+		int Threads = 0;
+		int Objects = 0;
+		int Frames = 0;
+		double WavesUs = 0.0;
+		double ObjectsUs = 0.0;
+		double MaterialsUs = 0.0;
+		double PassUs = 0.0;
+		double FrameUs = 0.0;
+		double WavesBytes = 0.0;
+		int Stalls = 0;
+	};
+
+	struct ReplayResult
+	{
+		int Rows = 0;
+		int Cols = 0;
+		int Threads = 0;
+		int Updates = 0;
+		double Ms = 0.0;
+	};
+
+	// Calls fn repeatedly for about the given time, in five batches, and returns the
+	// fastest batch average in nanoseconds per call.  Taking the best batch filters out
+	// interruptions from the rest of the system.
+	double TimeNs(double seconds, const std::function<void()>& fn)
+	{
+		using Clock = std::chrono::steady_clock;
+
+		// Warm up, and find how many calls fit in one batch.
+		auto start = Clock::now();
+		fn();
+		double once = std::chrono::duration<double>(Clock::now() - start).count();
+		int calls = std::max<int>(1, (int)(seconds / 5.0 / std::max<double>(once, 1.0e-9)));
+
+		double best = 1.0e300;
+		for(int batch = 0; batch < 5; ++batch)
+		{
+			start = Clock::now();
+			for(int k = 0; k < calls; ++k)
+				fn();
+			double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+			best = std::min<double>(best, ns / calls);
+		}
+
+		return best;
+	}
+
+	// Disturbs the whole grid and disables the activity tracking, so every step
+	// advances every cell.
+	void MakeBusy(Waves& waves)
+	{
+		waves.SetActivityThreshold(-1.0f);
+		for(int i = 8; i < waves.RowCount() - 8; i += 16)
+		{
+			for(int j = 8; j < waves.ColumnCount() - 8; j += 16)
+			{
+				// Flush the queue when it fills up.
+				if(!waves.Disturb(i, j, 0.5f, 3))
+				{
+					waves.Update(0.0f);
+					waves.Disturb(i, j, 0.5f, 3);
+				}
+			}
+		}
+		waves.Update(kTimeStep);
+	}
+
+	// FNV-1a over the bits of every height, normal and x-tangent.
+	std::uint64_t Checksum(const Waves& waves)
+	{
+		std::uint64_t hash = 14695981039346656037ull;
+		auto add = [&hash](float x)
+		{
+			std::uint32_t bits;
+			std::memcpy(&bits, &x, sizeof(bits));
+			for(int b = 0; b < 4; ++b)
+			{
+				hash ^= (bits >> 8*b) & 0xff;
+				hash *= 1099511628211ull;
+			}
+		};
+
+		for(int i = 0; i < waves.VertexCount(); ++i)
+		{
+			DirectX::XMFLOAT3 normal = waves.Normal(i);
+			DirectX::XMFLOAT3 tangent = waves.TangentX(i);
+			add(waves.Height(i));
+			add(normal.x);
+			add(normal.y);
+			add(normal.z);
+			add(tangent.x);
+			add(tangent.y);
+		}
+		return hash;
+	}
+
+	// Compares every kernel set this CPU supports to the scalar kernels and reports
+	// each.  Returns false if any of them differs.
+	bool CheckKernels()
+	{
+		bool passed = true;
+		for(const WavesKernels& kernels : WavesKernels::Supported())
+		{
+			bool matches = WavesKernels::MatchesScalar(kernels, 2);
+			std::fprintf(stderr, "%-6s %s\n", kernels.Name, matches ? "matches the scalar kernels" : "DIFFERS from the scalar kernels");
+			passed = passed && matches;
+		}
+		return passed;
+	}
+
+	Result Run(int size, TaskScheduler& scheduler, const Options& options)
+	{
+		int m = size;
+		int n = size;
+		double cells = (double)m*n;
+
+		Result r;
+		r.Rows = m;
+		r.Cols = n;
+		r.Threads = scheduler.ThreadCount();
+
+		Waves waves(m, n, kSpatialStep, kTimeStep, kSpeed, kDamping);
+		waves.SetScheduler(scheduler);
+		MakeBusy(waves);
+
+		r.StepNs = TimeNs(options.SecondsPerCase, [&]()
+		{
+			waves.Update(kTimeStep);
+		}) / cells;
+
+		waves.SetFusedUpdate(false);
+		r.TwoPassNs = TimeNs(options.SecondsPerCase, [&]()
+		{
+			waves.Update(kTimeStep);
+		}) / cells;
+		waves.SetFusedUpdate(true);
+
+		// A few steps each way from the same state must give the same grid.
+		{
+			Waves fused(m, n, kSpatialStep, kTimeStep, kSpeed, kDamping);
+			Waves twoPass(m, n, kSpatialStep, kTimeStep, kSpeed, kDamping);
+			fused.SetScheduler(scheduler);
+			twoPass.SetScheduler(scheduler);
+			twoPass.SetFusedUpdate(false);
+			MakeBusy(fused);
+			MakeBusy(twoPass);
+			for(int step = 0; step < 8; ++step)
+			{
+				fused.Update(kTimeStep);
+				twoPass.Update(kTimeStep);
+			}
+			r.FusedChecksum = Checksum(fused);
+			r.TwoPassChecksum = Checksum(twoPass);
+		}
+
+		// The kernels on their own, over the interior rows, split the way Waves splits them.
+		const WavesKernels& kernels = waves.Kernels();
+		std::vector<float> prev(m*n), curr(m*n);
+		std::vector<float> nx(m*n), ny(m*n), nz(m*n), tx(m*n), ty(m*n);
+		for(int k = 0; k < m*n; ++k)
+		{
+			prev[k] = waves.Height(k);
+			curr[k] = waves.Height(k);
+		}
+
+		float k1 = -0.9f, k2 = 1.2f, k3 = 0.3f;
+		r.StencilNs = TimeNs(options.SecondsPerCase, [&]()
+		{
+			scheduler.ParallelFor(1, m - 1, Waves::TileSize, [&](int first, int last)
+			{
+				for(int i = first; i < last; ++i)
+				{
+					const float* c = &curr[i*n + 1];
+					kernels.StencilRow(&prev[i*n + 1], c - n, c, c + n, n - 2, k1, k2, k3);
+				}
+			});
+		}) / cells;
+
+		r.NormalsNs = TimeNs(options.SecondsPerCase, [&]()
+		{
+			scheduler.ParallelFor(1, m - 1, Waves::TileSize, [&](int first, int last)
+			{
+				for(int i = first; i < last; ++i)
+				{
+					const float* c = &curr[i*n + 1];
+					int k = i*n + 1;
+					kernels.NormalRow(c - n, c, c + n, n - 2, 2.0f*kSpatialStep,
+						&nx[k], &ny[k], &nz[k], &tx[k], &ty[k]);
+				}
+			});
+		}) / cells;
+
+		// What UpdateWaves does when every tile changed.
+		std::vector<Waves::PackedVertex> vb(m*n);
+		r.PackNs = TimeNs(options.SecondsPerCase, [&]()
+		{
+			waves.WriteChangedTiles(0, vb.data(), false);
+		}) / cells;
+
+		r.StreamNs = TimeNs(options.SecondsPerCase, [&]()
+		{
+			waves.WriteChangedTiles(0, vb.data(), true);
+		}) / cells;
+
+		return r;
+	}
+
+	// Runs i4CastleApp's per-frame CPU work for about the given time: the water bodies
+	// and splashes of the castle, a camera circling the lake, and options.Objects
+	// objects of which one in eight moves every frame.
+	FrameResult RunFrames(bool asynchronous, TaskScheduler& scheduler, const Options& options)
+	{
+		using Clock = std::chrono::steady_clock;
+		const float dt = 1.0f / 60.0f;
+
+		// A GPU that keeps up, one frame behind the frame being built plus the one
+		// before it, so a frame resource is free again when its turn comes; the
+		// only stalls come from the ring filling up.
+		HostRenderDevice device(gNumFrameResources - 1);
+
+		WaterSystem water(scheduler);
+		int lake = water.AddBody(257, 257, 1.0f, 0.03f, 4.0f, 0.2f, true);
+		int moat = water.AddBody(33, 161, 0.25f, 0.03f, 4.0f, 0.4f, false);
+		int fountain = water.AddBody(33, 33, 0.125f, 0.02f, 2.0f, 1.0f, false);
+		std::vector<DirectX::XMFLOAT3> positions(water.BodyCount());
+		positions[moat] = DirectX::XMFLOAT3(0.0f, 0.2f, -16.0f);
+		positions[fountain] = DirectX::XMFLOAT3(0.0f, 0.6f, -22.0f);
+		AsyncWaves waves(water, asynchronous);
+
+		std::vector<std::unique_ptr<FrameResource>> frameResources;
+		for(int i = 0; i < gNumFrameResources; ++i)
+			frameResources.push_back(std::make_unique<FrameResource>(device, water.VertexCount(), water.BodyCount()));
+		UploadRing ring(device, 1 << 20);
+		FrameUpdater updater(ring);
+
+		std::unordered_map<std::string, std::unique_ptr<Material>> materials;
+		for(int k = 0; k < 8; ++k)
+		{
+			auto mat = std::make_unique<Material>();
+			mat->Name = "material" + std::to_string(k);
+			mat->MatCBIndex = k;
+			materials[mat->Name] = std::move(mat);
+		}
+		Material* waterMat = materials["material0"].get();
+
+		std::vector<std::unique_ptr<ObjectState>> objects;
+		std::vector<ObjectState*> bodyObjects;
+		for(int k = 0; k < options.Objects + water.BodyCount(); ++k)
+		{
+			auto object = std::make_unique<ObjectState>();
+			DirectX::XMStoreFloat4x4(&object->World, DirectX::XMMatrixTranslation((float)(k % 16), 0.0f, (float)(k / 16)));
+			object->ObjCBIndex = k;
+			object->Mat = materials["material" + std::to_string(k % 8)].get();
+			if(k >= options.Objects)
+				bodyObjects.push_back(object.get());
+			objects.push_back(std::move(object));
+		}
+
+		DirectX::XMMATRIX proj = DirectX::XMMatrixPerspectiveFovLH(DirectX::XM_PIDIV4, 16.0f / 9.0f, 1.0f, 1000.0f);
+		std::minstd_rand random(options.Seed);
+
+		FrameResult r;
+		r.Asynchronous = asynchronous;
+		r.Threads = scheduler.ThreadCount();
+		r.Objects = options.Objects;
+
+		std::uint64_t currentFence = 0;
+		double bytes = 0.0;
+		double elapsed = 0.0;
+		for(int frame = 0; elapsed < options.SecondsPerCase; ++frame)
+		{
+			auto start = Clock::now();
+
+			FrameResource& fr = *frameResources[frame % gNumFrameResources];
+			device.WaitForFence(fr.Fence);
+			ring.Reclaim(device.CompletedFenceValue());
+
+			// What i4CastleApp::AnimateMaterials and UpdateWaves do, with the splashes
+			// every fifteenth frame.
+			waterMat->MatTransform(3, 0) += 0.1f*dt;
+			waterMat->NumFramesDirty = gNumFrameResources;
+
+			if(frame % 15 == 0)
+			{
+				for(int body : { lake, moat })
+				{
+					const Waves& w = water.Body(body);
+					int i = std::uniform_int_distribution<int>(4, w.RowCount() - 5)(random);
+					int j = std::uniform_int_distribution<int>(4, w.ColumnCount() - 5)(random);
+					waves.Disturb(body, i, j, std::uniform_real_distribution<float>(0.2f, 0.5f)(random));
+				}
+				const Waves& f = water.Body(fountain);
+				waves.Disturb(fountain, f.RowCount() / 2, f.ColumnCount() / 2, 0.15f, 3);
+			}
+
+			float angle = frame*dt*0.1f;
+			DirectX::XMFLOAT3 eyePos(40.0f*std::cos(angle), 3.0f, 40.0f*std::sin(angle));
+			waves.Update(dt, eyePos.x, eyePos.z);
+			waves.Acquire();
+			bytes += (double)updater.UpdateWaves(waves, water, positions, bodyObjects, fr);
+			auto wavesDone = Clock::now();
+
+			for(int k = frame % 8; k < options.Objects; k += 8)
+			{
+				objects[k]->World._42 = 0.5f*std::sin(frame*dt);
+				objects[k]->NumFramesDirty = gNumFrameResources;
+			}
+			updater.UpdateObjectCBs(objects, fr);
+			auto objectsDone = Clock::now();
+
+			updater.UpdateMaterialBuffer(materials, fr);
+			auto materialsDone = Clock::now();
+
+			DirectX::XMMATRIX view = DirectX::XMMatrixLookAtLH(DirectX::XMVectorSet(eyePos.x, eyePos.y, eyePos.z, 1.0f),
+				DirectX::XMVectorZero(), DirectX::XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+			updater.UpdateMainPassCB(view, proj, eyePos, 1920.0f, 1080.0f, frame*dt, dt, fr);
+
+			fr.Fence = ++currentFence;
+			ring.EndFrame(currentFence);
+			device.Signal(currentFence);
+			auto end = Clock::now();
+
+			// The first frames fill every frame resource's copy of the water; leave them out.
+			if(frame < gNumFrameResources)
+				continue;
+
+			r.WavesUs += std::chrono::duration<double, std::micro>(wavesDone - start).count();
+			r.ObjectsUs += std::chrono::duration<double, std::micro>(objectsDone - wavesDone).count();
+			r.MaterialsUs += std::chrono::duration<double, std::micro>(materialsDone - objectsDone).count();
+			r.PassUs += std::chrono::duration<double, std::micro>(end - materialsDone).count();
+			r.FrameUs += std::chrono::duration<double, std::micro>(end - start).count();
+			elapsed += std::chrono::duration<double>(end - start).count();
+			++r.Frames;
+		}
+		waves.Wait();
+
+		r.WavesUs /= r.Frames;
+		r.ObjectsUs /= r.Frames;
+		r.MaterialsUs /= r.Frames;
+		r.PassUs /= r.Frames;
+		r.FrameUs /= r.Frames;
+		r.WavesBytes = bytes / (r.Frames + gNumFrameResources);
+		r.Stalls = device.StallCount();
+		return r;
+	}
+
+	// Runs the water bodies and splashes of RunFrames for 600 frames through two
+	// AsyncWaves, one synchronous and one asynchronous, and swaps their modes halfway.
+	// Every frame each is waited for, so both hand out the state after the same
+	// Update, and their versions, origins and renderer copies are compared.  Returns
+	// false at the first difference.
+	bool VerifyAsync(const Options& options)
+	{
+		const float dt = 1.0f / 60.0f;
+		const int frameCount = 600;
+
+		// Separate schedulers, so the worker of one never shares a pool with the other.
+		std::unique_ptr<ThreadPoolScheduler> schedulers[2];
+		std::unique_ptr<WaterSystem> water[2];
+		for(int s = 0; s < 2; ++s)
+		{
+			schedulers[s] = std::make_unique<ThreadPoolScheduler>(options.MaxThreads);
+			water[s] = std::make_unique<WaterSystem>(*schedulers[s]);
+			water[s]->AddBody(257, 257, 1.0f, 0.03f, 4.0f, 0.2f, true);
+			water[s]->AddBody(33, 161, 0.25f, 0.03f, 4.0f, 0.4f, false);
+			water[s]->AddBody(33, 33, 0.125f, 0.02f, 2.0f, 1.0f, false);
+		}
+		const int lake = 0, moat = 1, fountain = 2;
+		const int bodyCount = water[0]->BodyCount();
+
+		std::unique_ptr<AsyncWaves> waves[2] =
+		{
+			std::make_unique<AsyncWaves>(*water[0], false),
+			std::make_unique<AsyncWaves>(*water[1], true)
+		};
+
+		// What the renderer keeps of each body: its vertices, and the version they are from.
+		std::vector<Waves::PackedVertex> copies[2][3];
+		std::uint64_t copyVersions[2][3] = {};
+		for(int s = 0; s < 2; ++s)
+		{
+			for(int b = 0; b < bodyCount; ++b)
+				copies[s][b].resize(water[s]->Body(b).VertexCount());
+		}
+
+		std::minstd_rand random(options.Seed);
+		for(int frame = 0; frame < frameCount; ++frame)
+		{
+			if(frame == frameCount / 2)
+			{
+				waves[0]->SetAsynchronous(true);
+				waves[1]->SetAsynchronous(false);
+			}
+
+			if(frame % 15 == 0)
+			{
+				for(int body : { lake, moat })
+				{
+					const Waves& w = water[0]->Body(body);
+					int i = std::uniform_int_distribution<int>(4, w.RowCount() - 5)(random);
+					int j = std::uniform_int_distribution<int>(4, w.ColumnCount() - 5)(random);
+					float magnitude = std::uniform_real_distribution<float>(0.2f, 0.5f)(random);
+					for(auto& run : waves)
+						run->Disturb(body, i, j, magnitude);
+				}
+				const Waves& f = water[0]->Body(fountain);
+				for(auto& run : waves)
+					run->Disturb(fountain, f.RowCount() / 2, f.ColumnCount() / 2, 0.15f, 3);
+			}
+
+			float angle = frame*dt*0.1f;
+			for(auto& run : waves)
+				run->Update(dt, 40.0f*std::cos(angle), 40.0f*std::sin(angle));
+			for(auto& run : waves)
+			{
+				run->Wait();
+				run->Acquire();
+			}
+
+			for(int b = 0; b < bodyCount; ++b)
+			{
+				int written[2];
+				for(int s = 0; s < 2; ++s)
+				{
+					written[s] = waves[s]->WriteChangedTiles(b, copyVersions[s][b], copies[s][b].data());
+					copyVersions[s][b] = waves[s]->Version(b);
+				}
+
+				DirectX::XMFLOAT2 origins[2] = { waves[0]->Origin(b), waves[1]->Origin(b) };
+				const char* difference = nullptr;
+				if(copyVersions[0][b] != copyVersions[1][b])
+					difference = "version";
+				else if(origins[0].x != origins[1].x || origins[0].y != origins[1].y)
+					difference = "origin";
+				else if(written[0] != written[1])
+					difference = "changed tiles";
+				else if(std::memcmp(copies[0][b].data(), copies[1][b].data(), copies[0][b].size()*sizeof(Waves::PackedVertex)) != 0)
+					difference = "vertices";
+
+				if(difference != nullptr)
+				{
+					std::fprintf(stderr, "frame %d body %d: %s differs between the %s and %s runs\n", frame, b, difference,
+						waves[0]->Asynchronous() ? "async" : "sync", waves[1]->Asynchronous() ? "async" : "sync");
+					return false;
+				}
+			}
+		}
+
+		std::fprintf(stderr, "%3d threads: sync and async agree over %d frames\n", schedulers[0]->ThreadCount(), frameCount);
+		return true;
+	}
+
+	// The heavy-splash workload: a 512 x 512 grid at rest, then 1000 frames of 1/60 s
+	// with 16 random splashes each, drawn from the given seed.
+	bool WriteScenario(const Options& options)
+	{
+		Waves waves(512, 512, kSpatialStep, kTimeStep, kSpeed, kDamping);
+		std::ofstream checkpoint(options.Checkpoint, std::ios::binary);
+		if(!waves.Save(checkpoint))
+			return false;
+
+		WavesLog log;
+		waves.SetLog(&log);
+
+		std::minstd_rand random(options.Seed);
+		std::uniform_int_distribution<int> row(1, waves.RowCount() - 2);
+		std::uniform_int_distribution<int> col(1, waves.ColumnCount() - 2);
+		std::uniform_int_distribution<int> radius(1, 4);
+		std::uniform_real_distribution<float> magnitude(0.2f, 0.8f);
+		for(int frame = 0; frame < 1000; ++frame)
+		{
+			for(int k = 0; k < 16; ++k)
+				waves.Disturb(row(random), col(random), magnitude(random), radius(random));
+			waves.Update(1.0f / 60.0f);
+		}
+
+		std::ofstream out(options.Log, std::ios::binary);
+		return log.Save(out);
+	}
+
+	// Restores the checkpoint and replays the log, three times, and keeps the fastest.
+	bool Replay(const Options& options, TaskScheduler& scheduler, ReplayResult& r)
+	{
+		std::ifstream checkpointFile(options.Checkpoint, std::ios::binary);
+		std::ifstream logFile(options.Log, std::ios::binary);
+		std::stringstream checkpoint;
+		checkpoint << checkpointFile.rdbuf();
+
+		WavesLog log;
+		if(!log.Load(logFile))
+			return false;
+
+		r.Threads = scheduler.ThreadCount();
+		r.Updates = 0;
+		for(const WavesLog::Event& e : log.Events)
+			r.Updates += e.Type == WavesLog::Event::Update;
+
+		r.Ms = 1.0e300;
+		for(int run = 0; run < 3; ++run)
+		{
+			Waves waves(2, 2, kSpatialStep, kTimeStep, kSpeed, kDamping);
+			waves.SetScheduler(scheduler);
+
+			std::istringstream in(checkpoint.str());
+			if(!waves.Load(in))
+				return false;
+			r.Rows = waves.RowCount();
+			r.Cols = waves.ColumnCount();
+
+			auto start = std::chrono::steady_clock::now();
+			waves.Replay(log);
+			r.Ms = std::min<double>(r.Ms, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+
+		return true;
+	}
+
+	void WriteReplayJson(FILE* f, const char* kernels, int hardwareThreads, const ReplayResult& r)
+	{
+		std::fprintf(f, "{\n");
+		std::fprintf(f, "  \"benchmark\": \"WavesBench replay\",\n");
+		std::fprintf(f, "  \"kernels\": \"%s\",\n", kernels);
+		std::fprintf(f, "  \"hardware_threads\": %d,\n", hardwareThreads);
+		std::fprintf(f, "  \"rows\": %d, \"cols\": %d, \"threads\": %d, \"updates\": %d, \"ms\": %.3f\n",
+			r.Rows, r.Cols, r.Threads, r.Updates, r.Ms);
+		std::fprintf(f, "}\n");
+	}
+
+	void WriteFrameJson(FILE* f, const char* kernels, int hardwareThreads, const std::vector<FrameResult>& results)
+	{
+		std::fprintf(f, "{\n");
+		std::fprintf(f, "  \"benchmark\": \"WavesBench frame\",\n");
+		std::fprintf(f, "  \"kernels\": \"%s\",\n", kernels);
+		std::fprintf(f, "  \"hardware_threads\": %d,\n", hardwareThreads);
+		std::fprintf(f, "  \"unit\": \"us/frame\",\n");
+		std::fprintf(f, "  \"results\": [\n");
+		for(size_t k = 0; k < results.size(); ++k)
+		{
+			const FrameResult& r = results[k];
+			std::fprintf(f,
+				"    { \"async\": %s, \"threads\": %d, \"objects\": %d, \"frames\": %d, "
+				"\"waves\": %.3f, \"objects_cb\": %.3f, \"materials\": %.3f, \"pass\": %.3f, \"frame\": %.3f, "
+				"\"waves_bytes\": %.0f, \"fence_stalls\": %d }%s\n",
+				r.Asynchronous ? "true" : "false", r.Threads, r.Objects, r.Frames,
+				r.WavesUs, r.ObjectsUs, r.MaterialsUs, r.PassUs, r.FrameUs, r.WavesBytes, r.Stalls,
+				k + 1 < results.size() ? "," : "");
+		}
+		std::fprintf(f, "  ]\n");
+		std::fprintf(f, "}\n");
+	}
+
+	void WriteJson(FILE* f, const char* kernels, int hardwareThreads, const std::vector<Result>& results)
+	{
+		std::fprintf(f, "{\n");
+		std::fprintf(f, "  \"benchmark\": \"WavesBench\",\n");
+		std::fprintf(f, "  \"kernels\": \"%s\",\n", kernels);
+		std::fprintf(f, "  \"hardware_threads\": %d,\n", hardwareThreads);
+		std::fprintf(f, "  \"unit\": \"ns/cell\",\n");
+		std::fprintf(f, "  \"results\": [\n");
+		for(size_t k = 0; k < results.size(); ++k)
+		{
+			const Result& r = results[k];
+			std::fprintf(f,
+				"    { \"rows\": %d, \"cols\": %d, \"threads\": %d, "
+				"\"step\": %.4f, \"two_pass_step\": %.4f, \"stencil\": %.4f, \"normals\": %.4f, \"pack\": %.4f, \"stream\": %.4f, "
+				"\"fused_checksum\": \"%016llx\", \"two_pass_checksum\": \"%016llx\" }%s\n",
+				r.Rows, r.Cols, r.Threads,
+				r.StepNs, r.TwoPassNs, r.StencilNs, r.NormalsNs, r.PackNs, r.StreamNs,
+				(unsigned long long)r.FusedChecksum, (unsigned long long)r.TwoPassChecksum,
+				k + 1 < results.size() ? "," : "");
+		}
+		std::fprintf(f, "  ]\n");
+		std::fprintf(f, "}\n");
+	}
+
+	bool ParseOptions(int argc, char** argv, Options& options)
+	{
+		for(int k = 1; k < argc; ++k)
+		{
+			bool hasValue = k + 1 < argc;
+			if(std::strcmp(argv[k], "-o") == 0 && hasValue)
+				options.Output = argv[++k];
+			else if(std::strcmp(argv[k], "-min-size") == 0 && hasValue)
+				options.MinSize = std::atoi(argv[++k]);
+			else if(std::strcmp(argv[k], "-max-size") == 0 && hasValue)
+				options.MaxSize = std::atoi(argv[++k]);
+			else if(std::strcmp(argv[k], "-threads") == 0 && hasValue)
+				options.MaxThreads = std::atoi(argv[++k]);
+			else if(std::strcmp(argv[k], "-time") == 0 && hasValue)
+				options.SecondsPerCase = std::atof(argv[++k]);
+			else if((std::strcmp(argv[k], "-replay") == 0 || std::strcmp(argv[k], "-scenario") == 0) && k + 2 < argc)
+			{
+				options.WriteScenario = std::strcmp(argv[k], "-scenario") == 0;
+				options.Checkpoint = argv[++k];
+				options.Log = argv[++k];
+			}
+			else if(std::strcmp(argv[k], "-seed") == 0 && hasValue)
+				options.Seed = (unsigned)std::strtoul(argv[++k], nullptr, 10);
+			else if(std::strcmp(argv[k], "-frame") == 0)
+				options.Frame = true;
+			else if(std::strcmp(argv[k], "-objects") == 0 && hasValue)
+				options.Objects = std::atoi(argv[++k]);
+			else if(std::strcmp(argv[k], "-verify") == 0)
+				options.Verify = true;
+			else if(std::strcmp(argv[k], "-check") == 0)
+				options.Check = true;
+			else
+				return false;
+		}
+
+		return options.MinSize >= 16 && options.MinSize <= options.MaxSize && options.SecondsPerCase > 0.0 &&
+			options.Objects >= 0;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if(!ParseOptions(argc, argv, options))
+	{
+		std::fprintf(stderr, "usage: WavesBench [-o results.json] [-min-size 128] [-max-size 4096] "
+			"[-threads N] [-time seconds]\n"
+			"       WavesBench -replay checkpoint.bin log.bin [-o results.json] [-threads N]\n"
+			"       WavesBench -scenario checkpoint.bin log.bin [-seed N]\n"
+			"       WavesBench -frame [-objects N] [-o results.json] [-threads N] [-time seconds]\n"
+			"       WavesBench -verify [-seed N] [-threads N]\n"
+			"       WavesBench -check\n");
+		return 1;
+	}
+
+	if(options.Check)
+		return CheckKernels() ? 0 : 1;
+
+	if(options.Verify)
+		return VerifyAsync(options) ? 0 : 1;
+
+	if(options.WriteScenario)
+	{
+		if(!WriteScenario(options))
+		{
+			std::fprintf(stderr, "WavesBench: cannot write %s and %s\n", options.Checkpoint, options.Log);
+			return 1;
+		}
+		return 0;
+	}
+
+	FILE* f = stdout;
+	if(options.Output != nullptr && (f = std::fopen(options.Output, "w")) == nullptr)
+	{
+		std::fprintf(stderr, "WavesBench: cannot open %s\n", options.Output);
+		return 1;
+	}
+
+	int hardwareThreads = (int)std::max<unsigned>(1u, std::thread::hardware_concurrency());
+	int maxThreads = options.MaxThreads > 0 ? options.MaxThreads : hardwareThreads;
+	const char* kernels = WavesKernels::Best().Name;
+
+	if(options.Checkpoint != nullptr)
+	{
+		ThreadPoolScheduler scheduler(maxThreads);
+		ReplayResult r;
+		if(!Replay(options, scheduler, r))
+		{
+			std::fprintf(stderr, "WavesBench: cannot replay %s and %s\n", options.Checkpoint, options.Log);
+			return 1;
+		}
+
+		std::fprintf(stderr, "%5d x %-5d %3d threads: %d updates replayed in %.3f ms\n",
+			r.Rows, r.Cols, r.Threads, r.Updates, r.Ms);
+		WriteReplayJson(f, kernels, hardwareThreads, r);
+		if(f != stdout)
+			std::fclose(f);
+		return 0;
+	}
+
+	// Powers of two up to the thread limit, plus the limit itself.
+	std::vector<int> threadCounts;
+	for(int t = 1; t < maxThreads; t *= 2)
+		threadCounts.push_back(t);
+	threadCounts.push_back(maxThreads);
+
+	if(options.Frame)
+	{
+		std::vector<FrameResult> results;
+		for(int threads : threadCounts)
+		{
+			ThreadPoolScheduler scheduler(threads);
+			for(bool asynchronous : { false, true })
+			{
+				FrameResult r = RunFrames(asynchronous, scheduler, options);
+				std::fprintf(stderr, "%s %3d threads %5d objects: waves %.2f  objects %.2f  materials %.2f  pass %.2f  "
+					"frame %.2f us/frame, %.0f B/frame of water, %d fence stalls\n",
+					r.Asynchronous ? "async" : "sync ", r.Threads, r.Objects,
+					r.WavesUs, r.ObjectsUs, r.MaterialsUs, r.PassUs, r.FrameUs, r.WavesBytes, r.Stalls);
+				results.push_back(r);
+			}
+		}
+
+		WriteFrameJson(f, kernels, hardwareThreads, results);
+		if(f != stdout)
+			std::fclose(f);
+		return 0;
+	}
+
+	std::vector<Result> results;
+	bool fusedMatches = true;
+	for(int threads : threadCounts)
+	{
+		ThreadPoolScheduler scheduler(threads);
+		for(int size = options.MinSize; size <= options.MaxSize; size *= 2)
+		{
+			Result r = Run(size, scheduler, options);
+			std::fprintf(stderr, "%5d x %-5d %3d threads: step %.3f  two-pass %.3f  stencil %.3f  normals %.3f  pack %.3f  "
+				"stream %.3f ns/cell%s\n",
+				r.Rows, r.Cols, r.Threads, r.StepNs, r.TwoPassNs, r.StencilNs, r.NormalsNs, r.PackNs, r.StreamNs,
+				r.FusedChecksum == r.TwoPassChecksum ? "" : "  FUSED AND TWO-PASS DIFFER");
+			fusedMatches = fusedMatches && r.FusedChecksum == r.TwoPassChecksum;
+			results.push_back(r);
+		}
+	}
+
+	WriteJson(f, kernels, hardwareThreads, results);
+	if(f != stdout)
+		std::fclose(f);
+	return fusedMatches ? 0 : 1;
+}
@@ -0,0 +1,231 @@
+//***************************************************************************************
+// AsyncWaves.cpp
+//***************************************************************************************
+
+#include "AsyncWaves.h"
+#include <algorithm>
+#include <cstring>
+
+AsyncWaves::AsyncWaves(WaterSystem& system, bool asynchronous)
+	: mSystem(system), mMiddle(1)
+{
+	// Fill every frame so the front one is valid before the first step.
+	for(Frame& frame : mFrames)
+	{
+		frame.Bodies.resize(mSystem.BodyCount());
+		for(int b = 0; b < mSystem.BodyCount(); ++b)
+			Pack(mSystem.Body(b), frame.Bodies[b]);
+	}
+
+	SetAsynchronous(asynchronous);
+}
+
+AsyncWaves::~AsyncWaves()
+{
+	SetAsynchronous(false);
+}
+
+void AsyncWaves::SetAsynchronous(bool asynchronous)
+{
+	if(asynchronous == mAsynchronous)
+		return;
+
+	if(asynchronous)
+	{
+		// Synchronous mode does not publish; catch the frames up first.
+		Publish();
+
+		mStop = false;
+		mWorker = std::thread(&AsyncWaves::WorkerMain, this);
+	}
+	else
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mStop = true;
+		}
+		mWake.notify_one();
+		mWorker.join();
+	}
+
+	mAsynchronous = asynchronous;
+}
+
+void AsyncWaves::Disturb(int body, int i, int j, float magnitude, int radius, float falloff)
+{
+	if(body < 0 || body >= mSystem.BodyCount())
+		return;
+
+	Splash s;
+	s.Body = body;
+	s.I = i;
+	s.J = j;
+	s.Magnitude = magnitude;
+	s.Radius = radius;
+	s.Falloff = falloff;
+
+	std::lock_guard<std::mutex> lock(mSplashMutex);
+	mSplashes.push_back(s);
+}
+
+void AsyncWaves::Update(float dt, float x, float z)
+{
+	Request request;
+	request.Dt = dt;
+	request.X = x;
+	request.Z = z;
+	{
+		std::lock_guard<std::mutex> lock(mSplashMutex);
+		request.Splashes.swap(mSplashes);
+	}
+
+	if(!mAsynchronous)
+	{
+		Run(request);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mRequests.push_back(std::move(request));
+	}
+	mWake.notify_one();
+}
+
+void AsyncWaves::Acquire()
+{
+	if(mAsynchronous && (mMiddle.load(std::memory_order_relaxed) & FreshBit))
+		mFront = mMiddle.exchange(mFront, std::memory_order_acq_rel) & ~FreshBit;
+}
+
+std::uint64_t AsyncWaves::Version(int body)const
+{
+	return mAsynchronous ? mFrames[mFront].Bodies[body].Version : mSystem.Body(body).Version();
+}
+
+DirectX::XMFLOAT2 AsyncWaves::Origin(int body)const
+{
+	return mAsynchronous ? mFrames[mFront].Bodies[body].Origin : mSystem.Body(body).Origin();
+}
+
+int AsyncWaves::WriteChangedTiles(int body, std::uint64_t version, Waves::PackedVertex* out)const
+{
+	const Waves& waves = mSystem.Body(body);
+	if(!mAsynchronous)
+		return waves.WriteChangedTiles(version, out);
+
+	// The worker may be stepping the simulation, so copy from the frame instead,
+	// merging neighbouring changed tiles the same way Waves does.
+	const BodyFrame& frame = mFrames[mFront].Bodies[body];
+	int m = waves.RowCount();
+	int n = waves.ColumnCount();
+	int tileRows = waves.TileRowCount();
+	int tileCols = waves.TileColumnCount();
+
+	int count = 0;
+	for(int tr = 0; tr < tileRows; ++tr)
+	{
+		for(int tc = 0; tc < tileCols; )
+		{
+			if(!frame.TileChangedSince(tr*tileCols + tc, version))
+			{
+				++tc;
+				continue;
+			}
+
+			int end = tc;
+			while(end < tileCols && frame.TileChangedSince(tr*tileCols + end, version))
+				++end;
+
+			int r0 = tr*Waves::TileSize;
+			int r1 = std::min<int>(m, r0 + Waves::TileSize);
+			int c0 = tc*Waves::TileSize;
+			int c1 = std::min<int>(n, end*Waves::TileSize);
+			for(int i = r0; i < r1; ++i)
+				std::memcpy(out + i*n + c0, &frame.Vertices[i*n + c0], (c1 - c0)*sizeof(Waves::PackedVertex));
+
+			count += (r1 - r0)*(c1 - c0);
+			tc = end;
+		}
+	}
+
+	return count;
+}
+
+void AsyncWaves::Wait()
+{
+	if(!mAsynchronous)
+		return;
+
+	std::unique_lock<std::mutex> lock(mMutex);
+	mIdle.wait(lock, [this]() { return mRequests.empty() && !mWorking; });
+}
+
+void AsyncWaves::WorkerMain()
+{
+	std::vector<Request> requests;
+
+	std::unique_lock<std::mutex> lock(mMutex);
+	for(;;)
+	{
+		mWake.wait(lock, [this]() { return mStop || !mRequests.empty(); });
+
+		// Only stop once everything queued has run.
+		if(mRequests.empty())
+			return;
+
+		requests.swap(mRequests);
+		mWorking = true;
+		lock.unlock();
+
+		// Run every request, in order, so the result matches synchronous mode; only
+		// the last state needs publishing.
+		for(const Request& request : requests)
+			Run(request);
+		requests.clear();
+		Publish();
+
+		lock.lock();
+		mWorking = false;
+		mIdle.notify_all();
+	}
+}
+
+void AsyncWaves::Run(const Request& request)
+{
+	for(const Splash& s : request.Splashes)
+		mSystem.Body(s.Body).Disturb(s.I, s.J, s.Magnitude, s.Radius, s.Falloff);
+
+	mSystem.Update(request.Dt, request.X, request.Z);
+}
+
+void AsyncWaves::Publish()
+{
+	Frame& frame = mFrames[mBack];
+	mSystem.Scheduler().ParallelFor(0, mSystem.BodyCount(), 1, [&](int first, int last)
+	{
+		for(int b = first; b < last; ++b)
+			Pack(mSystem.Body(b), frame.Bodies[b]);
+	});
+
+	mBack = mMiddle.exchange(mBack | FreshBit, std::memory_order_acq_rel) & ~FreshBit;
+}
+
+void AsyncWaves::Pack(const Waves& waves, BodyFrame& frame)
+{
+	int tileCount = waves.TileRowCount()*waves.TileColumnCount();
+	if(frame.Vertices.empty())
+	{
+		frame.Vertices.resize(waves.VertexCount());
+		frame.TileVersions.resize(tileCount);
+	}
+
+	// Only repack the tiles that changed since this frame was last filled.  The frame
+	// is read back by the renderer, so it is written with ordinary stores.
+	waves.WriteChangedTiles(frame.Version, frame.Vertices.data(), false);
+	for(int tile = 0; tile < tileCount; ++tile)
+		frame.TileVersions[tile] = waves.TileVersion(tile);
+
+	frame.Version = waves.Version();
+	frame.Origin = waves.Origin();
+}
@@ -0,0 +1,142 @@
+//***************************************************************************************
+// AsyncWaves.h
+//
+// Runs the water bodies of a WaterSystem one frame ahead of the renderer on a worker
+// thread.  Each finished batch of steps is packed into the GPU vertex format and
+// published through a triple buffer, so the renderer picks up the newest finished frame
+// without waiting and the worker never waits for the renderer.  In synchronous mode the
+// same work runs on the calling thread instead, with identical results, and the
+// renderer's copy is packed straight from the simulations with no frame in between.
+//***************************************************************************************
+
+#ifndef ASYNCWAVES_H
+#define ASYNCWAVES_H
+
+#include "WaterSystem.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class AsyncWaves
+{
+public:
+	// While this object exists the water system belongs to it: apart from the body
+	// dimensions and layout, only use it through this object.  Add every body before
+	// creating it.  The system must outlive it.
+	explicit AsyncWaves(WaterSystem& system, bool asynchronous = true);
+	AsyncWaves(const AsyncWaves& rhs) = delete;
+	AsyncWaves& operator=(const AsyncWaves& rhs) = delete;
+	~AsyncWaves();
+
+	// Switching to synchronous mode waits for the worker to finish its queued work.
+	bool Asynchronous()const { return mAsynchronous; }
+	void SetAsynchronous(bool asynchronous);
+
+	// Queues a splash on a body for the next Update; see Waves::Disturb.  Splashes on
+	// bodies that do not exist are dropped here, and splashes Waves::Disturb rejects
+	// when they are applied.  May be called from any thread, also during Update.
+	void Disturb(int body, int i, int j, float magnitude, int radius = 1, float falloff = 1.0f);
+
+	// Applies the queued splashes and updates the water system; see
+	// WaterSystem::Update.  In asynchronous mode this only hands the work to the worker.
+	void Update(float dt, float x, float z);
+
+	// Picks up the newest finished frame.  Version, Origin and WriteChangedTiles
+	// describe that frame until the next call to Acquire or Update.
+	void Acquire();
+
+	// Waves::Version() and Waves::Origin() of a body in the acquired frame.
+	std::uint64_t Version(int body)const;
+	DirectX::XMFLOAT2 Origin(int body)const;
+
+	// Writes the tiles of a body in the acquired frame that changed since the given
+	// version into out, which holds that body's grid row by row, and returns the
+	// number of vertices written.  Meant for mapped upload memory: the vertices are
+	// only written, never read.  In synchronous mode they are packed straight from
+	// the simulation with streaming stores.
+	int WriteChangedTiles(int body, std::uint64_t version, Waves::PackedVertex* out)const;
+
+	// Blocks until the worker has finished everything queued by Update.
+	void Wait();
+
+	// Waits for the worker, then hands out the water system for direct use, e.g. to
+	// save checkpoints or attach logs, until the next call to Update.
+	WaterSystem& System() { Wait(); return mSystem; }
+
+private:
+	// One body of a finished simulation frame, in the form the renderer uploads it.
+	struct BodyFrame
+	{
+		// Waves::Version() and Waves::Origin() of the solution held here.
+		std::uint64_t Version = 0;
+		DirectX::XMFLOAT2 Origin = { 0.0f, 0.0f };
+
+		// Every grid point, row by row.
+		std::vector<Waves::PackedVertex> Vertices;
+
+		// Waves::TileVersion() of every tile.
+		std::vector<std::uint64_t> TileVersions;
+
+		bool TileChangedSince(int tile, std::uint64_t version)const { return TileVersions[tile] > version; }
+	};
+
+	struct Frame
+	{
+		std::vector<BodyFrame> Bodies;
+	};
+
+	struct Splash
+	{
+		int Body = 0;
+		int I = 0;
+		int J = 0;
+		float Magnitude = 0.0f;
+		int Radius = 0;
+		float Falloff = 0.0f;
+	};
+
+	// Everything one call to Update asked for.
+	struct Request
+	{
+		float Dt = 0.0f;
+		float X = 0.0f;
+		float Z = 0.0f;
+		std::vector<Splash> Splashes;
+	};
+
+	void WorkerMain();
+	void Run(const Request& request);
+
+	// Brings the back frame up to date and swaps it with the middle one.
+	void Publish();
+	void Pack(const Waves& waves, BodyFrame& frame);
+
+private:
+	WaterSystem& mSystem;
+	bool mAsynchronous = false;
+
+	// Splashes queued since the last Update, guarded by mSplashMutex.
+	std::mutex mSplashMutex;
+	std::vector<Splash> mSplashes;
+
+	// Triple buffer.  The worker fills mFrames[mBack] and the renderer reads
+	// mFrames[mFront]; mMiddle holds the index of the third frame, plus FreshBit when
+	// it was published after the renderer last looked.
+	static const int FreshBit = 4;
+	Frame mFrames[3];
+	int mBack = 0;
+	std::atomic<int> mMiddle;
+	int mFront = 2;
+
+	std::thread mWorker;
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::condition_variable mIdle;
+	std::vector<Request> mRequests;
+	bool mWorking = false;
+	bool mStop = false;
+};
+
+#endif // ASYNCWAVES_H
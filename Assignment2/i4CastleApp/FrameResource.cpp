@@ -1,16 +1,11 @@
 #include "FrameResource.h"
 
-FrameResource::FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount, UINT waveVertCount)
+FrameResource::FrameResource(RenderDevice& device, std::uint32_t waveVertCount, std::uint32_t waterBodyCount)
 {
-    ThrowIfFailed(device->CreateCommandAllocator(
-        D3D12_COMMAND_LIST_TYPE_DIRECT,
-		IID_PPV_ARGS(CmdListAlloc.GetAddressOf())));
+    CmdListAlloc = device.CreateCommandAllocator();
 
-    PassCB = std::make_unique<UploadBuffer<PassConstants>>(device, passCount, true);
-	MaterialCB = std::make_unique<UploadBuffer<MaterialData>>(device, materialCount, false);
-    ObjectCB = std::make_unique<UploadBuffer<ObjectConstants>>(device, objectCount, true);
-
-	WavesVB = std::make_unique<UploadBuffer<Vertex>>(device, waveVertCount, false);
+	WavesVB = std::make_unique<UploadBuffer<Waves::PackedVertex>>(device, waveVertCount, false);
+	WavesVersions.assign(waterBodyCount, 0);
 }
 
 FrameResource::~FrameResource()
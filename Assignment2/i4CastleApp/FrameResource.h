@@ -1,17 +1,20 @@
 #pragma once
 
-#include "../../Common/d3dUtil.h"
 #include "../../Common/MathHelper.h"
-#include "../../Common/UploadBuffer.h"
+#include "../../Common/SceneTypes.h"
+#include "../../Common/RenderDevice.h"
+#include "../../Common/UploadBuffer.h"
+#include "../../Common/UploadRing.h"
+#include "Waves.h"
 
 struct ObjectConstants
 {
     DirectX::XMFLOAT4X4 World = MathHelper::Identity4x4();
 	DirectX::XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
-	UINT     MaterialIndex;
-	UINT     ObjPad0;
-	UINT     ObjPad1;
-	UINT     ObjPad2;
+	std::uint32_t MaterialIndex;
+	std::uint32_t ObjPad0;
+	std::uint32_t ObjPad1;
+	std::uint32_t ObjPad2;
 };
 
 struct PassConstants
@@ -50,10 +53,10 @@ struct MaterialData
 	// Used in texture mapping.
 	DirectX::XMFLOAT4X4 MatTransform = MathHelper::Identity4x4();
 
-	UINT DiffuseMapIndex = 0;
-	UINT MaterialPad0;
-	UINT MaterialPad1;
-	UINT MaterialPad2;
+	std::uint32_t DiffuseMapIndex = 0;
+	std::uint32_t MaterialPad0;
+	std::uint32_t MaterialPad1;
+	std::uint32_t MaterialPad2;
 };
 
 struct Vertex
@@ -63,32 +66,54 @@ struct Vertex
 	DirectX::XMFLOAT2 TexC;
 };
 
+// The water mesh is drawn from two vertex streams.  The grid position never
+// changes, so it lives in a static default-heap buffer (slot 0); only the height
+// and the normal are uploaded each frame (slot 1), packed into four bytes as a
+// Waves::PackedVertex.  The flat rings around the water only use the static stream.
+struct WaveStaticVertex
+{
+	DirectX::XMFLOAT2 PosXZ;
+};
+
 // Stores the resources needed for the CPU to build the command lists
-// for a frame.  
+// for a frame.  They come from a RenderDevice.
 struct FrameResource
 {
 public:
     
-    FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount, UINT waveVertCount);
+    FrameResource(RenderDevice& device, std::uint32_t waveVertCount, std::uint32_t waterBodyCount);
     FrameResource(const FrameResource& rhs) = delete;
     FrameResource& operator=(const FrameResource& rhs) = delete;
     ~FrameResource();
 
     // We cannot reset the allocator until the GPU is done processing the commands.
     // So each frame needs their own allocator.
-    Microsoft::WRL::ComPtr<ID3D12CommandAllocator> CmdListAlloc;
+    std::unique_ptr<GpuCommandAllocator> CmdListAlloc;
 
     // We cannot update a cbuffer until the GPU is done processing the commands
-    // that reference it.  So each frame needs their own cbuffers.
-    std::unique_ptr<UploadBuffer<PassConstants>> PassCB = nullptr;
-    std::unique_ptr<UploadBuffer<ObjectConstants>> ObjectCB = nullptr;
-	std::unique_ptr<UploadBuffer<MaterialData>> MaterialCB = nullptr;
+    // that reference it.  So each frame allocates its cbuffers anew from the
+    // shared UploadRing, which takes them back once the frame's fence is reached.
+    // They are sized for the current number of passes, objects and materials.
+    UploadRing::Array<PassConstants> PassCB;
+    UploadRing::Array<ObjectConstants> ObjectCB;
+	UploadRing::Array<MaterialData> MaterialCB;
+
+	// The ObjectConstants of the instanced draws, packed one after another and read
+	// by the instanced vertex shader as a structured buffer; see InstanceBatcher.
+	UploadRing::Array<ObjectConstants> InstanceBuffer;
 
 	// We cannot update a dynamic vertex buffer until the GPU is done processing
-   // the commands that reference it.  So each frame needs their own.
-	std::unique_ptr<UploadBuffer<Vertex>> WavesVB = nullptr;
+   // the commands that reference it.  So each frame needs their own.  It holds
+	// every water body, each in its own slice; see WaterSystem::FirstVertex.  It is
+	// not taken from the ring: it keeps its contents from one use of this frame
+	// resource to the next, so only the tiles that changed have to be rewritten.
+	std::unique_ptr<UploadBuffer<Waves::PackedVertex>> WavesVB = nullptr;
+
+	// Waves::Version() of each water body when its slice of WavesVB was last brought
+	// up to date; only the tiles that changed since then need to be copied again.
+	std::vector<std::uint64_t> WavesVersions;
 
     // Fence value to mark commands up to this fence point.  This lets us
     // check if these frame resources are still in use by the GPU.
-    UINT64 Fence = 0;
+    std::uint64_t Fence = 0;
 };
\ No newline at end of file
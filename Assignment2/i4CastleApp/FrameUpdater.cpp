@@ -0,0 +1,163 @@
+//***************************************************************************************
+// FrameUpdater.cpp
+//***************************************************************************************
+
+#include "FrameUpdater.h"
+#include <algorithm>
+
+using namespace DirectX;
+
+FrameUpdater::FrameUpdater(UploadRing& ring)
+	: mRing(ring)
+{
+}
+
+void FrameUpdater::UpdateObjectCBs(FrameResource& frame)
+{
+	std::uint32_t objectCount = 0;
+	for(ObjectState* e : mObjects)
+		objectCount = std::max<std::uint32_t>(objectCount, e->ObjCBIndex + 1);
+	mObjectConstants.resize(objectCount);
+
+	for(ObjectState* e : mObjects)
+	{
+		// Only rebuild the constants if the object has changed.
+		if(e->NumFramesDirty > 0)
+		{
+			XMMATRIX world = XMLoadFloat4x4(&e->World);
+			XMMATRIX texTransform = XMLoadFloat4x4(&e->TexTransform);
+
+			ObjectConstants& objConstants = mObjectConstants[e->ObjCBIndex];
+			XMStoreFloat4x4(&objConstants.World, XMMatrixTranspose(world));
+			XMStoreFloat4x4(&objConstants.TexTransform, XMMatrixTranspose(texTransform));
+			objConstants.MaterialIndex = e->Mat->MatCBIndex;
+
+			e->NumFramesDirty = 0;
+		}
+	}
+
+	// This frame's cbuffer is new, so every object is copied into it.
+	auto& currObjectCB = frame.ObjectCB;
+	currObjectCB = mRing.AllocateArray<ObjectConstants>(objectCount, true);
+	for(std::uint32_t i = 0; i < objectCount; ++i)
+		currObjectCB.CopyData(i, mObjectConstants[i]);
+}
+
+void FrameUpdater::UpdateInstanceBuffer(const InstanceBatcher& batcher, FrameResource& frame)
+{
+	// A structured buffer, so the instances are packed rather than 256 bytes apart.
+	const std::vector<std::uint32_t>& instances = batcher.Instances();
+	auto& currInstanceBuffer = frame.InstanceBuffer;
+	currInstanceBuffer = mRing.AllocateArray<ObjectConstants>((std::uint32_t)instances.size(), false);
+	for(size_t i = 0; i < instances.size(); ++i)
+		currInstanceBuffer.CopyData((int)i, mObjectConstants[instances[i]]);
+}
+
+void FrameUpdater::UpdateMaterialBuffer(const std::unordered_map<std::string, std::unique_ptr<Material>>& materials,
+	FrameResource& frame)
+{
+	std::uint32_t materialCount = 0;
+	for(auto& e : materials)
+		materialCount = std::max<std::uint32_t>(materialCount, e.second->MatCBIndex + 1);
+	mMaterialData.resize(materialCount);
+
+	for(auto& e : materials)
+	{
+		// Only rebuild the material data if the constants have changed.
+		Material* mat = e.second.get();
+		if(mat->NumFramesDirty > 0)
+		{
+			XMMATRIX matTransform = XMLoadFloat4x4(&mat->MatTransform);
+
+			MaterialData& matData = mMaterialData[mat->MatCBIndex];
+			matData.DiffuseAlbedo = mat->DiffuseAlbedo;
+			matData.FresnelR0 = mat->FresnelR0;
+			matData.Roughness = mat->Roughness;
+			XMStoreFloat4x4(&matData.MatTransform, XMMatrixTranspose(matTransform));
+			//matData.DiffuseMapIndex = mat->DiffuseSrvHeapIndex;
+
+			mat->NumFramesDirty = 0;
+		}
+	}
+
+	// Each material is bound as a root CBV, so each one gets a 256-byte slot.
+	auto& currMaterialBuffer = frame.MaterialCB;
+	currMaterialBuffer = mRing.AllocateArray<MaterialData>(materialCount, true);
+	for(std::uint32_t i = 0; i < materialCount; ++i)
+		currMaterialBuffer.CopyData(i, mMaterialData[i]);
+}
+
+void FrameUpdater::UpdateMainPassCB(FXMMATRIX view, CXMMATRIX proj, const XMFLOAT3& eyePos,
+	float width, float height, float totalTime, float deltaTime, FrameResource& frame)
+{
+	XMMATRIX viewProj = XMMatrixMultiply(view, proj);
+	XMVECTOR viewDet = XMMatrixDeterminant(view);
+	XMVECTOR projDet = XMMatrixDeterminant(proj);
+	XMVECTOR viewProjDet = XMMatrixDeterminant(viewProj);
+	XMMATRIX invView = XMMatrixInverse(&viewDet, view);
+	XMMATRIX invProj = XMMatrixInverse(&projDet, proj);
+	XMMATRIX invViewProj = XMMatrixInverse(&viewProjDet, viewProj);
+
+	XMStoreFloat4x4(&mMainPassCB.View, XMMatrixTranspose(view));
+	XMStoreFloat4x4(&mMainPassCB.InvView, XMMatrixTranspose(invView));
+	XMStoreFloat4x4(&mMainPassCB.Proj, XMMatrixTranspose(proj));
+	XMStoreFloat4x4(&mMainPassCB.InvProj, XMMatrixTranspose(invProj));
+	XMStoreFloat4x4(&mMainPassCB.ViewProj, XMMatrixTranspose(viewProj));
+	XMStoreFloat4x4(&mMainPassCB.InvViewProj, XMMatrixTranspose(invViewProj));
+	mMainPassCB.EyePosW = eyePos;
+	mMainPassCB.RenderTargetSize = XMFLOAT2(width, height);
+	mMainPassCB.InvRenderTargetSize = XMFLOAT2(1.0f / width, 1.0f / height);
+	mMainPassCB.NearZ = 1.0f;
+	mMainPassCB.FarZ = 1000.0f;
+	mMainPassCB.TotalTime = totalTime;
+	mMainPassCB.DeltaTime = deltaTime;
+	mMainPassCB.AmbientLight = { 0.25f, 0.25f, 0.35f, 1.0f };
+	mMainPassCB.Lights[0].Direction = { 0.57735f, -0.57735f, 0.57735f };
+	mMainPassCB.Lights[0].Strength = { 0.2f, 0.2f, 0.2f };
+	//mMainPassCB.Lights[1].Direction = { -0.57735f, -0.57735f, 0.57735f };
+	mMainPassCB.Lights[1].Strength = { 1.0f, 1.0f, 1.0f };
+	mMainPassCB.Lights[1].Position = { 0.0f, 3.0f, -7.8f };
+	mMainPassCB.Lights[2].Strength = { 1.0f, 0.0f, 0.0f };
+	mMainPassCB.Lights[2].Position = { 4.0f, 6.0f, 0.0f };
+	mMainPassCB.Lights[3].Strength = { 0.0f, 1.0f, 0.0f };
+	mMainPassCB.Lights[3].Position = { -4.0f, 6.0f, 0.0f };
+	mMainPassCB.Lights[4].Strength = { 0.0f, 0.0f, 1.0f };
+	mMainPassCB.Lights[4].Position = { 4.0f, 6.0f, 8.0f };
+	mMainPassCB.Lights[5].Strength = { 1.0f, 1.0f, 0.0f };
+	mMainPassCB.Lights[5].Position = { -4.0f, 6.0f, 8.0f };
+	mMainPassCB.Lights[6].Strength = { 1.0f, 1.0f, 1.0f };
+	mMainPassCB.Lights[6].Position = { 0.0f, 10.0f, 6.0f };
+
+	auto& currPassCB = frame.PassCB;
+	currPassCB = mRing.AllocateArray<PassConstants>(1, true);
+	currPassCB.CopyData(0, mMainPassCB);
+}
+
+std::uint64_t FrameUpdater::UpdateWaves(const AsyncWaves& waves, const WaterSystem& water,
+	const std::vector<XMFLOAT3>& positions, FrameResource& frame)
+{
+	std::uint64_t bytes = 0;
+	for(int b = 0; b < water.BodyCount(); ++b)
+	{
+		// Place the body at its origin.
+		XMFLOAT2 origin = waves.Origin(b);
+		XMFLOAT3 pos = positions[b];
+		ObjectState* object = mObjects[b];
+		if(pos.x + origin.x != object->World._41 || pos.z + origin.y != object->World._43)
+		{
+			XMMATRIX world = XMMatrixTranslation(pos.x + origin.x, pos.y, pos.z + origin.y);
+			XMStoreFloat4x4(&object->World, world);
+			object->NumFramesDirty = gNumFrameResources;
+		}
+
+		// Bring this frame resource's copy of the body's heights and normals up to
+		// date.  Only the tiles that changed since it was last written are packed,
+		// straight into the body's slice of the mapped vertex buffer.
+		std::uint64_t& version = frame.WavesVersions[b];
+		int written = waves.WriteChangedTiles(b, version, frame.WavesVB->MappedData() + water.FirstVertex(b));
+		bytes += (std::uint64_t)written*sizeof(Waves::PackedVertex);
+		version = waves.Version(b);
+	}
+
+	return bytes;
+}
@@ -0,0 +1,109 @@
+//***************************************************************************************
+// FrameUpdater.h
+//
+// The CPU side of a frame of the castle scene: the object, material and pass constants
+// and the water vertices, written into a FrameResource.  It only talks to the device
+// through UploadRing and UploadBuffer; WavesBench runs and times it on a
+// HostRenderDevice.
+//***************************************************************************************
+
+#ifndef FRAMEUPDATER_H
+#define FRAMEUPDATER_H
+
+#include "FrameResource.h"
+#include "AsyncWaves.h"
+#include "InstanceBatcher.h"
+#include <unordered_map>
+
+// The part of a render item the per-frame updates read and write.  RenderItem adds
+// the draw parameters.
+struct ObjectState
+{
+	// World matrix of the shape that describes the object's local space
+	// relative to the world space, which defines the position, orientation,
+	// and scale of the object in the world.
+	DirectX::XMFLOAT4X4 World = MathHelper::Identity4x4();
+
+	DirectX::XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
+
+	// Dirty flag indicating the object data has changed and we need to rebuild its constants.
+	// The constants are kept on the CPU and copied into a new cbuffer every frame, so
+	// rebuilding them once is enough; any value above zero marks the item dirty.
+	int NumFramesDirty = gNumFrameResources;
+
+	// Index into GPU constant buffer corresponding to the ObjectCB for this render item.
+	std::uint32_t ObjCBIndex = -1;
+
+	Material* Mat = nullptr;
+};
+
+class FrameUpdater
+{
+public:
+	// Every frame's constants come out of the ring, which must outlive this object.
+	explicit FrameUpdater(UploadRing& ring);
+	FrameUpdater(const FrameUpdater& rhs) = delete;
+	FrameUpdater& operator=(const FrameUpdater& rhs) = delete;
+
+	// Rebuilds the constants of the objects that changed and copies every object's
+	// constants into a new frame.ObjectCB.  objects is a list of pointers to ObjectState
+	// or to a type derived from it.
+	template<typename ObjectList>
+	void UpdateObjectCBs(const ObjectList& objects, FrameResource& frame)
+	{
+		mObjects.clear();
+		for(auto& e : objects)
+			mObjects.push_back(&static_cast<ObjectState&>(*e));
+		UpdateObjectCBs(frame);
+	}
+
+	// Copies the constants of the instances the batcher last gathered, in order, into
+	// a new frame.InstanceBuffer.  Call after UpdateObjectCBs, which rebuilds them.
+	void UpdateInstanceBuffer(const InstanceBatcher& batcher, FrameResource& frame);
+
+	// Same for the materials, into frame.MaterialCB.
+	void UpdateMaterialBuffer(const std::unordered_map<std::string, std::unique_ptr<Material>>& materials,
+		FrameResource& frame);
+
+	// Fills in the pass constants for the given camera and render target, plus the
+	// scene's lights, and copies them into a new frame.PassCB.
+	void UpdateMainPassCB(DirectX::FXMMATRIX view, DirectX::CXMMATRIX proj, const DirectX::XMFLOAT3& eyePos,
+		float width, float height, float totalTime, float deltaTime, FrameResource& frame);
+
+	// Places the bodies of water in the frame last acquired from waves at their
+	// positions plus their origins, and brings frame.WavesVB up to date with it.  water
+	// is the system waves runs, only used for its layout.  bodyObjects is a list of
+	// pointers to the bodies' objects, as for UpdateObjectCBs.  Returns the number of
+	// bytes written to the vertex buffer.
+	template<typename ObjectList>
+	std::uint64_t UpdateWaves(const AsyncWaves& waves, const WaterSystem& water,
+		const std::vector<DirectX::XMFLOAT3>& positions, const ObjectList& bodyObjects, FrameResource& frame)
+	{
+		mObjects.clear();
+		for(auto& e : bodyObjects)
+			mObjects.push_back(&static_cast<ObjectState&>(*e));
+		return UpdateWaves(waves, water, positions, frame);
+	}
+
+	const PassConstants& MainPassCB()const { return mMainPassCB; }
+
+private:
+	void UpdateObjectCBs(FrameResource& frame);
+	std::uint64_t UpdateWaves(const AsyncWaves& waves, const WaterSystem& water,
+		const std::vector<DirectX::XMFLOAT3>& positions, FrameResource& frame);
+
+private:
+	UploadRing& mRing;
+
+	// The objects passed to the current update.
+	std::vector<ObjectState*> mObjects;
+
+	// The object and material constants are kept here between frames, indexed by
+	// ObjCBIndex and MatCBIndex, and only rebuilt when they change.
+	std::vector<ObjectConstants> mObjectConstants;
+	std::vector<MaterialData> mMaterialData;
+
+	PassConstants mMainPassCB;
+};
+
+#endif // FRAMEUPDATER_H
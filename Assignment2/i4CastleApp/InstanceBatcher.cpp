@@ -0,0 +1,52 @@
+//***************************************************************************************
+// InstanceBatcher.cpp
+//***************************************************************************************
+
+#include "InstanceBatcher.h"
+
+int InstanceBatcher::Add(const BatchKey& key, std::uint32_t objCBIndex, int cullIndex)
+{
+	KeyTuple k(key.Layer, key.Geometry, key.PrimitiveType, key.IndexCount, key.StartIndexLocation,
+		key.BaseVertexLocation, key.Material);
+	auto it = mBatchIndices.find(k);
+	if(it == mBatchIndices.end())
+	{
+		Batch batch;
+		batch.Key = key;
+		mBatches.push_back(batch);
+
+		it = mBatchIndices.insert(std::make_pair(k, (int)mBatches.size() - 1)).first;
+		if(key.Layer >= (int)mLayerBatches.size())
+			mLayerBatches.resize(key.Layer + 1);
+		mLayerBatches[key.Layer].push_back(it->second);
+	}
+
+	Batch& batch = mBatches[it->second];
+	batch.Objects.push_back(objCBIndex);
+	batch.CullIndices.push_back(cullIndex);
+	return it->second;
+}
+
+void InstanceBatcher::Gather(const FrustumCuller& culler)
+{
+	mInstances.clear();
+	mBatchDrawCount = 0;
+	for(Batch& batch : mBatches)
+	{
+		batch.FirstInstance = (std::uint32_t)mInstances.size();
+		for(size_t i = 0; i < batch.Objects.size(); ++i)
+		{
+			int cullIndex = batch.CullIndices[i];
+			if(cullIndex < 0 || culler.Visible(cullIndex))
+				mInstances.push_back(batch.Objects[i]);
+		}
+		batch.InstanceCount = (std::uint32_t)mInstances.size() - batch.FirstInstance;
+		mBatchDrawCount += batch.InstanceCount > 0 ? 1 : 0;
+	}
+}
+
+const std::vector<int>& InstanceBatcher::LayerBatches(int layer)const
+{
+	static const std::vector<int> none;
+	return layer < (int)mLayerBatches.size() ? mLayerBatches[layer] : none;
+}
@@ -0,0 +1,82 @@
+//***************************************************************************************
+// InstanceBatcher.h
+//
+// Groups render items that draw the same submesh of the same geometry with the same
+// material and pipeline state, so each group can be drawn with one instanced draw
+// call.  Every frame the objects of each group that pass frustum culling are listed
+// one after the other; their ObjectConstants are copied in that order into a
+// structured buffer, which the instanced vertex shader indexes by SV_InstanceID from
+// the group's first instance.
+//***************************************************************************************
+
+#ifndef INSTANCEBATCHER_H
+#define INSTANCEBATCHER_H
+
+#include "../../Common/FrustumCuller.h"
+#include <cstdint>
+#include <map>
+#include <tuple>
+#include <vector>
+
+class InstanceBatcher
+{
+public:
+	// What the objects of a batch have in common.  Layer stands for the pipeline
+	// state; Geometry and Material only identify and are never dereferenced.
+	struct BatchKey
+	{
+		int Layer = 0;
+		const void* Geometry = nullptr;
+		int PrimitiveType = 0;
+		std::uint32_t IndexCount = 0;
+		std::uint32_t StartIndexLocation = 0;
+		std::int32_t BaseVertexLocation = 0;
+		const void* Material = nullptr;
+	};
+
+	struct Batch
+	{
+		BatchKey Key;
+
+		// ObjCBIndex and FrustumCuller index of each object; a cull index of -1 means
+		// the object is always drawn.
+		std::vector<std::uint32_t> Objects;
+		std::vector<int> CullIndices;
+
+		// Set by Gather: the batch's visible objects are Instances()[FirstInstance,
+		// FirstInstance + InstanceCount).
+		std::uint32_t FirstInstance = 0;
+		std::uint32_t InstanceCount = 0;
+	};
+
+	// Adds an object to the batch with its key, and returns that batch's index.
+	int Add(const BatchKey& key, std::uint32_t objCBIndex, int cullIndex);
+
+	// Lists the objects of every batch that passed the culler's last call to Cull.
+	void Gather(const FrustumCuller& culler);
+
+	const std::vector<Batch>& Batches()const { return mBatches; }
+
+	// Indices of the batches of a layer, in the order they were first added to.
+	const std::vector<int>& LayerBatches(int layer)const;
+
+	// ObjCBIndex of each instance listed by the last call to Gather.
+	const std::vector<std::uint32_t>& Instances()const { return mInstances; }
+
+	// Draw calls for the last call to Gather: one per visible object without
+	// instancing, one per batch with a visible object with it.
+	int ObjectDrawCount()const { return (int)mInstances.size(); }
+	int BatchDrawCount()const { return mBatchDrawCount; }
+
+private:
+	typedef std::tuple<int, const void*, int, std::uint32_t, std::uint32_t, std::int32_t, const void*> KeyTuple;
+
+	std::vector<Batch> mBatches;
+	std::map<KeyTuple, int> mBatchIndices;
+	std::vector<std::vector<int>> mLayerBatches;
+
+	std::vector<std::uint32_t> mInstances;
+	int mBatchDrawCount = 0;
+};
+
+#endif // INSTANCEBATCHER_H
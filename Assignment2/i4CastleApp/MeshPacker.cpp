@@ -0,0 +1,116 @@
+//***************************************************************************************
+// MeshPacker.cpp
+//***************************************************************************************
+
+#include "MeshPacker.h"
+#include <algorithm>
+
+using namespace DirectX;
+
+void MeshPacker::Add(const std::string& name, const GeometryGenerator::MeshData& mesh)
+{
+	PackedMesh packed;
+	packed.Name = name;
+	mMeshes.push_back(packed);
+	mSources.push_back(&mesh);
+}
+
+void MeshPacker::Pack(TaskScheduler& scheduler)
+{
+	const int meshCount = (int)mSources.size();
+
+	// Each mesh starts where the previous one ends.  16-bit indices address the
+	// vertices of one mesh, since each is drawn from its own base vertex.
+	std::uint32_t vertexCount = 0;
+	std::uint32_t indexCount = 0;
+	mUses32BitIndices = false;
+	for(int i = 0; i < meshCount; ++i)
+	{
+		const GeometryGenerator::MeshData& mesh = *mSources[i];
+		PackedMesh& packed = mMeshes[i];
+		packed.IndexCount = (std::uint32_t)mesh.Indices32.size();
+		packed.StartIndexLocation = indexCount;
+		packed.BaseVertexLocation = (std::int32_t)vertexCount;
+
+		vertexCount += (std::uint32_t)mesh.Vertices.size();
+		indexCount += packed.IndexCount;
+		if(mesh.Vertices.size() > 0x10000)
+			mUses32BitIndices = true;
+	}
+
+	mVertices.resize(vertexCount);
+	mIndices16.clear();
+	mIndices32.clear();
+	if(mUses32BitIndices)
+		mIndices32.resize(indexCount);
+	else
+		mIndices16.resize(indexCount);
+
+	// A few chunks per thread balances meshes of very different sizes.
+	int grain = std::max<int>(1, meshCount / (scheduler.ThreadCount()*4));
+	scheduler.ParallelFor(0, meshCount, grain, [this](int first, int last)
+	{
+		for(int i = first; i < last; ++i)
+		{
+			const GeometryGenerator::MeshData& mesh = *mSources[i];
+			PackedMesh& packed = mMeshes[i];
+
+			Vertex* vertices = mVertices.data() + packed.BaseVertexLocation;
+			XMVECTOR vMin = XMVectorReplicate(+MathHelper::Infinity);
+			XMVECTOR vMax = XMVectorReplicate(-MathHelper::Infinity);
+			for(size_t v = 0; v < mesh.Vertices.size(); ++v)
+			{
+				const GeometryGenerator::Vertex& source = mesh.Vertices[v];
+				vertices[v].Pos = source.Position;
+				vertices[v].Normal = source.Normal;
+				vertices[v].TexC = source.TexC;
+
+				XMVECTOR p = XMLoadFloat3(&source.Position);
+				vMin = XMVectorMin(vMin, p);
+				vMax = XMVectorMax(vMax, p);
+			}
+
+			if(!mesh.Vertices.empty())
+			{
+				XMStoreFloat3(&packed.BoundsCenter, 0.5f*(vMin + vMax));
+				XMStoreFloat3(&packed.BoundsExtents, 0.5f*(vMax - vMin));
+			}
+			else
+			{
+				packed.BoundsCenter = XMFLOAT3(0.0f, 0.0f, 0.0f);
+				packed.BoundsExtents = XMFLOAT3(0.0f, 0.0f, 0.0f);
+			}
+
+			if(mUses32BitIndices)
+			{
+				std::copy(mesh.Indices32.begin(), mesh.Indices32.end(),
+					mIndices32.begin() + packed.StartIndexLocation);
+			}
+			else
+			{
+				std::uint16_t* indices = mIndices16.data() + packed.StartIndexLocation;
+				for(size_t k = 0; k < mesh.Indices32.size(); ++k)
+					indices[k] = (std::uint16_t)mesh.Indices32[k];
+			}
+		}
+	});
+}
+
+const void* MeshPacker::IndexData()const
+{
+	if(mUses32BitIndices)
+		return mIndices32.data();
+	return mIndices16.data();
+}
+
+std::uint32_t MeshPacker::IndexCount()const
+{
+	return (std::uint32_t)(mUses32BitIndices ? mIndices32.size() : mIndices16.size());
+}
+
+std::uint32_t MeshPacker::IndexByteSize()const
+{
+	if(mUses32BitIndices)
+		return (std::uint32_t)(mIndices32.size()*sizeof(std::uint32_t));
+	return (std::uint32_t)(mIndices16.size()*sizeof(std::uint16_t));
+}
@@ -0,0 +1,71 @@
+//***************************************************************************************
+// MeshPacker.h
+//
+// Packs any number of GeometryGenerator meshes into one vertex buffer and one index
+// buffer, the way every MeshGeometry of the demos is laid out: each mesh's vertices
+// and indices follow the previous mesh's, and its indices stay relative to its first
+// vertex, which becomes its BaseVertexLocation.
+//
+// The offsets come out of one pass over the mesh sizes; the vertices and indices are
+// then copied, and each mesh's bounds computed, in parallel, a mesh at a time.  The
+// indices are 16-bit unless some mesh has more vertices than they can address.
+//***************************************************************************************
+
+#ifndef MESHPACKER_H
+#define MESHPACKER_H
+
+#include "../../Common/GeometryGenerator.h"
+#include "../../Common/TaskScheduler.h"
+#include "FrameResource.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class MeshPacker
+{
+public:
+	// Where a mesh ended up, and its local-space bounds as a center and half extents.
+	struct PackedMesh
+	{
+		std::string Name;
+		std::uint32_t IndexCount = 0;
+		std::uint32_t StartIndexLocation = 0;
+		std::int32_t BaseVertexLocation = 0;
+		DirectX::XMFLOAT3 BoundsCenter = { 0.0f, 0.0f, 0.0f };
+		DirectX::XMFLOAT3 BoundsExtents = { 0.0f, 0.0f, 0.0f };
+	};
+
+	// Adds a mesh to pack under the given name.  Only a pointer is kept, so the mesh
+	// has to live until Pack returns.
+	void Add(const std::string& name, const GeometryGenerator::MeshData& mesh);
+
+	// Lays out and copies every mesh added so far.  Packing again repacks them all.
+	void Pack(TaskScheduler& scheduler = TaskScheduler::Default());
+
+	// The meshes, in the order they were added.
+	const std::vector<PackedMesh>& Meshes()const { return mMeshes; }
+
+	const std::vector<Vertex>& Vertices()const { return mVertices; }
+	std::uint32_t VertexByteSize()const { return (std::uint32_t)(mVertices.size()*sizeof(Vertex)); }
+
+	// The indices are in Indices16 or Indices32, as Uses32BitIndices says; IndexData
+	// points at whichever is used.
+	bool Uses32BitIndices()const { return mUses32BitIndices; }
+	const std::vector<std::uint16_t>& Indices16()const { return mIndices16; }
+	const std::vector<std::uint32_t>& Indices32()const { return mIndices32; }
+	const void* IndexData()const;
+	std::uint32_t IndexCount()const;
+	std::uint32_t IndexByteSize()const;
+
+private:
+	// The meshes added, and where Pack put them.
+	std::vector<const GeometryGenerator::MeshData*> mSources;
+	std::vector<PackedMesh> mMeshes;
+
+	std::vector<Vertex> mVertices;
+	std::vector<std::uint16_t> mIndices16;
+	std::vector<std::uint32_t> mIndices32;
+	bool mUses32BitIndices = false;
+};
+
+#endif // MESHPACKER_H
@@ -30,6 +30,17 @@ struct MaterialData
 	uint     MatPad2;
 };
 
+// Laid out like cbPerObject; one per instance of an instanced draw.
+struct InstanceData
+{
+	float4x4 World;
+	float4x4 TexTransform;
+	uint     MaterialIndex;
+	uint     InstPad0;
+	uint     InstPad1;
+	uint     InstPad2;
+};
+
 
 // An array of textures, which is only supported in shader model 5.1+.  Unlike Texture2DArray, the textures
 // in this array can be different sizes and formats, making it more flexible than texture arrays.
@@ -39,6 +50,9 @@ Texture2D gDiffuseMap[4] : register(t0);
 // The texture array will occupy registers t0, t1, ..., t3 in space0. 
 StructuredBuffer<MaterialData> gMaterialData : register(t0, space1);
 
+// The instances of the current instanced draw, starting at its first one.
+StructuredBuffer<InstanceData> gInstanceData : register(t1, space1);
+
 
 SamplerState gsamPointWrap        : register(s0);
 SamplerState gsamPointClamp       : register(s1);
@@ -97,36 +111,101 @@ struct VertexOut
     float3 PosW    : POSITION;
     float3 NormalW : NORMAL;
 	float2 TexC    : TEXCOORD;
+
+	// The same for every vertex of a draw, so it is not interpolated.
+	nointerpolation uint MatIndex : MATINDEX;
 };
 
-VertexOut VS(VertexIn vin)
+VertexOut TransformVertex(VertexIn vin, float4x4 world, float4x4 texTransform, uint materialIndex)
 {
 	VertexOut vout = (VertexOut)0.0f;
 
 	// Fetch the material data.
-	MaterialData matData = gMaterialData[gMaterialIndex];
+	MaterialData matData = gMaterialData[materialIndex];
 	
     // Transform to world space.
-    float4 posW = mul(float4(vin.PosL, 1.0f), gWorld);
+    float4 posW = mul(float4(vin.PosL, 1.0f), world);
     vout.PosW = posW.xyz;
 
     // Assumes nonuniform scaling; otherwise, need to use inverse-transpose of world matrix.
-    vout.NormalW = mul(vin.NormalL, (float3x3)gWorld);
+    vout.NormalW = mul(vin.NormalL, (float3x3)world);
 
     // Transform to homogeneous clip space.
     vout.PosH = mul(posW, gViewProj);
 	
 	// Output vertex attributes for interpolation across triangle.
-	float4 texC = mul(float4(vin.TexC, 0.0f, 1.0f), gTexTransform);
+	float4 texC = mul(float4(vin.TexC, 0.0f, 1.0f), texTransform);
 	vout.TexC = mul(texC, matData.MatTransform).xy;
+	vout.MatIndex = materialIndex;
 	
     return vout;
 }
 
+VertexOut VS(VertexIn vin)
+{
+	return TransformVertex(vin, gWorld, gTexTransform, gMaterialIndex);
+}
+
+// Draws many objects sharing a mesh and a material in one call; each instance takes
+// its constants from gInstanceData instead of cbPerObject.
+VertexOut InstancedVS(VertexIn vin, uint instanceID : SV_InstanceID)
+{
+	InstanceData instData = gInstanceData[instanceID];
+	return TransformVertex(vin, instData.World, instData.TexTransform, instData.MaterialIndex);
+}
+
+// The water is drawn from two vertex streams: the grid position is static (slot 0),
+// the height and normal change every frame (slot 1).  The normal arrives octahedron
+// encoded; the wave normals always point up, so only the upper half of the
+// octahedron is used.  The water moves to follow the camera, so its texture
+// coordinates come from the world position rather than from the mesh.
+struct WavesVertexIn
+{
+	float2 PosXZ     : POSITION;
+	float  Height    : HEIGHT;
+	float2 NormalOct : NORMAL;
+};
+
+struct WaterRingsVertexIn
+{
+	float2 PosXZ : POSITION;
+};
+
+float2 WaterTexC(float3 posL)
+{
+	float3 posW = mul(float4(posL, 1.0f), gWorld).xyz;
+	return float2(posW.x, -posW.z);
+}
+
+float3 DecodeOctahedralNormal(float2 e)
+{
+	return normalize(float3(e.x, 1.0f - abs(e.x) - abs(e.y), e.y));
+}
+
+VertexOut WavesVS(WavesVertexIn vin)
+{
+	VertexIn v;
+	v.PosL    = float3(vin.PosXZ.x, vin.Height, vin.PosXZ.y);
+	v.NormalL = DecodeOctahedralNormal(vin.NormalOct);
+	v.TexC    = WaterTexC(v.PosL);
+
+	return VS(v);
+}
+
+VertexOut WaterRingsVS(WaterRingsVertexIn vin)
+{
+	VertexIn v;
+	v.PosL    = float3(vin.PosXZ.x, 0.0f, vin.PosXZ.y);
+	v.NormalL = float3(0.0f, 1.0f, 0.0f);
+	v.TexC    = WaterTexC(v.PosL);
+
+	return VS(v);
+}
+
 float4 PS(VertexOut pin) : SV_Target
 {
 	// Fetch the material data.
-	MaterialData matData = gMaterialData[gMaterialIndex];
+	MaterialData matData = gMaterialData[pin.MatIndex];
 	float4 diffuseAlbedo = matData.DiffuseAlbedo;
 	float3 fresnelR0 = matData.FresnelR0;
 	float  roughness = matData.Roughness;
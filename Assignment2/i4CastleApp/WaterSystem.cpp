@@ -0,0 +1,49 @@
+//***************************************************************************************
+// WaterSystem.cpp
+//***************************************************************************************
+
+#include "WaterSystem.h"
+#include <algorithm>
+
+WaterSystem::WaterSystem(TaskScheduler& scheduler)
+	: mScheduler(&scheduler)
+{
+}
+
+int WaterSystem::AddBody(int m, int n, float dx, float dt, float speed, float damping, bool followsCamera)
+{
+	Entry e;
+	e.Sim = std::make_unique<Waves>(m, n, dx, dt, speed, damping);
+	e.Sim->SetScheduler(*mScheduler);
+	e.Sim->SetFixedGridSize(true);
+	e.FollowsCamera = followsCamera;
+	e.FirstVertex = mVertexCount;
+
+	mVertexCount += e.Sim->VertexCount();
+	mBodies.push_back(std::move(e));
+
+	int body = (int)mBodies.size() - 1;
+	mLargestFirst.push_back(body);
+	std::stable_sort(mLargestFirst.begin(), mLargestFirst.end(), [this](int a, int b)
+	{
+		return mBodies[a].Sim->VertexCount() > mBodies[b].Sim->VertexCount();
+	});
+
+	return body;
+}
+
+void WaterSystem::Update(float dt, float x, float z)
+{
+	// One task per body.  Each body splits its own rows on the same scheduler, so a
+	// thread that finishes a small body goes on to steal rows of a large one.
+	mScheduler->ParallelFor(0, BodyCount(), 1, [&](int first, int last)
+	{
+		for(int k = first; k < last; ++k)
+		{
+			Entry& e = mBodies[mLargestFirst[k]];
+			if(e.FollowsCamera)
+				e.Sim->Recenter(x, z);
+			e.Sim->Update(dt);
+		}
+	});
+}
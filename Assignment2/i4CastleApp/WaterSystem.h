@@ -0,0 +1,66 @@
+//***************************************************************************************
+// WaterSystem.h
+//
+// A set of independent water bodies (a lake, a moat, a fountain...), each its own Waves
+// simulation with its own grid size and constants.  All of them are stepped together on
+// one TaskScheduler.  Their vertices are laid out one after the other, so a single
+// vertex buffer holds every body and each body draws from its own slice of it.
+//***************************************************************************************
+
+#ifndef WATERSYSTEM_H
+#define WATERSYSTEM_H
+
+#include "Waves.h"
+#include <memory>
+#include <vector>
+
+class WaterSystem
+{
+public:
+	// The scheduler steps the bodies and the rows inside them; it must outlive this
+	// object.
+	explicit WaterSystem(TaskScheduler& scheduler = TaskScheduler::Default());
+	WaterSystem(const WaterSystem& rhs) = delete;
+	WaterSystem& operator=(const WaterSystem& rhs) = delete;
+
+	// Adds an m x n body (see Waves::Waves) and returns its index.  A body that
+	// follows the camera is scrolled to stay under it (see Waves::Recenter); the
+	// others stay where they are.  The body's grid size is fixed from then on (see
+	// Waves::SetFixedGridSize), so loading a checkpoint cannot move the others'
+	// vertices.
+	int AddBody(int m, int n, float dx, float dt, float speed, float damping, bool followsCamera);
+
+	int BodyCount()const { return (int)mBodies.size(); }
+	Waves& Body(int body) { return *mBodies[body].Sim; }
+	const Waves& Body(int body)const { return *mBodies[body].Sim; }
+	bool FollowsCamera(int body)const { return mBodies[body].FollowsCamera; }
+
+	// Index of the first vertex of a body in the shared vertex layout, and the total
+	// number of vertices of all bodies.
+	int FirstVertex(int body)const { return mBodies[body].FirstVertex; }
+	int VertexCount()const { return mVertexCount; }
+
+	TaskScheduler& Scheduler()const { return *mScheduler; }
+
+	// Scrolls the bodies that follow the camera to the world point (x, z), then
+	// advances every body by dt seconds.  The bodies run in parallel, largest first,
+	// so the small ones fill in around the large ones instead of being left for last.
+	void Update(float dt, float x, float z);
+
+private:
+	struct Entry
+	{
+		std::unique_ptr<Waves> Sim;
+		bool FollowsCamera = false;
+		int FirstVertex = 0;
+	};
+
+	TaskScheduler* mScheduler = nullptr;
+	std::vector<Entry> mBodies;
+	int mVertexCount = 0;
+
+	// Body indices by decreasing cell count.
+	std::vector<int> mLargestFirst;
+};
+
+#endif // WATERSYSTEM_H
@@ -3,21 +3,177 @@
 //***************************************************************************************
 
 #include "Waves.h"
-#include <ppl.h>
 #include <algorithm>
 #include <vector>
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <istream>
+#include <ostream>
 
 using namespace DirectX;
 
-Waves::Waves(int m, int n, float dx, float dt, float speed, float damping)
+namespace
 {
-    mNumRows = m;
-    mNumCols = n;
+	// Moves a rows x cols plane so that plane[i][j] becomes plane[i+dr][j+dc], and
+	// fills the points that have no source with rest.
+	template<typename T>
+	void ScrollPlane(std::vector<T>& plane, int rows, int cols, int dr, int dc, T rest)
+	{
+		std::vector<T> moved(plane.size(), rest);
 
-    mVertexCount = m*n;
-    mTriangleCount = (m - 1)*(n - 1) * 2;
+		int j0 = std::max(0, -dc);
+		int j1 = std::min(cols, cols - dc);
+		for(int i = std::max(0, -dr); i < std::min(rows, rows - dr) && j0 < j1; ++i)
+		{
+			const T* src = &plane[(i + dr)*cols + j0 + dc];
+			std::copy(src, src + (j1 - j0), &moved[i*cols + j0]);
+		}
+
+		plane.swap(moved);
+	}
+
+	// Checkpoints and logs are raw little structures of fixed-size fields, written
+	// in the byte order of the machine.
+	const char kCheckpointTag[4] = { 'W', 'A', 'V', 'S' };
+	const char kLogTag[4] = { 'W', 'L', 'O', 'G' };
+	const std::uint32_t kFormatVersion = 1;
+
+	// The largest grid a checkpoint may hold, and so the largest splash radius a log
+	// may hold; a larger radius reaches no more points.
+	const std::int32_t kMaxGridSize = 65536;
+
+	// Beyond 2^24 tiles a float no longer holds a whole tile count, and the shift in
+	// grid points would overflow an int.
+	const float kMaxRecenterTiles = 16777216.0f;
+
+	template<typename T>
+	void WriteValue(std::ostream& out, const T& value)
+	{
+		out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
 
+	template<typename T>
+	bool ReadValue(std::istream& in, T& value)
+	{
+		return (bool)in.read(reinterpret_cast<char*>(&value), sizeof(T));
+	}
+
+	template<typename T>
+	void WritePlane(std::ostream& out, const std::vector<T>& plane)
+	{
+		out.write(reinterpret_cast<const char*>(plane.data()), plane.size()*sizeof(T));
+	}
+
+	template<typename T>
+	bool ReadPlane(std::istream& in, std::vector<T>& plane, size_t count)
+	{
+		// A bounded chunk at a time, so a truncated or corrupt stream claiming a huge
+		// grid fails once its data runs out instead of allocating the whole claim.
+		const size_t chunk = (size_t)1 << 20;
+		plane.clear();
+		while(plane.size() < count)
+		{
+			size_t first = plane.size();
+			size_t size = std::min<size_t>(chunk, count - first);
+			plane.resize(first + size);
+			if(!in.read(reinterpret_cast<char*>(plane.data() + first), size*sizeof(T)))
+				return false;
+		}
+		return true;
+	}
+
+	void WriteHeader(std::ostream& out, const char (&tag)[4])
+	{
+		out.write(tag, 4);
+		WriteValue(out, kFormatVersion);
+	}
+
+	bool ReadHeader(std::istream& in, const char (&tag)[4])
+	{
+		char found[4];
+		std::uint32_t version = 0;
+		return in.read(found, 4) && std::memcmp(found, tag, 4) == 0 &&
+			ReadValue(in, version) && version == kFormatVersion;
+	}
+}
+
+bool WavesLog::Save(std::ostream& out)const
+{
+	WriteHeader(out, kLogTag);
+	WriteValue(out, (std::uint64_t)Events.size());
+	for(const Event& e : Events)
+	{
+		WriteValue(out, (std::uint32_t)e.Type);
+		switch(e.Type)
+		{
+		case Event::Splash:
+			WriteValue(out, (std::int32_t)e.I);
+			WriteValue(out, (std::int32_t)e.J);
+			WriteValue(out, e.Magnitude);
+			WriteValue(out, (std::int32_t)e.Radius);
+			WriteValue(out, e.Falloff);
+			break;
+		case Event::Recenter:
+			WriteValue(out, e.X);
+			WriteValue(out, e.Z);
+			break;
+		case Event::Update:
+			WriteValue(out, e.Dt);
+			break;
+		}
+	}
+
+	return (bool)out;
+}
+
+bool WavesLog::Load(std::istream& in)
+{
+	std::uint64_t count = 0;
+	if(!ReadHeader(in, kLogTag) || !ReadValue(in, count))
+		return false;
+
+	std::vector<Event> events;
+	for(std::uint64_t k = 0; k < count; ++k)
+	{
+		Event e;
+		std::uint32_t type = 0;
+		std::int32_t i = 0, j = 0, radius = 0;
+		if(!ReadValue(in, type))
+			return false;
+
+		bool ok = false;
+		switch(type)
+		{
+		case Event::Splash:
+			ok = ReadValue(in, i) && ReadValue(in, j) && ReadValue(in, e.Magnitude) &&
+				ReadValue(in, radius) && ReadValue(in, e.Falloff);
+			ok = ok && std::isfinite(e.Magnitude) && std::isfinite(e.Falloff) &&
+				radius >= 0 && radius <= kMaxGridSize;
+			e.I = i;
+			e.J = j;
+			e.Radius = radius;
+			break;
+		case Event::Recenter:
+			ok = ReadValue(in, e.X) && ReadValue(in, e.Z) && std::isfinite(e.X) && std::isfinite(e.Z);
+			break;
+		case Event::Update:
+			ok = ReadValue(in, e.Dt) && std::isfinite(e.Dt);
+			break;
+		}
+		if(!ok)
+			return false;
+
+		e.Type = (Event::Kind)type;
+		events.push_back(e);
+	}
+
+	Events.swap(events);
+	return true;
+}
+
+Waves::Waves(int m, int n, float dx, float dt, float speed, float damping)
+{
     mTimeStep = dt;
     mSpatialStep = dx;
 
@@ -27,34 +183,44 @@ Waves::Waves(int m, int n, float dx, float dt, float speed, float damping)
     mK2 = (4.0f - 8.0f*e) / d;
     mK3 = (2.0f*e) / d;
 
-    mPrevSolution.resize(m*n);
-    mCurrSolution.resize(m*n);
-    mNormals.resize(m*n);
-    mTangentX.resize(m*n);
-
-    // Generate grid vertices in system memory.
-
-    float halfWidth = (n - 1)*dx*0.5f;
-    float halfDepth = (m - 1)*dx*0.5f;
-    for(int i = 0; i < m; ++i)
-    {
-        float z = halfDepth - i*dx;
-        for(int j = 0; j < n; ++j)
-        {
-            float x = -halfWidth + j*dx;
-
-            mPrevSolution[i*n + j] = XMFLOAT3(x, 0.0f, z);
-            mCurrSolution[i*n + j] = XMFLOAT3(x, 0.0f, z);
-            mNormals[i*n + j] = XMFLOAT3(0.0f, 1.0f, 0.0f);
-            mTangentX[i*n + j] = XMFLOAT3(1.0f, 0.0f, 0.0f);
-        }
-    }
+    AllocateGrid(m, n);
 }
 
 Waves::~Waves()
 {
 }
 
+void Waves::AllocateGrid(int m, int n)
+{
+    mNumRows = m;
+    mNumCols = n;
+
+    mVertexCount = m*n;
+    mTriangleCount = (m - 1)*(n - 1) * 2;
+
+    mHalfWidth = (n - 1)*mSpatialStep*0.5f;
+    mHalfDepth = (m - 1)*mSpatialStep*0.5f;
+
+    // The grid starts out flat.  Positions in the xz-plane are implied by the
+    // grid indices, so only the heights need to be stored.
+    mPrevSolution.assign(m*n, 0.0f);
+    mCurrSolution.assign(m*n, 0.0f);
+    mNormalX.assign(m*n, 0.0f);
+    mNormalY.assign(m*n, 1.0f);
+    mNormalZ.assign(m*n, 0.0f);
+    mTangentXX.assign(m*n, 1.0f);
+    mTangentXY.assign(m*n, 0.0f);
+
+    // The water starts at rest, so every tile starts inactive.
+    mTileRows = (m + TileSize - 1) / TileSize;
+    mTileCols = (n + TileSize - 1) / TileSize;
+    mTileActive.assign(mTileRows*mTileCols, 0);
+    mTileStepped.assign(mTileRows*mTileCols, 0);
+    mTileActivity.assign(mTileRows*mTileCols, 0.0f);
+    mTileVersion.assign(mTileRows*mTileCols, mVersion);
+    mBandSpans.assign(mTileRows + 1, 0);
+}
+
 int Waves::RowCount()const
 {
 	return mNumRows;
@@ -85,88 +251,616 @@ float Waves::Depth()const
 	return mNumRows*mSpatialStep;
 }
 
-void Waves::Update(float dt)
+int Waves::ActiveTileCount()const
 {
-	static float t = 0;
+	int count = 0;
+	for(auto a : mTileActive)
+		count += a;
+
+	return count;
+}
+
+int Waves::WriteChangedTiles(std::uint64_t version, PackedVertex* out, bool streaming)const
+{
+	WavesKernels::PackRowFn pack = streaming ? mKernels.StreamRow : mKernels.PackRow;
+
+	int count = 0;
+	for(int tr = 0; tr < mTileRows; ++tr)
+	{
+		for(int tc = 0; tc < mTileCols; )
+		{
+			if(!TileChangedSince(tr*mTileCols + tc, version))
+			{
+				++tc;
+				continue;
+			}
+
+			int end = tc;
+			while(end < mTileCols && TileChangedSince(tr*mTileCols + end, version))
+				++end;
+
+			int r0 = tr*TileSize;
+			int r1 = std::min(mNumRows, r0 + TileSize);
+			int c0 = tc*TileSize;
+			int c1 = std::min(mNumCols, end*TileSize);
+			for(int i = r0; i < r1; ++i)
+			{
+				int k = i*mNumCols + c0;
+				pack(&mCurrSolution[k], &mNormalX[k], &mNormalY[k], &mNormalZ[k], c1 - c0, out + k);
+			}
+
+			count += (r1 - r0)*(c1 - c0);
+			tc = end;
+		}
+	}
+
+	if(streaming)
+		mKernels.EndStream();
+
+	return count;
+}
+
+int Waves::Update(float dt)
+{
+	ApplyDisturbances();
+
+	if(mLog != nullptr)
+	{
+		WavesLog::Event e;
+		e.Type = WavesLog::Event::Update;
+		e.Dt = dt;
+		mLog->Events.push_back(e);
+	}
 
 	// Accumulate time.
-	t += dt;
+	mAccumulator += dt;
+
+	// Only update the simulation at the specified time step, but take as many
+	// steps as the elapsed time calls for so the speed does not depend on the
+	// frame rate.
+	int steps = 0;
+	while(mAccumulator >= mTimeStep && steps < mMaxSubsteps)
+	{
+		if(mFusedUpdate)
+			StepFused();
+		else
+			StepTwoPass();
+
+		mAccumulator -= mTimeStep;
+		++steps;
+	}
+
+	// Hit the cap: drop the whole steps we could not afford, keep the fraction.
+	if(mAccumulator >= mTimeStep)
+		mAccumulator = std::fmod(mAccumulator, mTimeStep);
+
+	mAlpha = mAccumulator / mTimeStep;
+
+	return steps;
+}
+
+bool Waves::BeginStep()
+{
+	// Step every active tile plus a one tile halo around it.  A wave moves at most one
+	// grid point per step, so anything outside the halo is still at rest afterwards.
+	bool any = false;
+	for(int tr = 0; tr < mTileRows; ++tr)
+	{
+		for(int tc = 0; tc < mTileCols; ++tc)
+		{
+			bool stepped = false;
+			for(int r = std::max(0, tr - 1); r <= std::min(mTileRows - 1, tr + 1) && !stepped; ++r)
+			{
+				for(int c = std::max(0, tc - 1); c <= std::min(mTileCols - 1, tc + 1); ++c)
+				{
+					if(mTileActive[r*mTileCols + c])
+					{
+						stepped = true;
+						break;
+					}
+				}
+			}
+
+			mTileStepped[tr*mTileCols + tc] = stepped;
+			mTileActivity[tr*mTileCols + tc] = 0.0f;
+			any |= stepped;
+		}
+	}
+
+	// Merge neighbouring stepped tiles of each tile row into runs of interior columns.
+	mSpans.clear();
+	for(int tr = 0; tr < mTileRows; ++tr)
+	{
+		mBandSpans[tr] = (int)mSpans.size();
+		for(int tc = 0; tc < mTileCols; )
+		{
+			if(!mTileStepped[tr*mTileCols + tc])
+			{
+				++tc;
+				continue;
+			}
+
+			int end = tc;
+			while(end < mTileCols && mTileStepped[tr*mTileCols + end])
+				++end;
+
+			Span span;
+			span.First = std::max(1, tc*TileSize);
+			span.Last = std::min(mNumCols - 1, end*TileSize);
+			if(span.First < span.Last)
+				mSpans.push_back(span);
+
+			tc = end;
+		}
+	}
+	mBandSpans[mTileRows] = (int)mSpans.size();
+
+	return any;
+}
+
+void Waves::EndStep()
+{
+	++mVersion;
+	for(int t = 0; t < mTileRows*mTileCols; ++t)
+	{
+		if(!mTileStepped[t])
+			continue;
+
+		MarkChanged(t);
+
+		mTileActive[t] = mTileActivity[t] > mActivityThreshold;
+		if(!mTileActive[t])
+			SnapTile(t);
+	}
+}
+
+void Waves::StepFused()
+{
+	if(!BeginStep())
+		return;
 
-	// Only update the simulation at the specified time step.
-	if( t >= mTimeStep )
+	// Each tile row is a chunk.  Within it the stencil runs one row ahead of the
+	// normals: once row i has its new heights, rows i-2..i are final and the normals
+	// of row i-1 can be computed while those rows are still in cache.  The new
+	// heights live in the previous solution buffer until the swap at the end.
+	//
+	// Columns outside the stepped spans belong to tiles at rest, whose heights are
+	// zero in both buffers, so reading them as "new" heights is correct.
+	mScheduler->ParallelFor(0, mTileRows, 1, [this](int firstBand, int lastBand)
 	{
-		// Only update interior points; we use zero boundary conditions.
-		concurrency::parallel_for(1, mNumRows - 1, [this](int i)
-		//for(int i = 1; i < mNumRows-1; ++i)
+		for(int band = firstBand; band < lastBand; ++band)
 		{
-			for(int j = 1; j < mNumCols-1; ++j)
+			int first, last;
+			BandRows(band, first, last);
+
+			for(int i = first; i < last; ++i)
+			{
+				for(int s = mBandSpans[band]; s < mBandSpans[band+1]; ++s)
+					StencilRow(band, i, mSpans[s].First, mSpans[s].Last);
+
+				// The first row of the band also reads the last row of the band above,
+				// which may not be done yet; it is handled below.
+				if(i - 1 > first)
+				{
+					for(int s = mBandSpans[band]; s < mBandSpans[band+1]; ++s)
+						NormalRow(mPrevSolution, i - 1, mSpans[s].First, mSpans[s].Last);
+				}
+			}
+		}
+	});
+
+	// Every band has finished, so the rows on band boundaries can now be done.
+	mScheduler->ParallelFor(0, mTileRows, 1, [this](int firstBand, int lastBand)
+	{
+		for(int band = firstBand; band < lastBand; ++band)
+		{
+			int first, last;
+			BandRows(band, first, last);
+
+			for(int s = mBandSpans[band]; s < mBandSpans[band+1]; ++s)
 			{
-				// After this update we will be discarding the old previous
-				// buffer, so overwrite that buffer with the new update.
-				// Note how we can do this inplace (read/write to same element) 
-				// because we won't need prev_ij again and the assignment happens last.
-
-				// Note j indexes x and i indexes z: h(x_j, z_i, t_k)
-				// Moreover, our +z axis goes "down"; this is just to 
-				// keep consistent with our row indices going down.
-
-				mPrevSolution[i*mNumCols+j].y = 
-					mK1*mPrevSolution[i*mNumCols+j].y +
-					mK2*mCurrSolution[i*mNumCols+j].y +
-					mK3*(mCurrSolution[(i+1)*mNumCols+j].y + 
-					     mCurrSolution[(i-1)*mNumCols+j].y + 
-					     mCurrSolution[i*mNumCols+j+1].y + 
-						 mCurrSolution[i*mNumCols+j-1].y);
+				if(first < last)
+					NormalRow(mPrevSolution, first, mSpans[s].First, mSpans[s].Last);
+				if(last - 1 > first)
+					NormalRow(mPrevSolution, last - 1, mSpans[s].First, mSpans[s].Last);
 			}
-		});
+		}
+	});
 
-		// We just overwrote the previous buffer with the new data, so
-		// this data needs to become the current solution and the old
-		// current solution becomes the new previous solution.
-		std::swap(mPrevSolution, mCurrSolution);
+	// We just overwrote the previous buffer with the new data, so
+	// this data needs to become the current solution and the old
+	// current solution becomes the new previous solution.
+	std::swap(mPrevSolution, mCurrSolution);
 
-		t = 0.0f; // reset time
+	EndStep();
+}
+
+void Waves::StepTwoPass()
+{
+	if(!BeginStep())
+		return;
 
-		//
-		// Compute normals using finite difference scheme.
-		//
-		concurrency::parallel_for(1, mNumRows - 1, [this](int i)
-		//for(int i = 1; i < mNumRows - 1; ++i)
+	// Only update interior points; we use zero boundary conditions.
+	mScheduler->ParallelFor(0, mTileRows, 1, [this](int firstBand, int lastBand)
+	{
+		for(int band = firstBand; band < lastBand; ++band)
 		{
-			for(int j = 1; j < mNumCols-1; ++j)
+			int first, last;
+			BandRows(band, first, last);
+
+			for(int i = first; i < last; ++i)
 			{
-				float l = mCurrSolution[i*mNumCols+j-1].y;
-				float r = mCurrSolution[i*mNumCols+j+1].y;
-				float t = mCurrSolution[(i-1)*mNumCols+j].y;
-				float b = mCurrSolution[(i+1)*mNumCols+j].y;
-				mNormals[i*mNumCols+j].x = -r+l;
-				mNormals[i*mNumCols+j].y = 2.0f*mSpatialStep;
-				mNormals[i*mNumCols+j].z = b-t;
-
-				XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&mNormals[i*mNumCols+j]));
-				XMStoreFloat3(&mNormals[i*mNumCols+j], n);
-
-				mTangentX[i*mNumCols+j] = XMFLOAT3(2.0f*mSpatialStep, r-l, 0.0f);
-				XMVECTOR T = XMVector3Normalize(XMLoadFloat3(&mTangentX[i*mNumCols+j]));
-				XMStoreFloat3(&mTangentX[i*mNumCols+j], T);
+				for(int s = mBandSpans[band]; s < mBandSpans[band+1]; ++s)
+					StencilRow(band, i, mSpans[s].First, mSpans[s].Last);
 			}
-		});
+		}
+	});
+
+	// We just overwrote the previous buffer with the new data, so
+	// this data needs to become the current solution and the old
+	// current solution becomes the new previous solution.
+	std::swap(mPrevSolution, mCurrSolution);
+
+	//
+	// Compute normals using finite difference scheme.
+	//
+	mScheduler->ParallelFor(0, mTileRows, 1, [this](int firstBand, int lastBand)
+	{
+		for(int band = firstBand; band < lastBand; ++band)
+		{
+			int first, last;
+			BandRows(band, first, last);
+
+			for(int i = first; i < last; ++i)
+			{
+				for(int s = mBandSpans[band]; s < mBandSpans[band+1]; ++s)
+					NormalRow(mCurrSolution, i, mSpans[s].First, mSpans[s].Last);
+			}
+		}
+	});
+
+	EndStep();
+}
+
+void Waves::BandRows(int band, int& first, int& last)const
+{
+	first = std::max(1, band*TileSize);
+	last = std::min(mNumRows - 1, (band + 1)*TileSize);
+}
+
+void Waves::StencilRow(int band, int i, int c0, int c1)
+{
+	// After this update we will be discarding the old previous
+	// buffer, so overwrite that buffer with the new update.
+	// Note how we can do this inplace (read/write to same element) 
+	// because we won't need prev_ij again and the assignment happens last.
+
+	// Note j indexes x and i indexes z: h(x_j, z_i, t_k)
+	// Moreover, our +z axis goes "down"; this is just to 
+	// keep consistent with our row indices going down.
+	const float* curr = &mCurrSolution[i*mNumCols + c0];
+	float* next = &mPrevSolution[i*mNumCols + c0];
+	mKernels.StencilRow(next, curr - mNumCols, curr, curr + mNumCols,
+		c1 - c0, mK1, mK2, mK3);
+
+	// Only this thread touches the tiles of this band, so no locking is needed.
+	for(int j = c0; j < c1; )
+	{
+		int tile = band*mTileCols + j / TileSize;
+		int end = std::min(c1, (j / TileSize + 1)*TileSize);
+
+		float a = mKernels.ActivityRow(next + (j - c0), curr + (j - c0), end - j);
+		mTileActivity[tile] = std::max(mTileActivity[tile], a);
+
+		j = end;
 	}
 }
 
-void Waves::Disturb(int i, int j, float magnitude)
+void Waves::NormalRow(const std::vector<float>& heights, int i, int c0, int c1)
+{
+	const float* h = &heights[i*mNumCols + c0];
+	int k = i*mNumCols + c0;
+	mKernels.NormalRow(h - mNumCols, h, h + mNumCols,
+		c1 - c0, 2.0f*mSpatialStep,
+		&mNormalX[k], &mNormalY[k], &mNormalZ[k],
+		&mTangentXX[k], &mTangentXY[k]);
+}
+
+void Waves::SnapTile(int tile)
+{
+	int tr = tile / mTileCols;
+	int tc = tile % mTileCols;
+
+	int r0 = std::max(1, tr*TileSize);
+	int r1 = std::min(mNumRows - 1, (tr + 1)*TileSize);
+	int c0 = std::max(1, tc*TileSize);
+	int c1 = std::min(mNumCols - 1, (tc + 1)*TileSize);
+
+	for(int i = r0; i < r1; ++i)
+	{
+		int k = i*mNumCols;
+		std::fill(&mPrevSolution[k + c0], &mPrevSolution[k + c1], 0.0f);
+		std::fill(&mCurrSolution[k + c0], &mCurrSolution[k + c1], 0.0f);
+		std::fill(&mNormalX[k + c0], &mNormalX[k + c1], 0.0f);
+		std::fill(&mNormalY[k + c0], &mNormalY[k + c1], 1.0f);
+		std::fill(&mNormalZ[k + c0], &mNormalZ[k + c1], 0.0f);
+		std::fill(&mTangentXX[k + c0], &mTangentXX[k + c1], 1.0f);
+		std::fill(&mTangentXY[k + c0], &mTangentXY[k + c1], 0.0f);
+	}
+}
+
+bool Waves::Recenter(float x, float z)
+{
+	// Whole tiles keep the point-to-tile mapping intact, so the tile state can be
+	// scrolled along with the planes.  Rows run towards -z.
+	float tileWidth = TileSize*mSpatialStep;
+	float tilesX = (x - mOrigin.x) / tileWidth;
+	float tilesZ = (z - mOrigin.y) / tileWidth;
+
+	// Ignore points that are not finite or too far off to count tiles to exactly.
+	if(!(std::fabs(tilesX) < kMaxRecenterTiles) || !(std::fabs(tilesZ) < kMaxRecenterTiles))
+		return false;
+
+	int dTileCols = (int)tilesX;
+	int dTileRows = -(int)tilesZ;
+	if(dTileCols == 0 && dTileRows == 0)
+		return false;
+
+	ApplyDisturbances();
+
+	if(mLog != nullptr)
+	{
+		WavesLog::Event e;
+		e.Type = WavesLog::Event::Recenter;
+		e.X = x;
+		e.Z = z;
+		mLog->Events.push_back(e);
+	}
+
+	mOrigin.x += dTileCols*tileWidth;
+	mOrigin.y -= dTileRows*tileWidth;
+
+	int dr = dTileRows*TileSize;
+	int dc = dTileCols*TileSize;
+	int m = mNumRows;
+	int n = mNumCols;
+	ScrollPlane(mPrevSolution, m, n, dr, dc, 0.0f);
+	ScrollPlane(mCurrSolution, m, n, dr, dc, 0.0f);
+	ScrollPlane(mNormalX, m, n, dr, dc, 0.0f);
+	ScrollPlane(mNormalY, m, n, dr, dc, 1.0f);
+	ScrollPlane(mNormalZ, m, n, dr, dc, 0.0f);
+	ScrollPlane(mTangentXX, m, n, dr, dc, 1.0f);
+	ScrollPlane(mTangentXY, m, n, dr, dc, 0.0f);
+	ScrollPlane(mTileActive, mTileRows, mTileCols, dTileRows, dTileCols, (std::uint8_t)0);
+
+	// Points that were interior may now lie on the boundary, which stays at rest.
+	for(int j = 0; j < n; ++j)
+	{
+		mPrevSolution[j] = mCurrSolution[j] = 0.0f;
+		mPrevSolution[(m - 1)*n + j] = mCurrSolution[(m - 1)*n + j] = 0.0f;
+	}
+	for(int i = 0; i < m; ++i)
+	{
+		mPrevSolution[i*n] = mCurrSolution[i*n] = 0.0f;
+		mPrevSolution[i*n + n - 1] = mCurrSolution[i*n + n - 1] = 0.0f;
+	}
+
+	++mVersion;
+	for(int t = 0; t < mTileRows*mTileCols; ++t)
+		MarkChanged(t);
+
+	return true;
+}
+
+bool Waves::Save(std::ostream& out)const
+{
+	WriteHeader(out, kCheckpointTag);
+	WriteValue(out, (std::int32_t)mNumRows);
+	WriteValue(out, (std::int32_t)mNumCols);
+	WriteValue(out, mK1);
+	WriteValue(out, mK2);
+	WriteValue(out, mK3);
+	WriteValue(out, mTimeStep);
+	WriteValue(out, mSpatialStep);
+	WriteValue(out, mAccumulator);
+	WriteValue(out, mAlpha);
+	WriteValue(out, (std::int32_t)mMaxSubsteps);
+	WriteValue(out, mActivityThreshold);
+	WriteValue(out, mOrigin);
+
+	WritePlane(out, mPrevSolution);
+	WritePlane(out, mCurrSolution);
+	WritePlane(out, mNormalX);
+	WritePlane(out, mNormalY);
+	WritePlane(out, mNormalZ);
+	WritePlane(out, mTangentXX);
+	WritePlane(out, mTangentXY);
+	WritePlane(out, mTileActive);
+
+	return (bool)out;
+}
+
+bool Waves::Load(std::istream& in)
+{
+	std::int32_t m = 0, n = 0, maxSubsteps = 0;
+	float k1, k2, k3, dt, dx, accumulator, alpha, threshold;
+	XMFLOAT2 origin;
+	if(!ReadHeader(in, kCheckpointTag) ||
+		!ReadValue(in, m) || !ReadValue(in, n) ||
+		!ReadValue(in, k1) || !ReadValue(in, k2) || !ReadValue(in, k3) ||
+		!ReadValue(in, dt) || !ReadValue(in, dx) ||
+		!ReadValue(in, accumulator) || !ReadValue(in, alpha) ||
+		!ReadValue(in, maxSubsteps) || !ReadValue(in, threshold) ||
+		!ReadValue(in, origin))
+		return false;
+
+	if(m < 2 || n < 2 || m > kMaxGridSize || n > kMaxGridSize || maxSubsteps < 1)
+		return false;
+	if(mFixedGridSize && (m != mNumRows || n != mNumCols))
+		return false;
+
+	size_t count = (size_t)m*n;
+	int tileCount = ((m + TileSize - 1) / TileSize)*((n + TileSize - 1) / TileSize);
+	std::vector<float> prev, curr, normalX, normalY, normalZ, tangentXX, tangentXY;
+	std::vector<std::uint8_t> tileActive;
+	if(!ReadPlane(in, prev, count) || !ReadPlane(in, curr, count) ||
+		!ReadPlane(in, normalX, count) || !ReadPlane(in, normalY, count) || !ReadPlane(in, normalZ, count) ||
+		!ReadPlane(in, tangentXX, count) || !ReadPlane(in, tangentXY, count) ||
+		!ReadPlane(in, tileActive, tileCount))
+		return false;
+
+	// Everything has been read; only now change this object.
+	mK1 = k1;
+	mK2 = k2;
+	mK3 = k3;
+	mTimeStep = dt;
+	mSpatialStep = dx;
+	mAccumulator = accumulator;
+	mAlpha = alpha;
+	mMaxSubsteps = maxSubsteps;
+	mActivityThreshold = threshold;
+	mOrigin = origin;
+
+	AllocateGrid(m, n);
+	mPrevSolution.swap(prev);
+	mCurrSolution.swap(curr);
+	mNormalX.swap(normalX);
+	mNormalY.swap(normalY);
+	mNormalZ.swap(normalZ);
+	mTangentXX.swap(tangentXX);
+	mTangentXY.swap(tangentXY);
+	mTileActive.swap(tileActive);
+
+	++mVersion;
+	for(int t = 0; t < mTileRows*mTileCols; ++t)
+		MarkChanged(t);
+
+	return true;
+}
+
+void Waves::Replay(const WavesLog& log)
+{
+	// Replaying a log into itself would never end.
+	assert(&log != mLog);
+
+	for(const WavesLog::Event& e : log.Events)
+	{
+		switch(e.Type)
+		{
+		case WavesLog::Event::Splash:
+		{
+			Disturbance d;
+			d.I = e.I;
+			d.J = e.J;
+			d.Magnitude = e.Magnitude;
+			d.Radius = e.Radius;
+			d.Falloff = e.Falloff;
+			if(!IsValid(d))
+				break;
+
+			++mVersion;
+			ApplyDisturbance(d);
+			break;
+		}
+		case WavesLog::Event::Recenter:
+			Recenter(e.X, e.Z);
+			break;
+		case WavesLog::Event::Update:
+			if(std::isfinite(e.Dt))
+				Update(e.Dt);
+			break;
+		}
+	}
+}
+
+void Waves::MarkChanged(int tile)
+{
+	mTileVersion[tile] = mVersion;
+}
+
+bool Waves::Disturb(int i, int j, float magnitude, int radius, float falloff)
+{
+	Disturbance d;
+	d.I = i;
+	d.J = j;
+	d.Magnitude = magnitude;
+	d.Radius = radius;
+	d.Falloff = falloff;
+
+	return IsValid(d) && mDisturbances.TryPush(d);
+}
+
+bool Waves::IsValid(const Disturbance& d)const
 {
 	// Don't disturb boundaries.
-	assert(i > 1 && i < mNumRows-2);
-	assert(j > 1 && j < mNumCols-2);
+	if(d.I < 1 || d.I >= mNumRows-1 || d.J < 1 || d.J >= mNumCols-1)
+		return false;
+
+	// Bounding the radius by the grid keeps the footprint arithmetic in range.
+	return std::isfinite(d.Magnitude) && d.Radius >= 0 && d.Radius <= std::max(mNumRows, mNumCols) &&
+		d.Falloff >= 0.0f;
+}
 
-	float halfMag = 0.5f*magnitude;
+void Waves::ApplyDisturbances()
+{
+	mDisturbBatch.clear();
 
-	// Disturb the ijth vertex height and its neighbors.
-	mCurrSolution[i*mNumCols+j].y     += magnitude;
-	mCurrSolution[i*mNumCols+j+1].y   += halfMag;
-	mCurrSolution[i*mNumCols+j-1].y   += halfMag;
-	mCurrSolution[(i+1)*mNumCols+j].y += halfMag;
-	mCurrSolution[(i-1)*mNumCols+j].y += halfMag;
+	// Stop after one queue's worth so producers that keep pushing cannot stall Update.
+	Disturbance pending;
+	while(mDisturbBatch.size() < (size_t)MaxPendingDisturbances && mDisturbances.TryPop(pending))
+		mDisturbBatch.push_back(pending);
+
+	if(mDisturbBatch.empty())
+		return;
+
+	++mVersion;
+	for(const Disturbance& d : mDisturbBatch)
+		ApplyDisturbance(d);
+}
+
+void Waves::ApplyDisturbance(const Disturbance& d)
+{
+	if(mLog != nullptr)
+	{
+		WavesLog::Event e;
+		e.Type = WavesLog::Event::Splash;
+		e.I = d.I;
+		e.J = d.J;
+		e.Magnitude = d.Magnitude;
+		e.Radius = d.Radius;
+		e.Falloff = d.Falloff;
+		mLog->Events.push_back(e);
+	}
+
+	// Clip the footprint to the interior; the boundary stays at zero.
+	int r0 = std::max(1, d.I - d.Radius);
+	int r1 = std::min(mNumRows - 2, d.I + d.Radius);
+	int c0 = std::max(1, d.J - d.Radius);
+	int c1 = std::min(mNumCols - 2, d.J + d.Radius);
+
+	float scale = 1.0f / (d.Radius + 1);
+	for(int i = r0; i <= r1; ++i)
+	{
+		for(int j = c0; j <= c1; ++j)
+		{
+			// 64-bit, since a radius as wide as the largest grid squares past 2^31.
+			std::int64_t di = i - d.I;
+			std::int64_t dj = j - d.J;
+			if(di*di + dj*dj > (std::int64_t)d.Radius*d.Radius)
+				continue;
+
+			float dist = std::sqrt((float)(di*di + dj*dj));
+			mCurrSolution[i*mNumCols+j] += d.Magnitude*std::pow(1.0f - dist*scale, d.Falloff);
+		}
+	}
+
+	// Wake up every tile the splash touched.
+	for(int tr = r0 / TileSize; tr <= r1 / TileSize; ++tr)
+	{
+		for(int tc = c0 / TileSize; tc <= c1 / TileSize; ++tc)
+		{
+			mTileActive[tr*mTileCols + tc] = 1;
+			MarkChanged(tr*mTileCols + tc);
+		}
+	}
 }
-	
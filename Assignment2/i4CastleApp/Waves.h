@@ -10,11 +10,59 @@
 #define WAVES_H
 
 #include <vector>
+#include <cstdint>
+#include <iosfwd>
 #include <DirectXMath.h>
+#include "WavesKernels.h"
+#include "../../Common/TaskScheduler.h"
+#include "../../Common/MpscQueue.h"
+
+// Everything done to a Waves object from outside, in order: the splashes it applied,
+// the moves of the grid and the calls to Update.  See Waves::SetLog.
+struct WavesLog
+{
+	struct Event
+	{
+		enum Kind : std::uint32_t { Splash = 0, Recenter = 1, Update = 2 };
+		Kind Type = Update;
+
+		// Splash: see Waves::Disturb.
+		int I = 0;
+		int J = 0;
+		float Magnitude = 0.0f;
+		int Radius = 0;
+		float Falloff = 0.0f;
+
+		// Recenter: the point the grid was moved to follow.
+		float X = 0.0f;
+		float Z = 0.0f;
+
+		// Update: the time passed in.
+		float Dt = 0.0f;
+	};
+
+	std::vector<Event> Events;
+
+	// Binary, in the byte order of the machine.  Load returns false, and leaves the
+	// log unchanged, if the data is not a complete log, or holds an event no Waves
+	// could have logged: a value that is not finite, or a splash radius that is
+	// negative or wider than the largest grid a checkpoint may hold.
+	bool Save(std::ostream& out)const;
+	bool Load(std::istream& in);
+};
 
 class Waves
 {
 public:
+	using PackedVertex = WavesKernels::PackedVertex;
+
+	// Width and height, in grid points, of the tiles used to track which parts of
+	// the water are moving.
+	static const int TileSize = 32;
+
+	// Number of disturbances that can be queued between two calls to Update.
+	static const int MaxPendingDisturbances = 4096;
+
     Waves(int m, int n, float dx, float dt, float speed, float damping);
     Waves(const Waves& rhs) = delete;
     Waves& operator=(const Waves& rhs) = delete;
@@ -26,18 +74,203 @@ public:
 	int TriangleCount()const;
 	float Width()const;
 	float Depth()const;
+	float SpatialStep()const { return mSpatialStep; }
+
+	// Returns the solution at the ith grid point, relative to Origin().  Only the
+	// height is stored; x and z are reconstructed from the grid indices.
+    DirectX::XMFLOAT3 Position(int i)const
+    {
+        return DirectX::XMFLOAT3(
+            -mHalfWidth + (i % mNumCols)*mSpatialStep,
+            mCurrSolution[i],
+            mHalfDepth - (i / mNumCols)*mSpatialStep);
+    }
+
+	// Returns the solution height at the ith grid point.
+    float Height(int i)const { return mCurrSolution[i]; }
 
-	// Returns the solution at the ith grid point.
-    const DirectX::XMFLOAT3& Position(int i)const { return mCurrSolution[i]; }
+	// Returns the height at the ith grid point blended between the last two steps
+	// by InterpolationFactor(), for rendering in between simulation steps.
+    float InterpolatedHeight(int i)const
+    {
+        return mPrevSolution[i] + mAlpha*(mCurrSolution[i] - mPrevSolution[i]);
+    }
 
 	// Returns the solution normal at the ith grid point.
-    const DirectX::XMFLOAT3& Normal(int i)const { return mNormals[i]; }
+    DirectX::XMFLOAT3 Normal(int i)const { return DirectX::XMFLOAT3(mNormalX[i], mNormalY[i], mNormalZ[i]); }
 
 	// Returns the unit tangent vector at the ith grid point in the local x-axis direction.
-    const DirectX::XMFLOAT3& TangentX(int i)const { return mTangentX[i]; }
+    DirectX::XMFLOAT3 TangentX(int i)const { return DirectX::XMFLOAT3(mTangentXX[i], mTangentXY[i], 0.0f); }
+
+	// Packs the heights and normals of columns [c0, c1) of row i into out, for
+	// uploading to the GPU.  See WavesKernels::PackedVertex for the format.
+	void PackRow(int i, int c0, int c1, PackedVertex* out)const
+	{
+		int k = i*mNumCols + c0;
+		mKernels.PackRow(&mCurrSolution[k], &mNormalX[k], &mNormalY[k], &mNormalZ[k], c1 - c0, out);
+	}
+
+	// The row kernels used by Update.  Defaults to WavesKernels::Best(); pass
+	// WavesKernels::Scalar() to run the reference path for validation.
+	const WavesKernels& Kernels()const { return mKernels; }
+	void SetKernels(const WavesKernels& kernels) { mKernels = kernels; }
+
+	// The scheduler that runs the row loops.  Defaults to TaskScheduler::Default().
+	// The scheduler must outlive this object.
+	TaskScheduler& Scheduler()const { return *mScheduler; }
+	void SetScheduler(TaskScheduler& scheduler) { mScheduler = &scheduler; }
+
+	// When set (the default), Update computes the new heights and the normals in one
+	// row-pipelined pass.  Otherwise it makes two full passes over the grid.  Both
+	// give identical results; the two-pass path is kept for comparison.
+	bool FusedUpdate()const { return mFusedUpdate; }
+	void SetFusedUpdate(bool fused) { mFusedUpdate = fused; }
+
+	// While set, Load rejects checkpoints with another grid size.  WaterSystem sets it
+	// on its bodies, since it lays out their vertices by size once, in AddBody.
+	bool FixedGridSize()const { return mFixedGridSize; }
+	void SetFixedGridSize(bool fixed) { mFixedGridSize = fixed; }
+
+	// Upper bound on the number of fixed steps one call to Update may take.  Time
+	// beyond that is dropped so a long frame cannot snowball into longer ones.
+	int MaxSubsteps()const { return mMaxSubsteps; }
+	void SetMaxSubsteps(int count) { mMaxSubsteps = count > 0 ? count : 1; }
+
+	// Fraction of a time step accumulated but not yet simulated, in [0, 1).
+	float InterpolationFactor()const { return mAlpha; }
+
+	//
+	// Activity tracking.  The grid is split into TileSize x TileSize tiles.  A tile is
+	// active while any of its heights or velocities exceeds the activity threshold.
+	// Each step only advances active tiles and the tiles around them; a tile that
+	// comes to rest is snapped flat and skipped until a wave or a disturbance
+	// reaches it again.  Tiles are indexed tileRow*TileColumnCount() + tileCol.
+	//
+	int TileRowCount()const { return mTileRows; }
+	int TileColumnCount()const { return mTileCols; }
+	bool IsTileActive(int tile)const { return mTileActive[tile] != 0; }
+	int ActiveTileCount()const;
+
+	float ActivityThreshold()const { return mActivityThreshold; }
+	void SetActivityThreshold(float epsilon) { mActivityThreshold = epsilon; }
+
+	//
+	// Scrolling.  The grid is a window onto an unbounded sheet of water, centred on
+	// Origin() in world x and z.  Recenter moves the window by whole tiles: the water
+	// that stays inside keeps its motion, the strip that comes in is at rest and the
+	// strip that goes out is forgotten.  Every tile counts as changed after a move.
+	//
+	DirectX::XMFLOAT2 Origin()const { return mOrigin; }
+
+	// Scrolls the grid so that the world point (x, z) is less than one tile from its
+	// centre along each axis, and returns true if it moved.  The queued disturbances
+	// are applied first, so they land where they were aimed.  A point that is not
+	// finite, or more than 2^24 tiles away, is ignored.
+	bool Recenter(float x, float z);
+
+	// Change counter.  It goes up whenever a step or a disturbance changes any tile,
+	// and each changed tile is stamped with the new value.  A consumer that keeps a
+	// copy of the solution remembers the Version() it last copied and asks which
+	// tiles changed since then.  Every tile starts out changed since version 0.
+	std::uint64_t Version()const { return mVersion; }
+	std::uint64_t TileVersion(int tile)const { return mTileVersion[tile]; }
+	bool TileChangedSince(int tile, std::uint64_t version)const { return mTileVersion[tile] > version; }
+
+	// Packs every tile that changed since the given version straight into out, which
+	// holds VertexCount() vertices row by row, and returns the number of vertices
+	// written.  Neighbouring changed tiles of a tile row are written as one run per
+	// grid row.  With streaming set the rows go out through WavesKernels::StreamRow,
+	// for writing into mapped upload memory; out must then not be read before it
+	// reaches the GPU.
+	int WriteChangedTiles(std::uint64_t version, PackedVertex* out, bool streaming = true)const;
+
+	// Applies the queued disturbances, then advances the simulation by dt seconds in
+	// fixed steps and returns the number of steps taken.  Leftover time carries over
+	// to the next call.
+	int Update(float dt);
+
+	// Queues a splash centred on grid point (i, j).  Every point within radius grid
+	// steps of the centre is raised by magnitude*pow(1 - d/(radius+1), falloff), d
+	// being its distance from the centre; the defaults raise the centre by magnitude
+	// and its four neighbours by half of it.  Points outside the interior are left
+	// alone.  May be called from any thread, also while Update runs; the splash is
+	// applied at the start of the next Update.  Returns false, and drops the splash,
+	// if (i, j) is not an interior point, the arguments are invalid (a radius wider
+	// than the grid counts as invalid) or the queue is full.
+	bool Disturb(int i, int j, float magnitude, int radius = 1, float falloff = 1.0f);
 
-	void Update(float dt);
-	void Disturb(int i, int j, float magnitude);
+	//
+	// Checkpoints and replay.  Save writes the whole simulation state, grid size and
+	// constants included, but not the splashes still queued.  Load replaces this
+	// object's state with a saved one; it returns false, and changes nothing, if the
+	// data is not a complete checkpoint, or its grid size differs while the size is
+	// fixed (see SetFixedGridSize).  Afterwards every tile counts as changed.
+	// The kernels, the scheduler and the log are settings, not state, and are kept.
+	//
+	bool Save(std::ostream& out)const;
+	bool Load(std::istream& in);
+
+	// While a log is attached, every splash applied, every move of the grid and every
+	// call to Update is appended to it.  Replaying the log on the state it started
+	// from reproduces the run bit for bit, as long as the same kernels are used.
+	// The log must outlive its use; pass nullptr to detach it.
+	WavesLog* Log()const { return mLog; }
+	void SetLog(WavesLog* log) { mLog = log; }
+
+	// Performs the events of a log, in order, as if they were happening now.  Splashes
+	// go through the same checks as Disturb, against this grid, and the ones it would
+	// reject are skipped, as are updates by a time that is not finite.
+	void Replay(const WavesLog& log);
+
+private:
+	// A run of interior columns [First, Last) of one tile row that is stepped.
+	struct Span
+	{
+		int First = 0;
+		int Last = 0;
+	};
+
+	struct Disturbance
+	{
+		int I = 0;
+		int J = 0;
+		float Magnitude = 0.0f;
+		int Radius = 0;
+		float Falloff = 0.0f;
+	};
+
+	// Sizes every plane and the tile state for an m x n grid at rest.
+	void AllocateGrid(int m, int n);
+
+	// Drains the disturbance queue and adds every splash to the current solution.
+	void ApplyDisturbances();
+	void ApplyDisturbance(const Disturbance& d);
+
+	// The checks Disturb makes: an interior centre and usable arguments.
+	bool IsValid(const Disturbance& d)const;
+
+	// Works out which tiles to step; returns false if the whole grid is at rest.
+	bool BeginStep();
+	void EndStep();
+
+	void StepFused();
+	void StepTwoPass();
+
+	// Range of interior rows [first, last) covered by a tile row.
+	void BandRows(int band, int& first, int& last)const;
+
+	// Writes the next solution of columns [c0, c1) of row i over the previous
+	// solution and records how far they are from rest in the band's tiles.
+	void StencilRow(int band, int i, int c0, int c1);
+
+	// Computes the normals and tangents of columns [c0, c1) of row i from the given
+	// height plane.
+	void NormalRow(const std::vector<float>& heights, int i, int c0, int c1);
+
+	// Flattens a tile that has come to rest.
+	void SnapTile(int tile);
+
+	void MarkChanged(int tile);
 
 private:
     int mNumRows = 0;
@@ -54,10 +287,57 @@ private:
     float mTimeStep = 0.0f;
     float mSpatialStep = 0.0f;
 
-    std::vector<DirectX::XMFLOAT3> mPrevSolution;
-    std::vector<DirectX::XMFLOAT3> mCurrSolution;
-    std::vector<DirectX::XMFLOAT3> mNormals;
-    std::vector<DirectX::XMFLOAT3> mTangentX;
+    // Time accumulated since the last step, and the same expressed as a fraction
+    // of a step.
+    float mAccumulator = 0.0f;
+    float mAlpha = 0.0f;
+    int mMaxSubsteps = 4;
+
+    float mHalfWidth = 0.0f;
+    float mHalfDepth = 0.0f;
+
+    DirectX::XMFLOAT2 mOrigin = { 0.0f, 0.0f };
+
+    // The solution is stored as separate planes of floats (structure of arrays) so
+    // the stencil only streams the heights it actually reads through the cache.
+    std::vector<float> mPrevSolution;
+    std::vector<float> mCurrSolution;
+    std::vector<float> mNormalX;
+    std::vector<float> mNormalY;
+    std::vector<float> mNormalZ;
+
+    // The tangent in the x-axis direction always has a zero z component.
+    std::vector<float> mTangentXX;
+    std::vector<float> mTangentXY;
+
+    WavesKernels mKernels = WavesKernels::Best();
+
+    TaskScheduler* mScheduler = &TaskScheduler::Default();
+
+    bool mFusedUpdate = true;
+    bool mFixedGridSize = false;
+
+    int mTileRows = 0;
+    int mTileCols = 0;
+    float mActivityThreshold = 1.0e-4f;
+
+    std::vector<std::uint8_t> mTileActive;
+    std::vector<std::uint8_t> mTileStepped;
+    std::vector<float> mTileActivity;
+
+    std::uint64_t mVersion = 1;
+    std::vector<std::uint64_t> mTileVersion;
+
+    // Stepped column runs of every tile row for the current step; the spans of
+    // band b are mSpans[mBandSpans[b]] .. mSpans[mBandSpans[b+1]-1].
+    std::vector<Span> mSpans;
+    std::vector<int> mBandSpans;
+
+    // Filled by any thread through Disturb, drained by Update.
+    MpscQueue<Disturbance> mDisturbances{ MaxPendingDisturbances };
+    std::vector<Disturbance> mDisturbBatch;
+
+    WavesLog* mLog = nullptr;
 };
 
 #endif // WAVES_H
\ No newline at end of file
@@ -0,0 +1,796 @@
+//***************************************************************************************
+// WavesKernels.cpp
+//***************************************************************************************
+
+#include "WavesKernels.h"
+#include <DirectXMath.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <vector>
+
+#if defined(_XM_SSE_INTRINSICS_)
+	#include <immintrin.h>
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+		#define WAVES_TARGET_AVX2
+	#else
+		#include <cpuid.h>
+		#define WAVES_TARGET_AVX2 __attribute__((target("avx2")))
+	#endif
+#endif
+
+#if defined(_XM_ARM_NEON_INTRINSICS_) && (defined(_M_ARM64) || defined(__aarch64__))
+	#include <arm_neon.h>
+	#define WAVES_NEON_KERNELS
+#endif
+
+namespace
+{
+	//
+	// Scalar kernels.  These define the reference results.
+	//
+
+	void StencilRowScalar(float* prev, const float* up, const float* curr, const float* down,
+		int count, float k1, float k2, float k3)
+	{
+		for(int j = 0; j < count; ++j)
+		{
+			prev[j] = k1*prev[j] + k2*curr[j] +
+				k3*(down[j] + up[j] + curr[j+1] + curr[j-1]);
+		}
+	}
+
+	void NormalRowScalar(const float* up, const float* curr, const float* down,
+		int count, float twoDx,
+		float* normalX, float* normalY, float* normalZ,
+		float* tangentXX, float* tangentXY)
+	{
+		for(int j = 0; j < count; ++j)
+		{
+			float nx = curr[j-1] - curr[j+1];
+			float nz = down[j] - up[j];
+			float lenN = std::sqrt(nx*nx + twoDx*twoDx + nz*nz);
+			normalX[j] = nx / lenN;
+			normalY[j] = twoDx / lenN;
+			normalZ[j] = nz / lenN;
+
+			float ty = curr[j+1] - curr[j-1];
+			float lenT = std::sqrt(twoDx*twoDx + ty*ty);
+			tangentXX[j] = twoDx / lenT;
+			tangentXY[j] = ty / lenT;
+		}
+	}
+
+	float ActivityRowScalar(const float* next, const float* curr, int count)
+	{
+		float a = 0.0f;
+		for(int j = 0; j < count; ++j)
+		{
+			a = std::max(a, std::fabs(next[j]));
+			a = std::max(a, std::fabs(next[j] - curr[j]));
+		}
+
+		return a;
+	}
+
+	// Round-to-nearest-even float to half conversion done on the bit pattern, so the
+	// vector kernels below can follow exactly the same steps.
+	std::uint16_t FloatToHalf(float value)
+	{
+		std::uint32_t f;
+		std::memcpy(&f, &value, sizeof(f));
+		std::uint32_t sign = f & 0x80000000u;
+		f ^= sign;
+
+		std::uint32_t h;
+		if(f > 0x477fffffu)
+		{
+			// Too large for a half, infinity or NaN.
+			h = f > 0x7f800000u ? 0x7e00u : 0x7c00u;
+		}
+		else if(f < 0x38800000u)
+		{
+			// The result is a half denormal or zero.  Adding 0.5 lines the half's
+			// mantissa up with the low bits of the float and lets the FPU round.
+			float t;
+			std::memcpy(&t, &f, sizeof(t));
+			t += 0.5f;
+			std::memcpy(&h, &t, sizeof(h));
+			h -= 0x3f000000u;
+		}
+		else
+		{
+			// Rebias the exponent and round the 13 dropped mantissa bits.
+			std::uint32_t odd = (f >> 13) & 1u;
+			h = (f + 0xc8000fffu + odd) >> 13;
+		}
+
+		return (std::uint16_t)(h | (sign >> 16));
+	}
+
+	std::int8_t ToSnorm8(float v)
+	{
+		return (std::int8_t)(int)std::nearbyint(v*127.0f);
+	}
+
+	// Number of vertices to write with ordinary stores before out reaches the given
+	// alignment, at most count.
+	int HeadCount(const WavesKernels::PackedVertex* out, int count, std::uintptr_t alignment)
+	{
+		std::uintptr_t misaligned = reinterpret_cast<std::uintptr_t>(out) & (alignment - 1);
+		int head = misaligned == 0 ? 0 : (int)((alignment - misaligned) / sizeof(WavesKernels::PackedVertex));
+		return std::min(head, count);
+	}
+
+	void PackRowScalar(const float* height, const float* normalX, const float* normalY,
+		const float* normalZ, int count, WavesKernels::PackedVertex* out)
+	{
+		for(int j = 0; j < count; ++j)
+		{
+			float s = std::fabs(normalX[j]) + std::fabs(normalY[j]) + std::fabs(normalZ[j]);
+			out[j].Height = FloatToHalf(height[j]);
+			out[j].NormalX = ToSnorm8(normalX[j] / s);
+			out[j].NormalZ = ToSnorm8(normalZ[j] / s);
+		}
+	}
+
+#if defined(_XM_SSE_INTRINSICS_)
+	//
+	// SSE2 kernels (4 points per iteration).  SSE2 is part of the x64 baseline.
+	//
+
+	void StencilRowSSE2(float* prev, const float* up, const float* curr, const float* down,
+		int count, float k1, float k2, float k3)
+	{
+		const __m128 vK1 = _mm_set1_ps(k1);
+		const __m128 vK2 = _mm_set1_ps(k2);
+		const __m128 vK3 = _mm_set1_ps(k3);
+
+		int j = 0;
+		for(; j + 4 <= count; j += 4)
+		{
+			__m128 sum = _mm_add_ps(_mm_loadu_ps(down + j), _mm_loadu_ps(up + j));
+			sum = _mm_add_ps(sum, _mm_loadu_ps(curr + j + 1));
+			sum = _mm_add_ps(sum, _mm_loadu_ps(curr + j - 1));
+
+			__m128 h = _mm_add_ps(
+				_mm_mul_ps(vK1, _mm_loadu_ps(prev + j)),
+				_mm_mul_ps(vK2, _mm_loadu_ps(curr + j)));
+			h = _mm_add_ps(h, _mm_mul_ps(vK3, sum));
+
+			_mm_storeu_ps(prev + j, h);
+		}
+
+		StencilRowScalar(prev + j, up + j, curr + j, down + j, count - j, k1, k2, k3);
+	}
+
+	void NormalRowSSE2(const float* up, const float* curr, const float* down,
+		int count, float twoDx,
+		float* normalX, float* normalY, float* normalZ,
+		float* tangentXX, float* tangentXY)
+	{
+		const __m128 vTwoDx = _mm_set1_ps(twoDx);
+		const __m128 vTwoDxSq = _mm_mul_ps(vTwoDx, vTwoDx);
+
+		int j = 0;
+		for(; j + 4 <= count; j += 4)
+		{
+			__m128 l = _mm_loadu_ps(curr + j - 1);
+			__m128 r = _mm_loadu_ps(curr + j + 1);
+
+			__m128 nx = _mm_sub_ps(l, r);
+			__m128 nz = _mm_sub_ps(_mm_loadu_ps(down + j), _mm_loadu_ps(up + j));
+			__m128 lenN = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), vTwoDxSq), _mm_mul_ps(nz, nz));
+			lenN = _mm_sqrt_ps(lenN);
+			_mm_storeu_ps(normalX + j, _mm_div_ps(nx, lenN));
+			_mm_storeu_ps(normalY + j, _mm_div_ps(vTwoDx, lenN));
+			_mm_storeu_ps(normalZ + j, _mm_div_ps(nz, lenN));
+
+			__m128 ty = _mm_sub_ps(r, l);
+			__m128 lenT = _mm_sqrt_ps(_mm_add_ps(vTwoDxSq, _mm_mul_ps(ty, ty)));
+			_mm_storeu_ps(tangentXX + j, _mm_div_ps(vTwoDx, lenT));
+			_mm_storeu_ps(tangentXY + j, _mm_div_ps(ty, lenT));
+		}
+
+		NormalRowScalar(up + j, curr + j, down + j, count - j, twoDx,
+			normalX + j, normalY + j, normalZ + j, tangentXX + j, tangentXY + j);
+	}
+
+	float ActivityRowSSE2(const float* next, const float* curr, int count)
+	{
+		const __m128 signMask = _mm_set1_ps(-0.0f);
+		__m128 a = _mm_setzero_ps();
+
+		int j = 0;
+		for(; j + 4 <= count; j += 4)
+		{
+			__m128 h = _mm_loadu_ps(next + j);
+			__m128 v = _mm_sub_ps(h, _mm_loadu_ps(curr + j));
+			a = _mm_max_ps(a, _mm_andnot_ps(signMask, h));
+			a = _mm_max_ps(a, _mm_andnot_ps(signMask, v));
+		}
+
+		float lanes[4];
+		_mm_storeu_ps(lanes, a);
+		float m = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+
+		return std::max(m, ActivityRowScalar(next + j, curr + j, count - j));
+	}
+
+	// FloatToHalf on four lanes; the half ends up in the low 16 bits of each lane.
+	__m128i FloatToHalfSSE2(__m128 value)
+	{
+		__m128i f = _mm_castps_si128(value);
+		__m128i sign = _mm_and_si128(f, _mm_set1_epi32((int)0x80000000u));
+		f = _mm_xor_si128(f, sign);
+
+		// f is non-negative now, so the signed compares are safe.
+		__m128i nan = _mm_cmpgt_epi32(f, _mm_set1_epi32(0x7f800000));
+		__m128i big = _mm_cmpgt_epi32(f, _mm_set1_epi32(0x477fffff));
+		__m128i small = _mm_cmplt_epi32(f, _mm_set1_epi32(0x38800000));
+
+		__m128i hBig = _mm_or_si128(
+			_mm_and_si128(nan, _mm_set1_epi32(0x7e00)),
+			_mm_andnot_si128(nan, _mm_set1_epi32(0x7c00)));
+		__m128i hSmall = _mm_sub_epi32(
+			_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(f), _mm_set1_ps(0.5f))),
+			_mm_set1_epi32(0x3f000000));
+		__m128i odd = _mm_and_si128(_mm_srli_epi32(f, 13), _mm_set1_epi32(1));
+		__m128i hNormal = _mm_srli_epi32(
+			_mm_add_epi32(_mm_add_epi32(f, _mm_set1_epi32((int)0xc8000fffu)), odd), 13);
+
+		__m128i h = _mm_or_si128(_mm_and_si128(small, hSmall), _mm_andnot_si128(small, hNormal));
+		h = _mm_or_si128(_mm_and_si128(big, hBig), _mm_andnot_si128(big, h));
+		return _mm_or_si128(h, _mm_srli_epi32(sign, 16));
+	}
+
+	// Four packed vertices, one per lane.
+	__m128i PackFourSSE2(const float* height, const float* normalX, const float* normalY,
+		const float* normalZ)
+	{
+		const __m128 signMask = _mm_set1_ps(-0.0f);
+		const __m128 scale = _mm_set1_ps(127.0f);
+
+		__m128 nx = _mm_loadu_ps(normalX);
+		__m128 nz = _mm_loadu_ps(normalZ);
+		__m128 s = _mm_add_ps(
+			_mm_add_ps(_mm_andnot_ps(signMask, nx), _mm_andnot_ps(signMask, _mm_loadu_ps(normalY))),
+			_mm_andnot_ps(signMask, nz));
+
+		__m128i ox = _mm_cvtps_epi32(_mm_mul_ps(_mm_div_ps(nx, s), scale));
+		__m128i oz = _mm_cvtps_epi32(_mm_mul_ps(_mm_div_ps(nz, s), scale));
+
+		__m128i v = FloatToHalfSSE2(_mm_loadu_ps(height));
+		v = _mm_or_si128(v, _mm_slli_epi32(_mm_and_si128(ox, _mm_set1_epi32(0xff)), 16));
+		return _mm_or_si128(v, _mm_slli_epi32(oz, 24));
+	}
+
+	void PackRowSSE2(const float* height, const float* normalX, const float* normalY,
+		const float* normalZ, int count, WavesKernels::PackedVertex* out)
+	{
+		int j = 0;
+		for(; j + 4 <= count; j += 4)
+		{
+			__m128i v = PackFourSSE2(height + j, normalX + j, normalY + j, normalZ + j);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + j), v);
+		}
+
+		PackRowScalar(height + j, normalX + j, normalY + j, normalZ + j, count - j, out + j);
+	}
+
+	void StreamRowSSE2(const float* height, const float* normalX, const float* normalY,
+		const float* normalZ, int count, WavesKernels::PackedVertex* out)
+	{
+		int j = HeadCount(out, count, 16);
+		PackRowScalar(height, normalX, normalY, normalZ, j, out);
+
+		for(; j + 4 <= count; j += 4)
+		{
+			__m128i v = PackFourSSE2(height + j, normalX + j, normalY + j, normalZ + j);
+			_mm_stream_si128(reinterpret_cast<__m128i*>(out + j), v);
+		}
+
+		PackRowScalar(height + j, normalX + j, normalY + j, normalZ + j, count - j, out + j);
+	}
+
+	void EndStreamSSE2()
+	{
+		_mm_sfence();
+	}
+
+	//
+	// AVX2 kernels (8 points per iteration).  Only called after CPU detection.  Each
+	// one clears the upper halves of the ymm registers before running any SSE code;
+	// leaving them dirty makes every later SSE instruction pay a transition penalty.
+	//
+
+	WAVES_TARGET_AVX2
+	void StencilRowAVX2(float* prev, const float* up, const float* curr, const float* down,
+		int count, float k1, float k2, float k3)
+	{
+		const __m256 vK1 = _mm256_set1_ps(k1);
+		const __m256 vK2 = _mm256_set1_ps(k2);
+		const __m256 vK3 = _mm256_set1_ps(k3);
+
+		int j = 0;
+		for(; j + 8 <= count; j += 8)
+		{
+			__m256 sum = _mm256_add_ps(_mm256_loadu_ps(down + j), _mm256_loadu_ps(up + j));
+			sum = _mm256_add_ps(sum, _mm256_loadu_ps(curr + j + 1));
+			sum = _mm256_add_ps(sum, _mm256_loadu_ps(curr + j - 1));
+
+			__m256 h = _mm256_add_ps(
+				_mm256_mul_ps(vK1, _mm256_loadu_ps(prev + j)),
+				_mm256_mul_ps(vK2, _mm256_loadu_ps(curr + j)));
+			h = _mm256_add_ps(h, _mm256_mul_ps(vK3, sum));
+
+			_mm256_storeu_ps(prev + j, h);
+		}
+
+		_mm256_zeroupper();
+		StencilRowScalar(prev + j, up + j, curr + j, down + j, count - j, k1, k2, k3);
+	}
+
+	WAVES_TARGET_AVX2
+	void NormalRowAVX2(const float* up, const float* curr, const float* down,
+		int count, float twoDx,
+		float* normalX, float* normalY, float* normalZ,
+		float* tangentXX, float* tangentXY)
+	{
+		const __m256 vTwoDx = _mm256_set1_ps(twoDx);
+		const __m256 vTwoDxSq = _mm256_mul_ps(vTwoDx, vTwoDx);
+
+		int j = 0;
+		for(; j + 8 <= count; j += 8)
+		{
+			__m256 l = _mm256_loadu_ps(curr + j - 1);
+			__m256 r = _mm256_loadu_ps(curr + j + 1);
+
+			__m256 nx = _mm256_sub_ps(l, r);
+			__m256 nz = _mm256_sub_ps(_mm256_loadu_ps(down + j), _mm256_loadu_ps(up + j));
+			__m256 lenN = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, nx), vTwoDxSq), _mm256_mul_ps(nz, nz));
+			lenN = _mm256_sqrt_ps(lenN);
+			_mm256_storeu_ps(normalX + j, _mm256_div_ps(nx, lenN));
+			_mm256_storeu_ps(normalY + j, _mm256_div_ps(vTwoDx, lenN));
+			_mm256_storeu_ps(normalZ + j, _mm256_div_ps(nz, lenN));
+
+			__m256 ty = _mm256_sub_ps(r, l);
+			__m256 lenT = _mm256_sqrt_ps(_mm256_add_ps(vTwoDxSq, _mm256_mul_ps(ty, ty)));
+			_mm256_storeu_ps(tangentXX + j, _mm256_div_ps(vTwoDx, lenT));
+			_mm256_storeu_ps(tangentXY + j, _mm256_div_ps(ty, lenT));
+		}
+
+		_mm256_zeroupper();
+		NormalRowScalar(up + j, curr + j, down + j, count - j, twoDx,
+			normalX + j, normalY + j, normalZ + j, tangentXX + j, tangentXY + j);
+	}
+
+	WAVES_TARGET_AVX2
+	float ActivityRowAVX2(const float* next, const float* curr, int count)
+	{
+		const __m256 signMask = _mm256_set1_ps(-0.0f);
+		__m256 a = _mm256_setzero_ps();
+
+		int j = 0;
+		for(; j + 8 <= count; j += 8)
+		{
+			__m256 h = _mm256_loadu_ps(next + j);
+			__m256 v = _mm256_sub_ps(h, _mm256_loadu_ps(curr + j));
+			a = _mm256_max_ps(a, _mm256_andnot_ps(signMask, h));
+			a = _mm256_max_ps(a, _mm256_andnot_ps(signMask, v));
+		}
+
+		float lanes[8];
+		_mm256_storeu_ps(lanes, a);
+		_mm256_zeroupper();
+
+		float m = 0.0f;
+		for(float f : lanes)
+			m = std::max(m, f);
+
+		return std::max(m, ActivityRowScalar(next + j, curr + j, count - j));
+	}
+
+	WAVES_TARGET_AVX2
+	__m256i FloatToHalfAVX2(__m256 value)
+	{
+		__m256i f = _mm256_castps_si256(value);
+		__m256i sign = _mm256_and_si256(f, _mm256_set1_epi32((int)0x80000000u));
+		f = _mm256_xor_si256(f, sign);
+
+		__m256i nan = _mm256_cmpgt_epi32(f, _mm256_set1_epi32(0x7f800000));
+		__m256i big = _mm256_cmpgt_epi32(f, _mm256_set1_epi32(0x477fffff));
+		__m256i small = _mm256_cmpgt_epi32(_mm256_set1_epi32(0x38800000), f);
+
+		__m256i hBig = _mm256_blendv_epi8(_mm256_set1_epi32(0x7c00), _mm256_set1_epi32(0x7e00), nan);
+		__m256i hSmall = _mm256_sub_epi32(
+			_mm256_castps_si256(_mm256_add_ps(_mm256_castsi256_ps(f), _mm256_set1_ps(0.5f))),
+			_mm256_set1_epi32(0x3f000000));
+		__m256i odd = _mm256_and_si256(_mm256_srli_epi32(f, 13), _mm256_set1_epi32(1));
+		__m256i hNormal = _mm256_srli_epi32(
+			_mm256_add_epi32(_mm256_add_epi32(f, _mm256_set1_epi32((int)0xc8000fffu)), odd), 13);
+
+		__m256i h = _mm256_blendv_epi8(hNormal, hSmall, small);
+		h = _mm256_blendv_epi8(h, hBig, big);
+		return _mm256_or_si256(h, _mm256_srli_epi32(sign, 16));
+	}
+
+	// Eight packed vertices, one per lane.
+	WAVES_TARGET_AVX2
+	__m256i PackEightAVX2(const float* height, const float* normalX, const float* normalY,
+		const float* normalZ)
+	{
+		const __m256 signMask = _mm256_set1_ps(-0.0f);
+		const __m256 scale = _mm256_set1_ps(127.0f);
+
+		__m256 nx = _mm256_loadu_ps(normalX);
+		__m256 nz = _mm256_loadu_ps(normalZ);
+		__m256 s = _mm256_add_ps(
+			_mm256_add_ps(_mm256_andnot_ps(signMask, nx), _mm256_andnot_ps(signMask, _mm256_loadu_ps(normalY))),
+			_mm256_andnot_ps(signMask, nz));
+
+		__m256i ox = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_div_ps(nx, s), scale));
+		__m256i oz = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_div_ps(nz, s), scale));
+
+		__m256i v = FloatToHalfAVX2(_mm256_loadu_ps(height));
+		v = _mm256_or_si256(v, _mm256_slli_epi32(_mm256_and_si256(ox, _mm256_set1_epi32(0xff)), 16));
+		return _mm256_or_si256(v, _mm256_slli_epi32(oz, 24));
+	}
+
+	WAVES_TARGET_AVX2
+	void PackRowAVX2(const float* height, const float* normalX, const float* normalY,
+		const float* normalZ, int count, WavesKernels::PackedVertex* out)
+	{
+		int j = 0;
+		for(; j + 8 <= count; j += 8)
+		{
+			__m256i v = PackEightAVX2(height + j, normalX + j, normalY + j, normalZ + j);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + j), v);
+		}
+
+		_mm256_zeroupper();
+		PackRowScalar(height + j, normalX + j, normalY + j, normalZ + j, count - j, out + j);
+	}
+
+	WAVES_TARGET_AVX2
+	void StreamRowAVX2(const float* height, const float* normalX, const float* normalY,
+		const float* normalZ, int count, WavesKernels::PackedVertex* out)
+	{
+		int j = HeadCount(out, count, 32);
+		PackRowScalar(height, normalX, normalY, normalZ, j, out);
+
+		for(; j + 8 <= count; j += 8)
+		{
+			__m256i v = PackEightAVX2(height + j, normalX + j, normalY + j, normalZ + j);
+			_mm256_stream_si256(reinterpret_cast<__m256i*>(out + j), v);
+		}
+
+		_mm256_zeroupper();
+		PackRowScalar(height + j, normalX + j, normalY + j, normalZ + j, count - j, out + j);
+	}
+
+	bool CpuSupportsAVX2()
+	{
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if(info[0] < 7)
+			return false;
+
+		// The OS must save the upper halves of the ymm registers (OSXSAVE + AVX state).
+		__cpuid(info, 1);
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+		if(!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+			return false;
+
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") != 0;
+#endif
+	}
+#endif // _XM_SSE_INTRINSICS_
+
+#if defined(WAVES_NEON_KERNELS)
+	//
+	// NEON kernels (4 points per iteration).  NEON is always present on ARM64.
+	//
+
+	void StencilRowNEON(float* prev, const float* up, const float* curr, const float* down,
+		int count, float k1, float k2, float k3)
+	{
+		const float32x4_t vK1 = vdupq_n_f32(k1);
+		const float32x4_t vK2 = vdupq_n_f32(k2);
+		const float32x4_t vK3 = vdupq_n_f32(k3);
+
+		int j = 0;
+		for(; j + 4 <= count; j += 4)
+		{
+			float32x4_t sum = vaddq_f32(vld1q_f32(down + j), vld1q_f32(up + j));
+			sum = vaddq_f32(sum, vld1q_f32(curr + j + 1));
+			sum = vaddq_f32(sum, vld1q_f32(curr + j - 1));
+
+			float32x4_t h = vaddq_f32(
+				vmulq_f32(vK1, vld1q_f32(prev + j)),
+				vmulq_f32(vK2, vld1q_f32(curr + j)));
+			h = vaddq_f32(h, vmulq_f32(vK3, sum));
+
+			vst1q_f32(prev + j, h);
+		}
+
+		StencilRowScalar(prev + j, up + j, curr + j, down + j, count - j, k1, k2, k3);
+	}
+
+	void NormalRowNEON(const float* up, const float* curr, const float* down,
+		int count, float twoDx,
+		float* normalX, float* normalY, float* normalZ,
+		float* tangentXX, float* tangentXY)
+	{
+		const float32x4_t vTwoDx = vdupq_n_f32(twoDx);
+		const float32x4_t vTwoDxSq = vmulq_f32(vTwoDx, vTwoDx);
+
+		int j = 0;
+		for(; j + 4 <= count; j += 4)
+		{
+			float32x4_t l = vld1q_f32(curr + j - 1);
+			float32x4_t r = vld1q_f32(curr + j + 1);
+
+			float32x4_t nx = vsubq_f32(l, r);
+			float32x4_t nz = vsubq_f32(vld1q_f32(down + j), vld1q_f32(up + j));
+			float32x4_t lenN = vaddq_f32(vaddq_f32(vmulq_f32(nx, nx), vTwoDxSq), vmulq_f32(nz, nz));
+			lenN = vsqrtq_f32(lenN);
+			vst1q_f32(normalX + j, vdivq_f32(nx, lenN));
+			vst1q_f32(normalY + j, vdivq_f32(vTwoDx, lenN));
+			vst1q_f32(normalZ + j, vdivq_f32(nz, lenN));
+
+			float32x4_t ty = vsubq_f32(r, l);
+			float32x4_t lenT = vsqrtq_f32(vaddq_f32(vTwoDxSq, vmulq_f32(ty, ty)));
+			vst1q_f32(tangentXX + j, vdivq_f32(vTwoDx, lenT));
+			vst1q_f32(tangentXY + j, vdivq_f32(ty, lenT));
+		}
+
+		NormalRowScalar(up + j, curr + j, down + j, count - j, twoDx,
+			normalX + j, normalY + j, normalZ + j, tangentXX + j, tangentXY + j);
+	}
+
+	float ActivityRowNEON(const float* next, const float* curr, int count)
+	{
+		float32x4_t a = vdupq_n_f32(0.0f);
+
+		int j = 0;
+		for(; j + 4 <= count; j += 4)
+		{
+			float32x4_t h = vld1q_f32(next + j);
+			float32x4_t v = vsubq_f32(h, vld1q_f32(curr + j));
+			a = vmaxq_f32(a, vabsq_f32(h));
+			a = vmaxq_f32(a, vabsq_f32(v));
+		}
+
+		return std::max(vmaxvq_f32(a), ActivityRowScalar(next + j, curr + j, count - j));
+	}
+
+	uint32x4_t FloatToHalfNEON(float32x4_t value)
+	{
+		uint32x4_t f = vreinterpretq_u32_f32(value);
+		uint32x4_t sign = vandq_u32(f, vdupq_n_u32(0x80000000u));
+		f = veorq_u32(f, sign);
+
+		uint32x4_t nan = vcgtq_u32(f, vdupq_n_u32(0x7f800000u));
+		uint32x4_t big = vcgtq_u32(f, vdupq_n_u32(0x477fffffu));
+		uint32x4_t small = vcltq_u32(f, vdupq_n_u32(0x38800000u));
+
+		uint32x4_t hBig = vbslq_u32(nan, vdupq_n_u32(0x7e00u), vdupq_n_u32(0x7c00u));
+		uint32x4_t hSmall = vsubq_u32(
+			vreinterpretq_u32_f32(vaddq_f32(vreinterpretq_f32_u32(f), vdupq_n_f32(0.5f))),
+			vdupq_n_u32(0x3f000000u));
+		uint32x4_t odd = vandq_u32(vshrq_n_u32(f, 13), vdupq_n_u32(1u));
+		uint32x4_t hNormal = vshrq_n_u32(vaddq_u32(vaddq_u32(f, vdupq_n_u32(0xc8000fffu)), odd), 13);
+
+		uint32x4_t h = vbslq_u32(small, hSmall, hNormal);
+		h = vbslq_u32(big, hBig, h);
+		return vorrq_u32(h, vshrq_n_u32(sign, 16));
+	}
+
+	void PackRowNEON(const float* height, const float* normalX, const float* normalY,
+		const float* normalZ, int count, WavesKernels::PackedVertex* out)
+	{
+		const float32x4_t scale = vdupq_n_f32(127.0f);
+		const uint32x4_t byteMask = vdupq_n_u32(0xffu);
+
+		int j = 0;
+		for(; j + 4 <= count; j += 4)
+		{
+			float32x4_t nx = vld1q_f32(normalX + j);
+			float32x4_t nz = vld1q_f32(normalZ + j);
+			float32x4_t s = vaddq_f32(vaddq_f32(vabsq_f32(nx), vabsq_f32(vld1q_f32(normalY + j))), vabsq_f32(nz));
+
+			uint32x4_t ox = vreinterpretq_u32_s32(vcvtnq_s32_f32(vmulq_f32(vdivq_f32(nx, s), scale)));
+			uint32x4_t oz = vreinterpretq_u32_s32(vcvtnq_s32_f32(vmulq_f32(vdivq_f32(nz, s), scale)));
+
+			uint32x4_t v = FloatToHalfNEON(vld1q_f32(height + j));
+			v = vorrq_u32(v, vshlq_n_u32(vandq_u32(ox, byteMask), 16));
+			v = vorrq_u32(v, vshlq_n_u32(oz, 24));
+			vst1q_u32(reinterpret_cast<std::uint32_t*>(out + j), v);
+		}
+
+		PackRowScalar(height + j, normalX + j, normalY + j, normalZ + j, count - j, out + j);
+	}
+#endif // WAVES_NEON_KERNELS
+
+	// Maps a float onto a line of integers so that adjacent floats differ by one.
+	std::int64_t OrderedBits(float f)
+	{
+		std::int32_t i;
+		std::memcpy(&i, &f, sizeof(i));
+		return i < 0 ? -(std::int64_t)(i & 0x7fffffff) : (std::int64_t)i;
+	}
+
+	bool WithinUlps(const std::vector<float>& a, const std::vector<float>& b, int maxUlps)
+	{
+		for(size_t i = 0; i < a.size(); ++i)
+		{
+			std::int64_t d = OrderedBits(a[i]) - OrderedBits(b[i]);
+			if(d < -maxUlps || d > maxUlps)
+				return false;
+		}
+
+		return true;
+	}
+
+	// Without non-temporal stores there is nothing to order.
+	void EndStreamNone()
+	{
+	}
+
+	WavesKernels MakeKernels(const char* name, WavesKernels::StencilRowFn stencil, WavesKernels::NormalRowFn normal,
+		WavesKernels::ActivityRowFn activity, WavesKernels::PackRowFn pack,
+		WavesKernels::PackRowFn stream, WavesKernels::EndStreamFn endStream)
+	{
+		WavesKernels k;
+		k.Name = name;
+		k.StencilRow = stencil;
+		k.NormalRow = normal;
+		k.ActivityRow = activity;
+		k.PackRow = pack;
+		k.StreamRow = stream;
+		k.EndStream = endStream;
+		return k;
+	}
+
+	std::vector<WavesKernels> DetectSupported()
+	{
+		std::vector<WavesKernels> kernels(1, WavesKernels::Scalar());
+#if defined(_XM_SSE_INTRINSICS_)
+		kernels.push_back(MakeKernels("SSE2", StencilRowSSE2, NormalRowSSE2, ActivityRowSSE2, PackRowSSE2,
+			StreamRowSSE2, EndStreamSSE2));
+
+		if(CpuSupportsAVX2())
+			kernels.push_back(MakeKernels("AVX2", StencilRowAVX2, NormalRowAVX2, ActivityRowAVX2, PackRowAVX2,
+				StreamRowAVX2, EndStreamSSE2));
+#elif defined(WAVES_NEON_KERNELS)
+		// NEON has no non-temporal store intrinsic; ordinary stores are used instead.
+		kernels.push_back(MakeKernels("NEON", StencilRowNEON, NormalRowNEON, ActivityRowNEON, PackRowNEON,
+			PackRowNEON, EndStreamNone));
+#endif
+		return kernels;
+	}
+}
+
+const WavesKernels& WavesKernels::Scalar()
+{
+	static const WavesKernels scalar = MakeKernels("Scalar", StencilRowScalar, NormalRowScalar, ActivityRowScalar,
+		PackRowScalar, PackRowScalar, EndStreamNone);
+	return scalar;
+}
+
+const std::vector<WavesKernels>& WavesKernels::Supported()
+{
+	static const std::vector<WavesKernels> supported = DetectSupported();
+	return supported;
+}
+
+const WavesKernels& WavesKernels::Best()
+{
+	static const WavesKernels best = []()
+	{
+		WavesKernels k = Supported().back();
+
+		// In debug builds make sure the vector path agrees with the reference path
+		// before the simulation starts relying on it.
+#if defined(DEBUG) | defined(_DEBUG)
+		assert(MatchesScalar(k, 2));
+#endif
+		return k;
+	}();
+
+	return best;
+}
+
+bool WavesKernels::MatchesScalar(const WavesKernels& kernels, int maxUlps)
+{
+	// Shorter than one vector, around one and two vectors of 4 and 8 lanes, and long
+	// enough for an unrolled body followed by every length of tail.
+	static const int counts[] = { 1, 2, 3, 5, 7, 8, 9, 15, 16, 17, 31, 33, 63, 64, 65, 67, 129, 257 };
+	for(int count : counts)
+	{
+		if(!MatchesScalar(kernels, maxUlps, count))
+			return false;
+	}
+	return true;
+}
+
+bool WavesKernels::MatchesScalar(const WavesKernels& kernels, int maxUlps, int count)
+{
+	const int stride = count + 2;
+	const float k1 = -0.98f, k2 = 0.72f, k3 = 0.31f, twoDx = 2.0f;
+
+	std::vector<float> rows(3*stride);
+	std::uint32_t seed = 12345u;
+	for(auto& h : rows)
+	{
+		seed = seed*1664525u + 1013904223u;
+		h = ((seed >> 8) / 16777216.0f - 0.5f)*4.0f;
+	}
+
+	const float* up = &rows[0*stride + 1];
+	const float* curr = &rows[1*stride + 1];
+	const float* down = &rows[2*stride + 1];
+
+	std::vector<float> prevRef(curr, curr + count), prevTest(curr, curr + count);
+	for(auto& h : prevRef)
+		h *= 0.5f;
+	prevTest = prevRef;
+
+	Scalar().StencilRow(prevRef.data(), up, curr, down, count, k1, k2, k3);
+	kernels.StencilRow(prevTest.data(), up, curr, down, count, k1, k2, k3);
+	if(!WithinUlps(prevRef, prevTest, maxUlps))
+		return false;
+
+	std::vector<float> ref[5], test[5];
+	for(int p = 0; p < 5; ++p)
+	{
+		ref[p].resize(count);
+		test[p].resize(count);
+	}
+
+	Scalar().NormalRow(up, curr, down, count, twoDx,
+		ref[0].data(), ref[1].data(), ref[2].data(), ref[3].data(), ref[4].data());
+	kernels.NormalRow(up, curr, down, count, twoDx,
+		test[0].data(), test[1].data(), test[2].data(), test[3].data(), test[4].data());
+
+	for(int p = 0; p < 5; ++p)
+	{
+		if(!WithinUlps(ref[p], test[p], maxUlps))
+			return false;
+	}
+
+	// A maximum of absolute values involves no rounding, so it must match exactly.
+	if(Scalar().ActivityRow(prevRef.data(), curr, count) != kernels.ActivityRow(prevRef.data(), curr, count))
+		return false;
+
+	// Packing rounds once from exactly computed values, so it must match exactly too.
+	// Scale the heights so they cover half denormals, normal halves and overflow.
+	std::vector<float> heights(count);
+	for(int j = 0; j < count; ++j)
+		heights[j] = curr[j]*std::ldexp(1.0f, j % 36 - 20);
+
+	std::vector<PackedVertex> packedRef(count), packedTest(count);
+	Scalar().PackRow(heights.data(), ref[0].data(), ref[1].data(), ref[2].data(), count, packedRef.data());
+	kernels.PackRow(heights.data(), ref[0].data(), ref[1].data(), ref[2].data(), count, packedTest.data());
+	if(std::memcmp(packedRef.data(), packedTest.data(), count*sizeof(PackedVertex)) != 0)
+		return false;
+
+	// Streaming writes the same vertices.  Start one vertex past an aligned address so
+	// the unaligned head is exercised as well.
+	std::vector<PackedVertex> streamed(count + 8);
+	PackedVertex* out = streamed.data() + HeadCount(streamed.data(), 8, 32) + 1;
+	kernels.StreamRow(heights.data(), ref[0].data(), ref[1].data(), ref[2].data(), count, out);
+	kernels.EndStream();
+
+	return std::memcmp(packedRef.data(), out, count*sizeof(PackedVertex)) == 0;
+}
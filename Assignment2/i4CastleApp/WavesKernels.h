@@ -0,0 +1,89 @@
+//***************************************************************************************
+// WavesKernels.h
+//
+// Row kernels used by the wave simulation.  Each kernel works on a contiguous run of
+// interior grid points in one row.  Several implementations exist (scalar, SSE2, AVX2,
+// NEON); Best() picks the widest one the CPU supports at run time.  WavesBench -check
+// compares every supported one to the scalar kernels.  The scalar kernels
+// are always kept so the vector versions can be validated against them.
+//***************************************************************************************
+
+#ifndef WAVESKERNELS_H
+#define WAVESKERNELS_H
+
+#include <cstdint>
+#include <vector>
+
+struct WavesKernels
+{
+	// Compact water vertex for the GPU.  The height is an IEEE half float.  The normal
+	// is projected onto the octahedron |x| + |y| + |z| = 1 and its x and z stored as
+	// 8-bit snorms; the wave normals always point up, so the upper half of the
+	// octahedron is enough and y = 1 - |x| - |z|.  The grid x/z are not stored.
+	struct PackedVertex
+	{
+		std::uint16_t Height;
+		std::int8_t NormalX;
+		std::int8_t NormalZ;
+	};
+
+	// Advances count heights of one row to the next time step, in place:
+	//   prev[j] = k1*prev[j] + k2*curr[j] + k3*(down[j] + up[j] + curr[j+1] + curr[j-1])
+	// curr[-1] and curr[count] must be readable.
+	using StencilRowFn = void(*)(float* prev, const float* up, const float* curr, const float* down,
+		int count, float k1, float k2, float k3);
+
+	// Computes the unit normal and x-tangent of count points of one row from the
+	// heights of the row above, the row itself and the row below.  twoDx is twice
+	// the spatial step.  curr[-1] and curr[count] must be readable.
+	using NormalRowFn = void(*)(const float* up, const float* curr, const float* down,
+		int count, float twoDx,
+		float* normalX, float* normalY, float* normalZ,
+		float* tangentXX, float* tangentXY);
+
+	// Returns the largest of |next[j]| and |next[j] - curr[j]| over count points, which
+	// measures how far a run of points is from rest (displacement and velocity).
+	using ActivityRowFn = float(*)(const float* next, const float* curr, int count);
+
+	// Packs count vertices.  Heights are rounded to the nearest half (ties to even) and
+	// octahedral coordinates to the nearest multiple of 1/127.
+	using PackRowFn = void(*)(const float* height, const float* normalX, const float* normalY,
+		const float* normalZ, int count, PackedVertex* out);
+
+	// Orders the stores of earlier StreamRow calls before any later store, so another
+	// agent (the GPU) that is signalled afterwards sees them.
+	using EndStreamFn = void(*)();
+
+	const char* Name = "";
+	StencilRowFn StencilRow = nullptr;
+	NormalRowFn NormalRow = nullptr;
+	ActivityRowFn ActivityRow = nullptr;
+	PackRowFn PackRow = nullptr;
+
+	// Same results as PackRow, written with non-temporal stores that bypass the cache
+	// where the CPU has them.  Meant for write-combined memory such as a mapped upload
+	// heap, which is never read back.  Call EndStream after the last row.
+	PackRowFn StreamRow = nullptr;
+	EndStreamFn EndStream = nullptr;
+
+	// The portable reference implementation.
+	static const WavesKernels& Scalar();
+
+	// Every implementation this CPU supports, Scalar first and the fastest last.
+	// Detected on first use.
+	static const std::vector<WavesKernels>& Supported();
+
+	// The fastest implementation supported by this CPU, Supported().back().
+	static const WavesKernels& Best();
+
+	// Runs the kernels on synthetic rows of several widths, odd ones included so both
+	// the vector bodies and the scalar tails are exercised, and compares them to the
+	// scalar kernels.  Returns true if every result is within maxUlps units in the
+	// last place.
+	static bool MatchesScalar(const WavesKernels& kernels, int maxUlps);
+
+	// The same for a single row width.
+	static bool MatchesScalar(const WavesKernels& kernels, int maxUlps, int count);
+};
+
+#endif // WAVESKERNELS_H
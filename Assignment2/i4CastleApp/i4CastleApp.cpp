@@ -7,8 +7,21 @@
 #include "../../Common/UploadBuffer.h"
 #include "../../Common/GeometryGenerator.h"
 #include "../../Common/Camera.h"
+#include "../../Common/D3D12RenderDevice.h"
+#include "../../Common/FrustumCuller.h"
+#include "../../Common/DrawSort.h"
+#include "../../Common/CommandBindCache.h"
+#include "../../Common/SceneFile.h"
+#include "../../Common/MeshOptimizer.h"
 #include "FrameResource.h"
+#include "FrameUpdater.h"
+#include "InstanceBatcher.h"
+#include "MeshPacker.h"
 #include "Waves.h"
+#include "WaterSystem.h"
+#include "AsyncWaves.h"
+#include <fstream>
+#include <random>
 
 using Microsoft::WRL::ComPtr;
 using namespace DirectX;
@@ -20,29 +33,13 @@ using namespace DirectX::PackedVector;
 const int gNumFrameResources = 3;
 
 // Lightweight structure stores parameters to draw a shape.  This will
-// vary from app-to-app.
-struct RenderItem
+// vary from app-to-app.  The world matrix, constant buffer index and material
+// are in ObjectState; see FrameUpdater.
+struct RenderItem : ObjectState
 {
 	RenderItem() = default;
     //RenderItem(const RenderItem& rhs) = delete;
- 
-    // World matrix of the shape that describes the object's local space
-    // relative to the world space, which defines the position, orientation,
-    // and scale of the object in the world.
-    XMFLOAT4X4 World = MathHelper::Identity4x4();
-
-	XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
-
-	// Dirty flag indicating the object data has changed and we need to update the constant buffer.
-	// Because we have an object cbuffer for each FrameResource, we have to apply the
-	// update to each FrameResource.  Thus, when we modify obect data we should set 
-	// NumFramesDirty = gNumFrameResources so that each frame resource gets the update.
-	int NumFramesDirty = gNumFrameResources;
-
-	// Index into GPU constant buffer corresponding to the ObjectCB for this render item.
-	UINT ObjCBIndex = -1;
 
-	Material* Mat = nullptr;
 	MeshGeometry* Geo = nullptr;
 
     // Primitive topology.
@@ -52,6 +49,14 @@ struct RenderItem
     UINT IndexCount = 0;
     UINT StartIndexLocation = 0;
     int BaseVertexLocation = 0;
+
+	// Optional second vertex stream, bound to slot 1 when BufferLocation is set.
+	D3D12_VERTEX_BUFFER_VIEW DynamicVertexBufferView = {};
+
+	// Local-space bounds of the submesh drawn, and the item's index in the frustum
+	// culler; -1 if it is never culled.
+	BoundingBox Bounds;
+	int CullIndex = -1;
 };
 
 enum class RenderLayer : int
@@ -59,6 +64,8 @@ enum class RenderLayer : int
 	Opaque = 0,
 	Transparent,
 	AlphaTested,
+	Waves,
+	WaterRings,
 	Count
 };
 
@@ -88,18 +95,25 @@ private:
 	void UpdateMaterialBuffer(const GameTimer& gt);
 	void UpdateMainPassCB(const GameTimer& gt);
 	void UpdateWaves(const GameTimer& gt);
+	void UpdateCulling(const GameTimer& gt);
+	void UpdateStats(const GameTimer& gt);
+	void ToggleWavesRecording();
 
 	void LoadTextures();
     void BuildRootSignature();
 	void BuildDescriptorHeaps();
     void BuildShadersAndInputLayout();
 	void BuildWavesGeometry();
+	void BuildWaterRingsGeometry();
     void BuildShapeGeometry();
     void BuildPSOs();
     void BuildFrameResources();
     void BuildMaterials();
     void BuildRenderItems();
-    void DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems);
+	void BuildInstanceBatches();
+	void BuildDrawSortIds();
+    void DrawRenderItems(ID3D12GraphicsCommandList* cmdList, RenderLayer layer, const std::vector<RenderItem*>& ritems);
+	void DrawInstanceBatches(ID3D12GraphicsCommandList* cmdList, RenderLayer layer);
 
 	std::array<const CD3DX12_STATIC_SAMPLER_DESC, 6> GetStaticSamplers();
 
@@ -122,20 +136,71 @@ private:
 	std::unordered_map<std::string, ComPtr<ID3D12PipelineState>> mPSOs;
 
     std::vector<D3D12_INPUT_ELEMENT_DESC> mInputLayout;
+    std::vector<D3D12_INPUT_ELEMENT_DESC> mWavesInputLayout;
+    std::vector<D3D12_INPUT_ELEMENT_DESC> mWaterRingsInputLayout;
  
-	RenderItem* mWavesRitem = nullptr;
+	// One render item per water body, indexed like the bodies.
+	std::vector<RenderItem*> mWaterBodyRitems;
+	RenderItem* mWaterRingsRitem = nullptr;
 
 
 	// List of all the render items.
 	std::vector<std::unique_ptr<RenderItem>> mAllRitems;
 
-	std::unique_ptr<Waves> mWaves;
+	// The water bodies are only used through mAsyncWaves, which runs them on a worker
+	// thread; mWater itself is only asked for their dimensions and vertex layout.
+	// Each body is drawn at its position in mWaterBodyPositions plus its origin.
+	std::unique_ptr<WaterSystem> mWater;
+	std::unique_ptr<AsyncWaves> mAsyncWaves;
+	std::vector<XMFLOAT3> mWaterBodyPositions;
+	int mLakeBody = 0;
+	int mMoatBody = 0;
+	int mFountainBody = 0;
+	bool mToggleAsyncKeyDown = false;
+
+	// Random splashes come from a fixed seed.  While recording, everything done to
+	// each body goes into its entry of mWavesLogs; see ToggleWavesRecording.
+	std::minstd_rand mSplashRandom{ 1 };
+	std::vector<WavesLog> mWavesLogs;
+	bool mRecordingWaves = false;
+	bool mRecordKeyDown = false;
+
+	// Every render item's bounds, tested against the camera frustum each frame;
+	// DrawRenderItems skips the items outside it.
+	FrustumCuller mCuller;
+
+	// The opaque and alpha tested items, grouped into instanced draws; see
+	// BuildInstanceBatches.  The blended layers are drawn item by item, back to front.
+	InstanceBatcher mBatcher;
+
+	// Each layer's draws are sorted by DrawSort keys, so that consecutive draws mostly
+	// share their bindings, and recorded through mBindCache, which skips the bindings
+	// that are already set.  mGeometrySortIds numbers the geometries for the keys.
+	std::unordered_map<const MeshGeometry*, UINT> mGeometrySortIds;
+	std::vector<DrawSortEntry> mDrawEntries;
+	std::vector<DrawSortEntry> mDrawSortScratch;
+	CommandBindCache mBindCache;
+
+	// Per-frame upload, culling and draw stats, averaged over a second for the caption.
+	UINT64 mWavesUploadBytes = 0;
+	UINT64 mCulledItems = 0;
+	UINT64 mObjectDraws = 0;
+	UINT64 mBatchDraws = 0;
+	UINT64 mBindFrames = 0;
+	UINT64 mStatsFrames = 0;
+	float mStatsTime = 0.0f;
+	std::wstring mBaseCaption;
 
 	// Render items divided by PSO.
 	std::vector<RenderItem*> mOpaqueRitems;
 	std::vector<RenderItem*> mRitemLayer[(int)RenderLayer::Count];
 
-    PassConstants mMainPassCB;
+	// The frame resources and the upload ring are created through mRenderDevice.
+	// Every frame's constants come out of the ring; mFrameUpdater builds them, and
+	// keeps the object and material constants between frames.
+	std::unique_ptr<D3D12RenderDevice> mRenderDevice;
+	std::unique_ptr<UploadRing> mUploadRing;
+	std::unique_ptr<FrameUpdater> mFrameUpdater;
 
 	Camera mCamera;
 
@@ -163,6 +228,11 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE prevInstance,
         MessageBox(nullptr, e.ToString().c_str(), L"HR Failed", MB_OK);
         return 0;
     }
+    catch(std::exception& e)
+    {
+        MessageBoxA(nullptr, e.what(), "Failed", MB_OK);
+        return 0;
+    }
 }
 
 i4CastleApp::i4CastleApp(HINSTANCE hInstance)
@@ -190,16 +260,35 @@ bool i4CastleApp::Initialize()
 
 	mCamera.SetPosition(0.0f, 3.0f, -25.0f);
  
-	mWaves = std::make_unique<Waves>(128, 128, 1.0f, 0.03f, 4.0f, 0.2f);
+	// The lake follows the camera; coarser flat rings extend it out to beyond the far
+	// plane.  It has more than 64K vertices, so the water uses 32-bit indices.  The
+	// moat in front of the gate and the fountain beyond it stay where they are.
+	mWater = std::make_unique<WaterSystem>();
+	mLakeBody = mWater->AddBody(257, 257, 1.0f, 0.03f, 4.0f, 0.2f, true);
+	mMoatBody = mWater->AddBody(33, 161, 0.25f, 0.03f, 4.0f, 0.4f, false);
+	mFountainBody = mWater->AddBody(33, 33, 0.125f, 0.02f, 2.0f, 1.0f, false);
+
+	mWaterBodyPositions.resize(mWater->BodyCount());
+	mWaterBodyPositions[mLakeBody] = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	mWaterBodyPositions[mMoatBody] = XMFLOAT3(0.0f, 0.2f, -16.0f);
+	mWaterBodyPositions[mFountainBody] = XMFLOAT3(0.0f, 0.6f, -22.0f);
+
+	mWavesLogs.resize(mWater->BodyCount());
+	mAsyncWaves = std::make_unique<AsyncWaves>(*mWater);
+
+	mBaseCaption = mMainWndCaption;
 
 	LoadTextures();
     BuildRootSignature();
 	BuildDescriptorHeaps();
     BuildShadersAndInputLayout();
 	BuildWavesGeometry();
+	BuildWaterRingsGeometry();
     BuildShapeGeometry();
 	BuildMaterials();
     BuildRenderItems();
+	BuildInstanceBatches();
+	BuildDrawSortIds();
     BuildFrameResources();
     BuildPSOs();
 
@@ -232,32 +321,33 @@ void i4CastleApp::Update(const GameTimer& gt)
 
     // Has the GPU finished processing the commands of the current frame resource?
     // If not, wait until the GPU has completed commands up to this fence point.
-    if(mCurrFrameResource->Fence != 0 && mFence->GetCompletedValue() < mCurrFrameResource->Fence)
-    {
-        HANDLE eventHandle = CreateEventEx(nullptr, false, false, EVENT_ALL_ACCESS);
-        ThrowIfFailed(mFence->SetEventOnCompletion(mCurrFrameResource->Fence, eventHandle));
-        WaitForSingleObject(eventHandle, INFINITE);
-        CloseHandle(eventHandle);
-    }
+    mRenderDevice->WaitForFence(mCurrFrameResource->Fence);
 
+	// Everything the ring handed out for frames the GPU has finished is free again.
+	mUploadRing->Reclaim(mRenderDevice->CompletedFenceValue());
+
+	// The water may move to follow the camera, so update it before the object constants.
+	// Culling reads the moved items' dirty flags, which UpdateObjectCBs clears.
 	AnimateMaterials(gt);
+	UpdateWaves(gt);
+	UpdateCulling(gt);
 	UpdateObjectCBs(gt);
 	UpdateMaterialBuffer(gt);
 	UpdateMainPassCB(gt);
-	UpdateWaves(gt);
+	UpdateStats(gt);
 }
 
 void i4CastleApp::Draw(const GameTimer& gt)
 {
-    auto cmdListAlloc = mCurrFrameResource->CmdListAlloc;
+    auto cmdListAlloc = D3D12RenderDevice::Native(*mCurrFrameResource->CmdListAlloc);
 
     // Reuse the memory associated with command recording.
     // We can only reset when the associated command lists have finished execution on the GPU.
-    ThrowIfFailed(cmdListAlloc->Reset());
+    mCurrFrameResource->CmdListAlloc->Reset();
 
     // A command list can be reset after it has been added to the command queue via ExecuteCommandList.
     // Reusing the command list reuses memory.
-    ThrowIfFailed(mCommandList->Reset(cmdListAlloc.Get(), mPSOs["opaque"].Get()));
+    ThrowIfFailed(mCommandList->Reset(cmdListAlloc, mPSOs["opaque"].Get()));
 
     mCommandList->RSSetViewports(1, &mScreenViewport);
     mCommandList->RSSetScissorRects(1, &mScissorRect);
@@ -267,7 +357,7 @@ void i4CastleApp::Draw(const GameTimer& gt)
 		D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET));
 
     // Clear the back buffer and depth buffer.
-    mCommandList->ClearRenderTargetView(CurrentBackBufferView(), (float*)&mMainPassCB.FogColor, 0, nullptr);
+    mCommandList->ClearRenderTargetView(CurrentBackBufferView(), (float*)&mFrameUpdater->MainPassCB().FogColor, 0, nullptr);
     mCommandList->ClearDepthStencilView(DepthStencilView(), D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.0f, 0, 0, nullptr);
 
     // Specify the buffers we are going to render to.
@@ -277,17 +367,24 @@ void i4CastleApp::Draw(const GameTimer& gt)
 	mCommandList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
 
 	mCommandList->SetGraphicsRootSignature(mRootSignature.Get());
+	mBindCache.Reset(mCommandList.Get());
 
-	auto passCB = mCurrFrameResource->PassCB->Resource();
-	mCommandList->SetGraphicsRootConstantBufferView(2, passCB->GetGPUVirtualAddress());
+	mBindCache.SetGraphicsRootConstantBufferView(2, mCurrFrameResource->PassCB.Address(0));
 
-	DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::Opaque]);
+	mCommandList->SetPipelineState(mPSOs["opaqueInstanced"].Get());
+	DrawInstanceBatches(mCommandList.Get(), RenderLayer::Opaque);
 
-	mCommandList->SetPipelineState(mPSOs["alphaTested"].Get());
-	DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::AlphaTested]);
+	mCommandList->SetPipelineState(mPSOs["alphaTestedInstanced"].Get());
+	DrawInstanceBatches(mCommandList.Get(), RenderLayer::AlphaTested);
 
 	mCommandList->SetPipelineState(mPSOs["transparent"].Get());
-	DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::Transparent]);
+	DrawRenderItems(mCommandList.Get(), RenderLayer::Transparent, mRitemLayer[(int)RenderLayer::Transparent]);
+
+	mCommandList->SetPipelineState(mPSOs["waves"].Get());
+	DrawRenderItems(mCommandList.Get(), RenderLayer::Waves, mRitemLayer[(int)RenderLayer::Waves]);
+
+	mCommandList->SetPipelineState(mPSOs["waterRings"].Get());
+	DrawRenderItems(mCommandList.Get(), RenderLayer::WaterRings, mRitemLayer[(int)RenderLayer::WaterRings]);
 
 	// Bind all the materials used in this scene.  For structured buffers, we can bypass the heap and 
 	// set as a root descriptor.
@@ -299,7 +396,7 @@ void i4CastleApp::Draw(const GameTimer& gt)
     // The root signature knows how many descriptors are expected in the table.
 	//mCommandList->SetGraphicsRootDescriptorTable(3, mSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart());
 
-    DrawRenderItems(mCommandList.Get(), mOpaqueRitems);
+    DrawRenderItems(mCommandList.Get(), RenderLayer::Opaque, mOpaqueRitems);
 
     // Indicate a state transition on the resource usage.
 	mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(CurrentBackBuffer(),
@@ -312,17 +409,20 @@ void i4CastleApp::Draw(const GameTimer& gt)
     ID3D12CommandList* cmdsLists[] = { mCommandList.Get() };
     mCommandQueue->ExecuteCommandLists(_countof(cmdsLists), cmdsLists);
 
+	++mBindFrames;
+
     // Swap the back and front buffers
     ThrowIfFailed(mSwapChain->Present(0, 0));
 	mCurrBackBuffer = (mCurrBackBuffer + 1) % SwapChainBufferCount;
 
     // Advance the fence value to mark commands up to this fence point.
     mCurrFrameResource->Fence = ++mCurrentFence;
+	mUploadRing->EndFrame(mCurrentFence);
 
     // Add an instruction to the command queue to set a new fence point. 
     // Because we are on the GPU timeline, the new fence point won't be 
     // set until the GPU finishes processing all the commands prior to this Signal().
-    mCommandQueue->Signal(mFence.Get(), mCurrentFence);
+    mRenderDevice->Signal(mCurrentFence);
 }
 
 void i4CastleApp::OnMouseDown(WPARAM btnState, int x, int y)
@@ -393,6 +493,55 @@ void i4CastleApp::OnKeyboardInput(const GameTimer& gt)
 	}	
 
 	mCamera.UpdateViewMatrix();
+
+	// T switches the wave simulation between the worker thread and the main thread.
+	bool toggleAsyncKeyDown = (GetAsyncKeyState('T') & 0x8000) != 0;
+	if (toggleAsyncKeyDown && !mToggleAsyncKeyDown)
+		mAsyncWaves->SetAsynchronous(!mAsyncWaves->Asynchronous());
+	mToggleAsyncKeyDown = toggleAsyncKeyDown;
+
+	// R starts and stops recording the waves.
+	bool recordKeyDown = (GetAsyncKeyState('R') & 0x8000) != 0;
+	if (recordKeyDown && !mRecordKeyDown)
+		ToggleWavesRecording();
+	mRecordKeyDown = recordKeyDown;
+}
+
+// Starting a recording saves a checkpoint of each water body b to
+// WavesCheckpoint<b>.bin and logs everything done to it from then on; stopping it
+// saves the log to WavesLog<b>.bin.  "WavesBench -replay WavesCheckpoint0.bin
+// WavesLog0.bin" plays the recording of the lake back bit for bit.
+void i4CastleApp::ToggleWavesRecording()
+{
+	WaterSystem& water = mAsyncWaves->System();
+	if (!mRecordingWaves)
+	{
+		for (int b = 0; b < water.BodyCount(); ++b)
+		{
+			std::ofstream checkpoint("WavesCheckpoint" + std::to_string(b) + ".bin", std::ios::binary);
+			if (!water.Body(b).Save(checkpoint))
+			{
+				for (int k = 0; k < b; ++k)
+					water.Body(k).SetLog(nullptr);
+				return;
+			}
+
+			mWavesLogs[b].Events.clear();
+			water.Body(b).SetLog(&mWavesLogs[b]);
+		}
+		mRecordingWaves = true;
+	}
+	else
+	{
+		for (int b = 0; b < water.BodyCount(); ++b)
+		{
+			water.Body(b).SetLog(nullptr);
+
+			std::ofstream log("WavesLog" + std::to_string(b) + ".bin", std::ios::binary);
+			mWavesLogs[b].Save(log);
+		}
+		mRecordingWaves = false;
+	}
 }
 
 
@@ -438,138 +587,129 @@ void i4CastleApp::AnimateMaterials(const GameTimer& gt)
 
 void i4CastleApp::UpdateObjectCBs(const GameTimer& gt)
 {
-	auto currObjectCB = mCurrFrameResource->ObjectCB.get();
-	for(auto& e : mAllRitems)
-	{
-		// Only update the cbuffer data if the constants have changed.  
-		// This needs to be tracked per frame resource.
-		if(e->NumFramesDirty > 0)
-		{
-			XMMATRIX world = XMLoadFloat4x4(&e->World);
-			XMMATRIX texTransform = XMLoadFloat4x4(&e->TexTransform);
-
-			ObjectConstants objConstants;
-			XMStoreFloat4x4(&objConstants.World, XMMatrixTranspose(world));
-			XMStoreFloat4x4(&objConstants.TexTransform, XMMatrixTranspose(texTransform));
-			objConstants.MaterialIndex = e->Mat->MatCBIndex;
-
-			currObjectCB->CopyData(e->ObjCBIndex, objConstants);
-
-			// Next FrameResource need to be updated too.
-			e->NumFramesDirty--;
-		}
-	}
+	mFrameUpdater->UpdateObjectCBs(mAllRitems, *mCurrFrameResource);
+	mFrameUpdater->UpdateInstanceBuffer(mBatcher, *mCurrFrameResource);
 }
 
 void i4CastleApp::UpdateMaterialBuffer(const GameTimer& gt)
 {
-	auto currMaterialBuffer = mCurrFrameResource->MaterialCB.get();
-	for(auto& e : mMaterials)
-	{
-		// Only update the cbuffer data if the constants have changed.  If the cbuffer
-		// data changes, it needs to be updated for each FrameResource.
-		Material* mat = e.second.get();
-		if(mat->NumFramesDirty > 0)
-		{
-			XMMATRIX matTransform = XMLoadFloat4x4(&mat->MatTransform);
-
-			MaterialData matData;
-			matData.DiffuseAlbedo = mat->DiffuseAlbedo;
-			matData.FresnelR0 = mat->FresnelR0;
-			matData.Roughness = mat->Roughness;
-			XMStoreFloat4x4(&matData.MatTransform, XMMatrixTranspose(matTransform));
-			//matData.DiffuseMapIndex = mat->DiffuseSrvHeapIndex;
-
-			currMaterialBuffer->CopyData(mat->MatCBIndex, matData);
-
-			// Next FrameResource need to be updated too.
-			mat->NumFramesDirty--;
-		}
-	}
+	mFrameUpdater->UpdateMaterialBuffer(mMaterials, *mCurrFrameResource);
 }
 
 void i4CastleApp::UpdateMainPassCB(const GameTimer& gt)
 {
-	XMMATRIX view = mCamera.GetView();
-	XMMATRIX proj = mCamera.GetProj();
-
-	XMMATRIX viewProj = XMMatrixMultiply(view, proj);
-	XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(view), view);
-	XMMATRIX invProj = XMMatrixInverse(&XMMatrixDeterminant(proj), proj);
-	XMMATRIX invViewProj = XMMatrixInverse(&XMMatrixDeterminant(viewProj), viewProj);
-
-	XMStoreFloat4x4(&mMainPassCB.View, XMMatrixTranspose(view));
-	XMStoreFloat4x4(&mMainPassCB.InvView, XMMatrixTranspose(invView));
-	XMStoreFloat4x4(&mMainPassCB.Proj, XMMatrixTranspose(proj));
-	XMStoreFloat4x4(&mMainPassCB.InvProj, XMMatrixTranspose(invProj));
-	XMStoreFloat4x4(&mMainPassCB.ViewProj, XMMatrixTranspose(viewProj));
-	XMStoreFloat4x4(&mMainPassCB.InvViewProj, XMMatrixTranspose(invViewProj));
-	mMainPassCB.EyePosW = mCamera.GetPosition3f();
-	mMainPassCB.RenderTargetSize = XMFLOAT2((float)mClientWidth, (float)mClientHeight);
-	mMainPassCB.InvRenderTargetSize = XMFLOAT2(1.0f / mClientWidth, 1.0f / mClientHeight);
-	mMainPassCB.NearZ = 1.0f;
-	mMainPassCB.FarZ = 1000.0f;
-	mMainPassCB.TotalTime = gt.TotalTime();
-	mMainPassCB.DeltaTime = gt.DeltaTime();
-	mMainPassCB.AmbientLight = { 0.25f, 0.25f, 0.35f, 1.0f };
-	mMainPassCB.Lights[0].Direction = { 0.57735f, -0.57735f, 0.57735f };
-	mMainPassCB.Lights[0].Strength = { 0.2f, 0.2f, 0.2f };
-	//mMainPassCB.Lights[1].Direction = { -0.57735f, -0.57735f, 0.57735f };
-	mMainPassCB.Lights[1].Strength = { 1.0f, 1.0f, 1.0f };
-	mMainPassCB.Lights[1].Position = { 0.0f, 3.0f, -7.8f };
-	mMainPassCB.Lights[2].Strength = { 1.0f, 0.0f, 0.0f };
-	mMainPassCB.Lights[2].Position = { 4.0f, 6.0f, 0.0f };
-	mMainPassCB.Lights[3].Strength = { 0.0f, 1.0f, 0.0f };
-	mMainPassCB.Lights[3].Position = { -4.0f, 6.0f, 0.0f };
-	mMainPassCB.Lights[4].Strength = { 0.0f, 0.0f, 1.0f };
-	mMainPassCB.Lights[4].Position = { 4.0f, 6.0f, 8.0f };
-	mMainPassCB.Lights[5].Strength = { 1.0f, 1.0f, 0.0f };
-	mMainPassCB.Lights[5].Position = { -4.0f, 6.0f, 8.0f };
-	mMainPassCB.Lights[6].Strength = { 1.0f, 1.0f, 1.0f };
-	mMainPassCB.Lights[6].Position = { 0.0f, 10.0f, 6.0f };
-
-	auto currPassCB = mCurrFrameResource->PassCB.get();
-	currPassCB->CopyData(0, mMainPassCB);
+	mFrameUpdater->UpdateMainPassCB(mCamera.GetView(), mCamera.GetProj(), mCamera.GetPosition3f(),
+		(float)mClientWidth, (float)mClientHeight, gt.TotalTime(), gt.DeltaTime(), *mCurrFrameResource);
 }
 
 void i4CastleApp::UpdateWaves(const GameTimer& gt)
 {
-	// Every quarter second, generate a random wave.
+	// Every quarter second, generate a random wave on the lake and on the moat, and
+	// let the fountain bubble up in its middle.
 	static float t_base = 0.0f;
 	if ((mTimer.TotalTime() - t_base) >= 0.25f)
 	{
 		t_base += 0.25f;
 
-		int i = MathHelper::Rand(4, mWaves->RowCount() - 5);
-		int j = MathHelper::Rand(4, mWaves->ColumnCount() - 5);
+		for (int body : { mLakeBody, mMoatBody })
+		{
+			const Waves& waves = mWater->Body(body);
+			int i = std::uniform_int_distribution<int>(4, waves.RowCount() - 5)(mSplashRandom);
+			int j = std::uniform_int_distribution<int>(4, waves.ColumnCount() - 5)(mSplashRandom);
+
+			float r = std::uniform_real_distribution<float>(0.2f, 0.5f)(mSplashRandom);
 
-		float r = MathHelper::RandF(0.2f, 0.5f);
+			mAsyncWaves->Disturb(body, i, j, r);
+		}
 
-		mWaves->Disturb(i, j, r);
+		const Waves& fountain = mWater->Body(mFountainBody);
+		mAsyncWaves->Disturb(mFountainBody, fountain.RowCount() / 2, fountain.ColumnCount() / 2, 0.15f, 3);
 	}
 
-	// Update the wave simulation.
-	mWaves->Update(gt.DeltaTime());
+	// Update the wave simulations, keeping the lake under the camera.  In asynchronous
+	// mode this only queues the step for the worker thread.
+	XMFLOAT3 eyePos = mCamera.GetPosition3f();
+	mAsyncWaves->Update(gt.DeltaTime(), eyePos.x, eyePos.z);
 
-	// Update the wave vertex buffer with the new solution.
-	auto currWavesVB = mCurrFrameResource->WavesVB.get();
-	for (int i = 0; i < mWaves->VertexCount(); ++i)
-	{
-		Vertex v;
+	// Draw the newest finished simulation frame.
+	mAsyncWaves->Acquire();
 
-		v.Pos = mWaves->Position(i);
-		v.Normal = mWaves->Normal(i);
+	// Place the bodies at their origins and upload the tiles that changed.
+	UINT64 bytes = mFrameUpdater->UpdateWaves(*mAsyncWaves, *mWater, mWaterBodyPositions, mWaterBodyRitems,
+		*mCurrFrameResource);
 
-		// Derive tex-coords from position by 
-		// mapping [-w/2,w/2] --> [0,1]
-		v.TexC.x = 0.5f + v.Pos.x / mWaves->Width();
-		v.TexC.y = 0.5f - v.Pos.z / mWaves->Depth();
+	// The rings move with the lake.
+	RenderItem* lakeRitem = mWaterBodyRitems[mLakeBody];
+	if (lakeRitem->NumFramesDirty > 0)
+	{
+		mWaterRingsRitem->World = lakeRitem->World;
+		mWaterRingsRitem->NumFramesDirty = gNumFrameResources;
+	}
+
+	mWavesUploadBytes += bytes;
+
+	// Point the dynamic stream of the water render items at the current frame VB.
+	// The static and dynamic streams share one layout, so each item's
+	// BaseVertexLocation selects its body's slice of both.
+	D3D12_VERTEX_BUFFER_VIEW dynamicView;
+	dynamicView.BufferLocation = mCurrFrameResource->WavesVB->GpuAddress();
+	dynamicView.StrideInBytes = sizeof(Waves::PackedVertex);
+	dynamicView.SizeInBytes = mWater->VertexCount() * sizeof(Waves::PackedVertex);
+	for (RenderItem* ritem : mWaterBodyRitems)
+		ritem->DynamicVertexBufferView = dynamicView;
+}
 
-		currWavesVB->CopyData(i, v);
+void i4CastleApp::UpdateCulling(const GameTimer& gt)
+{
+	// The cached world-space boxes only change with the world matrices.
+	for (auto& e : mAllRitems)
+	{
+		if (e->CullIndex >= 0 && e->NumFramesDirty > 0)
+			mCuller.SetWorld(e->CullIndex, e->World);
 	}
 
-	// Set the dynamic VB of the wave renderitem to the current frame VB.
-	mWavesRitem->Geo->VertexBufferGPU = currWavesVB->Resource();
+	mCuller.Cull(XMMatrixMultiply(mCamera.GetView(), mCamera.GetProj()));
+	mCulledItems += mCuller.CulledCount();
+
+	// List the instances left in each batch.
+	mBatcher.Gather(mCuller);
+	mObjectDraws += mBatcher.ObjectDrawCount();
+	mBatchDraws += mBatcher.BatchDrawCount();
+}
+
+void i4CastleApp::UpdateStats(const GameTimer& gt)
+{
+	// Show the average number of bytes written to the water VB, of items drawn, of
+	// draw calls for the batched items without and with instancing, and of bindings
+	// recorded and skipped, per frame in the caption bar.
+	++mStatsFrames;
+	if ((mTimer.TotalTime() - mStatsTime) >= 1.0f)
+	{
+		UINT64 culled = mCulledItems / mStatsFrames;
+		mMainWndCaption = mBaseCaption + L"    waves VB: " +
+			std::to_wstring(mWavesUploadBytes / mStatsFrames) + L" B/frame" +
+			(mAsyncWaves->Asynchronous() ? L"  (async, T to toggle)" : L"  (sync, T to toggle)") +
+			(mRecordingWaves ? L"  recording, R to stop" : L"") +
+			L"    items: " + std::to_wstring(mCuller.TestedCount()) + L" tested, " +
+			std::to_wstring(culled) + L" culled, " +
+			std::to_wstring(mCuller.TestedCount() - culled) + L" drawn" +
+			L"    draws: " + std::to_wstring(mObjectDraws / mStatsFrames) + L" -> " +
+			std::to_wstring(mBatchDraws / mStatsFrames) + L" instanced";
+		if (mBindFrames > 0)
+		{
+			mMainWndCaption += L"    binds: " + std::to_wstring(mBindCache.IssuedCount() / mBindFrames) + L" set, " +
+				std::to_wstring(mBindCache.AvoidedCount() / mBindFrames) + L" redundant skipped";
+		}
+
+		mWavesUploadBytes = 0;
+		mCulledItems = 0;
+		mObjectDraws = 0;
+		mBatchDraws = 0;
+		mBindCache.ResetCounts();
+		mBindFrames = 0;
+		mStatsFrames = 0;
+		mStatsTime += 1.0f;
+	}
 }
 
 void i4CastleApp::LoadTextures()
@@ -623,7 +763,7 @@ void i4CastleApp::BuildRootSignature()
 	texTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0);
 
     // Root parameter can be a table, root descriptor or root constants.
-    CD3DX12_ROOT_PARAMETER slotRootParameter[4];
+    CD3DX12_ROOT_PARAMETER slotRootParameter[5];
 
 	// Perfomance TIP: Order from most frequent to least frequent.
 	slotRootParameter[0].InitAsDescriptorTable(1, &texTable, D3D12_SHADER_VISIBILITY_PIXEL);
@@ -632,12 +772,13 @@ void i4CastleApp::BuildRootSignature()
     //slotRootParameter[2].InitAsShaderResourceView(0, 1);
 	slotRootParameter[3].InitAsConstantBufferView(2);
 	//slotRootParameter[3].InitAsDescriptorTable(1, &texTable, D3D12_SHADER_VISIBILITY_PIXEL);
+	slotRootParameter[4].InitAsShaderResourceView(1, 1);
 
 
 	auto staticSamplers = GetStaticSamplers();
 
     // A root signature is an array of root parameters.
-	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(4, slotRootParameter,
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(5, slotRootParameter,
 		(UINT)staticSamplers.size(), staticSamplers.data(),
 		D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
 
@@ -733,6 +874,9 @@ void i4CastleApp::BuildShadersAndInputLayout()
 	};
 
 	mShaders["standardVS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", nullptr, "VS", "vs_5_1");
+	mShaders["instancedVS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", nullptr, "InstancedVS", "vs_5_1");
+	mShaders["wavesVS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", nullptr, "WavesVS", "vs_5_1");
+	mShaders["waterRingsVS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", nullptr, "WaterRingsVS", "vs_5_1");
 	mShaders["opaquePS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", defines, "PS", "ps_5_1");
 	mShaders["alphaTestedPS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", alphaTestDefines, "PS", "ps_5_1");
 	
@@ -742,62 +886,171 @@ void i4CastleApp::BuildShadersAndInputLayout()
         { "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
 		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
     };
+
+	// Slot 0 is the static WaveStaticVertex stream, slot 1 the per-frame Waves::PackedVertex stream.
+	mWavesInputLayout =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "HEIGHT", 0, DXGI_FORMAT_R16_FLOAT, 1, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R8G8_SNORM, 1, 2, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+	};
+
+	// The rings around the simulated water are flat, so they only need the static stream.
+	mWaterRingsInputLayout =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+	};
 }
 
 void i4CastleApp::BuildWavesGeometry()
 {
-	std::vector<std::uint16_t> indices(30 * mWaves->TriangleCount()); // 3 indices per face
-	assert(mWaves->VertexCount() < 0x0000ffff);
-
-	// Iterate over each quad.
-	int m = mWaves->RowCount();
-	int n = mWaves->ColumnCount();
-	int k = 0;
-	for (int i = 0; i < m - 1; ++i)
+	// Every water body goes into one mesh, one submesh per body.  The vertices of a
+	// body start at WaterSystem::FirstVertex, the same place its heights and normals
+	// go in the per-frame buffer, and its indices are relative to that.
+	std::vector<std::uint32_t> indices;
+	std::vector<WaveStaticVertex> vertices(mWater->VertexCount());
+	std::vector<SubmeshGeometry> submeshes(mWater->BodyCount());
+	for (int b = 0; b < mWater->BodyCount(); ++b)
 	{
-		for (int j = 0; j < n - 1; ++j)
+		const Waves& waves = mWater->Body(b);
+		submeshes[b].IndexCount = 3 * waves.TriangleCount(); // 3 indices per face
+		submeshes[b].StartIndexLocation = (UINT)indices.size();
+		submeshes[b].BaseVertexLocation = mWater->FirstVertex(b);
+
+		// Iterate over each quad.
+		int m = waves.RowCount();
+		int n = waves.ColumnCount();
+		for (int i = 0; i < m - 1; ++i)
 		{
-			indices[k] = i * n + j;
-			indices[k + 1] = i * n + j + 1;
-			indices[k + 2] = (i + 1)*n + j;
+			for (int j = 0; j < n - 1; ++j)
+			{
+				indices.push_back(i * n + j);
+				indices.push_back(i * n + j + 1);
+				indices.push_back((i + 1)*n + j);
+
+				indices.push_back((i + 1)*n + j);
+				indices.push_back(i * n + j + 1);
+				indices.push_back((i + 1)*n + j + 1);
+			}
+		}
 
-			indices[k + 3] = (i + 1)*n + j;
-			indices[k + 4] = i * n + j + 1;
-			indices[k + 5] = (i + 1)*n + j + 1;
+		// The vertices stay in grid order, which is where the simulation writes them;
+		// only the triangles are reordered, for the post-transform vertex cache.
+		OptimizeVertexCache(&indices[submeshes[b].StartIndexLocation], submeshes[b].IndexCount,
+			waves.VertexCount());
 
-			k += 6; // next quad
+		// The grid positions never change, so they go into a static buffer once.  The
+		// heights and normals are streamed in each frame.
+		for (int i = 0; i < waves.VertexCount(); ++i)
+		{
+			XMFLOAT3 pos = waves.Position(i);
+			vertices[mWater->FirstVertex(b) + i].PosXZ = XMFLOAT2(pos.x, pos.z);
 		}
+
+		// The grid, with room for the waves above and below it.
+		XMFLOAT3 first = waves.Position(0);
+		XMFLOAT3 last = waves.Position(waves.VertexCount() - 1);
+		BoundingBox::CreateFromPoints(submeshes[b].Bounds,
+			XMVectorSet(first.x, -1.0f, first.z, 1.0f), XMVectorSet(last.x, 1.0f, last.z, 1.0f));
 	}
 
-	UINT vbByteSize = mWaves->VertexCount() * sizeof(Vertex);
-	UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
+	// 16-bit indices while they can address every vertex of the largest body, 32-bit
+	// beyond that.
+	int largest = 0;
+	for (int b = 0; b < mWater->BodyCount(); ++b)
+		largest = std::max<int>(largest, mWater->Body(b).VertexCount());
+
+	bool indices16 = largest < 0x0000ffff;
+	std::vector<std::uint16_t> shortIndices;
+	if (indices16)
+		shortIndices.assign(indices.begin(), indices.end());
+	const void* indexData = indices16 ? (const void*)shortIndices.data() : (const void*)indices.data();
+
+	UINT vbByteSize = (UINT)vertices.size() * sizeof(WaveStaticVertex);
+	UINT ibByteSize = (UINT)indices.size() * (indices16 ? sizeof(std::uint16_t) : sizeof(std::uint32_t));
 
 	auto geo = std::make_unique<MeshGeometry>();
 	geo->Name = "waterGeo";
 
-	// Set dynamically.
-	geo->VertexBufferCPU = nullptr;
-	geo->VertexBufferGPU = nullptr;
+	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
+	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
+
+	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
+	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indexData, ibByteSize);
+
+	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
+		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
+
+	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
+		mCommandList.Get(), indexData, ibByteSize, geo->IndexBufferUploader);
+
+	geo->VertexByteStride = sizeof(WaveStaticVertex);
+	geo->VertexBufferByteSize = vbByteSize;
+	geo->IndexFormat = indices16 ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+	geo->IndexBufferByteSize = ibByteSize;
+
+	for (int b = 0; b < mWater->BodyCount(); ++b)
+		geo->DrawArgs["body" + std::to_string(b)] = submeshes[b];
+
+	mGeometries["waterGeo"] = std::move(geo);
+}
+
+void i4CastleApp::BuildWaterRingsGeometry()
+{
+	// Flat rings of ever coarser quads around the lake, each twice as wide as the
+	// one inside it.  Every ring has as many vertices as the lake's grid, so the cost
+	// grows with the log of the distance covered.  Three rings around the 256 m grid
+	// reach 1024 m from the camera, past the far plane.
+	const UINT ringCount = 3;
+	const Waves& lake = mWater->Body(mLakeBody);
+	int n = lake.ColumnCount() - 1;
+	assert(lake.RowCount() == lake.ColumnCount());
+
+	GeometryGenerator geoGen;
+	GeometryGenerator::MeshData rings = geoGen.CreateClipmapRings(n * lake.SpatialStep(), n, ringCount);
+
+	std::vector<WaveStaticVertex> vertices(rings.Vertices.size());
+	for (size_t i = 0; i < rings.Vertices.size(); ++i)
+	{
+		vertices[i].PosXZ.x = rings.Vertices[i].Position.x;
+		vertices[i].PosXZ.y = rings.Vertices[i].Position.z;
+	}
+
+	std::vector<std::uint32_t>& indices = rings.Indices32;
+
+	UINT vbByteSize = (UINT)vertices.size() * sizeof(WaveStaticVertex);
+	UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint32_t);
+
+	auto geo = std::make_unique<MeshGeometry>();
+	geo->Name = "waterRingsGeo";
+
+	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
+	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
 
 	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
 	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
 
+	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
+		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
+
 	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
 		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
 
-	geo->VertexByteStride = sizeof(Vertex);
+	geo->VertexByteStride = sizeof(WaveStaticVertex);
 	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
+	geo->IndexFormat = DXGI_FORMAT_R32_UINT;
 	geo->IndexBufferByteSize = ibByteSize;
 
 	SubmeshGeometry submesh;
 	submesh.IndexCount = (UINT)indices.size();
 	submesh.StartIndexLocation = 0;
 	submesh.BaseVertexLocation = 0;
+	BoundingBox::CreateFromPoints(submesh.Bounds, rings.Vertices.size(), &rings.Vertices[0].Position,
+		sizeof(GeometryGenerator::Vertex));
 
-	geo->DrawArgs["grid"] = submesh;
+	geo->DrawArgs["rings"] = submesh;
 
-	mGeometries["waterGeo"] = std::move(geo);
+	mGeometries["waterRingsGeo"] = std::move(geo);
 }
 
 
@@ -820,281 +1073,68 @@ void i4CastleApp::BuildShapeGeometry()
 	GeometryGenerator::MeshData container = geoGen.CreateHexagonContainer(1.f, 1.f, 3);
 	GeometryGenerator::MeshData star = geoGen.CreateCandy(1.f, 1.f, 3);
 
-
-	//
-	// We are concatenating all the geometry into one big vertex/index buffer.  So
-	// define the regions in the buffer each submesh covers.
-	//
-
-	// Cache the vertex offsets to each object in the concatenated vertex buffer.
-	UINT boxVertexOffset = 0;
-	UINT gridVertexOffset = (UINT)box.Vertices.size();
-	UINT sphereVertexOffset = gridVertexOffset + (UINT)grid.Vertices.size();
-	UINT cylinderVertexOffset = sphereVertexOffset + (UINT)sphere.Vertices.size();
-	UINT diamondVertexOffset = cylinderVertexOffset + (UINT)cylinder.Vertices.size();
-	UINT wedgeVertexOffset = diamondVertexOffset + (UINT)diamond.Vertices.size();
-	UINT octahedronVertexOffset = wedgeVertexOffset + (UINT)wedge.Vertices.size();
-	UINT triPrismVertexOffset = octahedronVertexOffset + (UINT)octahedron.Vertices.size();
-	UINT hexagonVertexOffset = triPrismVertexOffset + (UINT)triangularPrism.Vertices.size();
-	UINT octagonVertexOffset = hexagonVertexOffset + (UINT)hexagon.Vertices.size();
-	UINT coneVertexOffset = octagonVertexOffset + (UINT)octagon.Vertices.size();
-	UINT pyramidVertexOffset = coneVertexOffset + (UINT)cone.Vertices.size();
-	UINT containerVertexOffset = pyramidVertexOffset + (UINT)pyramid.Vertices.size();
-	UINT starVertexOffset = containerVertexOffset + (UINT)container.Vertices.size();
-
-	// Cache the starting index for each object in the concatenated index buffer.
-	UINT boxIndexOffset = 0;
-	UINT gridIndexOffset = (UINT)box.Indices32.size();
-	UINT sphereIndexOffset = gridIndexOffset + (UINT)grid.Indices32.size();
-	UINT cylinderIndexOffset = sphereIndexOffset + (UINT)sphere.Indices32.size();
-	UINT diamondIndexOffset = cylinderIndexOffset + (UINT)cylinder.Indices32.size();
-	UINT wedgeIndexOffset = diamondIndexOffset + (UINT)diamond.Indices32.size();
-	UINT octahedronIndexOffset = wedgeIndexOffset + (UINT)wedge.Indices32.size();
-	UINT triPrismIndexOffset = octahedronIndexOffset + (UINT)octahedron.Indices32.size();
-	UINT hexagonIndexOffset = triPrismIndexOffset + (UINT)triangularPrism.Indices32.size();
-	UINT octagonIndexOffset = hexagonIndexOffset + (UINT)hexagon.Indices32.size();
-	UINT coneIndexOffset = octagonIndexOffset + (UINT)octagon.Indices32.size();
-	UINT pyramidIndexOffset = coneIndexOffset + (UINT)cone.Indices32.size();
-	UINT containerIndexOffset = pyramidIndexOffset + (UINT)pyramid.Indices32.size();
-	UINT starIndexOffset = containerIndexOffset + (UINT)container.Indices32.size();
-
-
-	SubmeshGeometry boxSubmesh;
-	boxSubmesh.IndexCount = (UINT)box.Indices32.size();
-	boxSubmesh.StartIndexLocation = boxIndexOffset;
-	boxSubmesh.BaseVertexLocation = boxVertexOffset;
-
-	SubmeshGeometry gridSubmesh;
-	gridSubmesh.IndexCount = (UINT)grid.Indices32.size();
-	gridSubmesh.StartIndexLocation = gridIndexOffset;
-	gridSubmesh.BaseVertexLocation = gridVertexOffset;
-
-	SubmeshGeometry sphereSubmesh;
-	sphereSubmesh.IndexCount = (UINT)sphere.Indices32.size();
-	sphereSubmesh.StartIndexLocation = sphereIndexOffset;
-	sphereSubmesh.BaseVertexLocation = sphereVertexOffset;
-
-	SubmeshGeometry cylinderSubmesh;
-	cylinderSubmesh.IndexCount = (UINT)cylinder.Indices32.size();
-	cylinderSubmesh.StartIndexLocation = cylinderIndexOffset;
-	cylinderSubmesh.BaseVertexLocation = cylinderVertexOffset;
-
-	SubmeshGeometry diamondSubmesh;
-	diamondSubmesh.IndexCount = (UINT)diamond.Indices32.size();
-	diamondSubmesh.StartIndexLocation = diamondIndexOffset;
-	diamondSubmesh.BaseVertexLocation = diamondVertexOffset;
-
-	SubmeshGeometry wedgeSubmesh;
-	wedgeSubmesh.IndexCount = (UINT)wedge.Indices32.size();
-	wedgeSubmesh.StartIndexLocation = wedgeIndexOffset;
-	wedgeSubmesh.BaseVertexLocation = wedgeVertexOffset;
-
-	SubmeshGeometry octahedronSubmesh;
-	octahedronSubmesh.IndexCount = (UINT)octahedron.Indices32.size();
-	octahedronSubmesh.StartIndexLocation = octahedronIndexOffset;
-	octahedronSubmesh.BaseVertexLocation = octahedronVertexOffset;
-
-	SubmeshGeometry triPrismSubmesh;
-	triPrismSubmesh.IndexCount = (UINT)triangularPrism.Indices32.size();
-	triPrismSubmesh.StartIndexLocation = triPrismIndexOffset;
-	triPrismSubmesh.BaseVertexLocation = triPrismVertexOffset;
-
-	SubmeshGeometry hexagonSubmesh;
-	hexagonSubmesh.IndexCount = (UINT)hexagon.Indices32.size();
-	hexagonSubmesh.StartIndexLocation = hexagonIndexOffset;
-	hexagonSubmesh.BaseVertexLocation = hexagonVertexOffset;
-
-	SubmeshGeometry octagonSubmesh;
-	octagonSubmesh.IndexCount = (UINT)octagon.Indices32.size();
-	octagonSubmesh.StartIndexLocation = octagonIndexOffset;
-	octagonSubmesh.BaseVertexLocation = octagonVertexOffset;
-
-	SubmeshGeometry coneSubmesh;
-	coneSubmesh.IndexCount = (UINT)cone.Indices32.size();
-	coneSubmesh.StartIndexLocation = coneIndexOffset;
-	coneSubmesh.BaseVertexLocation = coneVertexOffset;
-
-	SubmeshGeometry pyramidSubmesh;
-	pyramidSubmesh.IndexCount = (UINT)pyramid.Indices32.size();
-	pyramidSubmesh.StartIndexLocation = pyramidIndexOffset;
-	pyramidSubmesh.BaseVertexLocation = pyramidVertexOffset;
-
-	SubmeshGeometry containerSubmesh;
-	containerSubmesh.IndexCount = (UINT)container.Indices32.size();
-	containerSubmesh.StartIndexLocation = containerIndexOffset;
-	containerSubmesh.BaseVertexLocation = containerVertexOffset;
-
-	SubmeshGeometry starSubmesh;
-	starSubmesh.IndexCount = (UINT)star.Indices32.size();
-	starSubmesh.StartIndexLocation = starIndexOffset;
-	starSubmesh.BaseVertexLocation = starVertexOffset;
-
-	//
-	// Extract the vertex elements we are interested in and pack the
-	// vertices of all the meshes into one vertex buffer.
-	//
-
-	auto totalVertexCount =
-		box.Vertices.size() +
-		grid.Vertices.size() +
-		sphere.Vertices.size() +
-		cylinder.Vertices.size() +
-		diamond.Vertices.size() +
-		wedge.Vertices.size() +
-		octahedron.Vertices.size() +
-		triangularPrism.Vertices.size() +
-		hexagon.Vertices.size() +
-		octagon.Vertices.size() +
-		cone.Vertices.size() +
-		pyramid.Vertices.size() +
-		container.Vertices.size() +
-		star.Vertices.size();
-
-	std::vector<Vertex> vertices(totalVertexCount);
-
-	UINT k = 0;
-	for (size_t i = 0; i < box.Vertices.size(); ++i, ++k)
-	{
-		vertices[k].Pos = box.Vertices[i].Position;
-		vertices[k].Normal = box.Vertices[i].Normal;
-		vertices[k].TexC = box.Vertices[i].TexC;
-	}
-
-	for (size_t i = 0; i < grid.Vertices.size(); ++i, ++k)
+	// Order each mesh's triangles for the post-transform vertex cache, its outward
+	// facing parts first, and its vertices in the order the triangles use them.
+	for (GeometryGenerator::MeshData* mesh : { &box, &grid, &sphere, &cylinder, &diamond, &wedge, &octahedron,
+		&triangularPrism, &hexagon, &octagon, &cone, &pyramid, &container, &star })
 	{
-		vertices[k].Pos = grid.Vertices[i].Position;
-		vertices[k].Normal = grid.Vertices[i].Normal;
-		vertices[k].TexC = grid.Vertices[i].TexC;
-	}
-
-	for (size_t i = 0; i < sphere.Vertices.size(); ++i, ++k)
-	{
-		vertices[k].Pos = sphere.Vertices[i].Position;
-		vertices[k].Normal = sphere.Vertices[i].Normal;
-		vertices[k].TexC = sphere.Vertices[i].TexC;
-	}
-
-	for (size_t i = 0; i < cylinder.Vertices.size(); ++i, ++k)
-	{
-		vertices[k].Pos = cylinder.Vertices[i].Position;
-		vertices[k].Normal = cylinder.Vertices[i].Normal;
-		vertices[k].TexC = cylinder.Vertices[i].TexC;
-	}
-
-	for (size_t i = 0; i < diamond.Vertices.size(); ++i, ++k) {
-		vertices[k].Pos = diamond.Vertices[i].Position;
-		vertices[k].Normal = diamond.Vertices[i].Normal;
-		vertices[k].TexC = diamond.Vertices[i].TexC;
-	}
-
-	for (size_t i = 0; i < wedge.Vertices.size(); ++i, ++k) {
-		vertices[k].Pos = wedge.Vertices[i].Position;
-		vertices[k].Normal = wedge.Vertices[i].Normal;
-		vertices[k].TexC = wedge.Vertices[i].TexC;
-	}
-
-	for (size_t i = 0; i < octahedron.Vertices.size(); ++i, ++k) {
-		vertices[k].Pos = octahedron.Vertices[i].Position;
-		vertices[k].Normal = octahedron.Vertices[i].Normal;
-		vertices[k].TexC = octahedron.Vertices[i].TexC;
-	}
-
-	for (size_t i = 0; i < triangularPrism.Vertices.size(); ++i, ++k) {
-		vertices[k].Pos = triangularPrism.Vertices[i].Position;
-		vertices[k].Normal = triangularPrism.Vertices[i].Normal;
-		vertices[k].TexC = triangularPrism.Vertices[i].TexC;
-	}
-
-	for (size_t i = 0; i < hexagon.Vertices.size(); ++i, ++k) {
-		vertices[k].Pos = hexagon.Vertices[i].Position;
-		vertices[k].Normal = hexagon.Vertices[i].Normal;
-		vertices[k].TexC = hexagon.Vertices[i].TexC;
-	}
-
-	for (size_t i = 0; i < octagon.Vertices.size(); ++i, ++k) {
-		vertices[k].Pos = octagon.Vertices[i].Position;
-		vertices[k].Normal = octagon.Vertices[i].Normal;
-		vertices[k].TexC = octagon.Vertices[i].TexC;
-	}
-
-	for (size_t i = 0; i < cone.Vertices.size(); ++i, ++k) {
-		vertices[k].Pos = cone.Vertices[i].Position;
-		vertices[k].Normal = cone.Vertices[i].Normal;
-		vertices[k].TexC = cone.Vertices[i].TexC;
-	}
-
-	for (size_t i = 0; i < pyramid.Vertices.size(); ++i, ++k) {
-		vertices[k].Pos = pyramid.Vertices[i].Position;
-		vertices[k].Normal = pyramid.Vertices[i].Normal;
-		vertices[k].TexC = pyramid.Vertices[i].TexC;
-	}
-
-	for (size_t i = 0; i < container.Vertices.size(); ++i, ++k) {
-		vertices[k].Pos = container.Vertices[i].Position;
-		vertices[k].Normal = container.Vertices[i].Normal;
-		vertices[k].TexC = container.Vertices[i].TexC;
-	}
-
-	for (size_t i = 0; i < star.Vertices.size(); ++i, ++k) {
-		vertices[k].Pos = star.Vertices[i].Position;
-		vertices[k].Normal = star.Vertices[i].Normal;
-		vertices[k].TexC = star.Vertices[i].TexC;
+		OptimizeMesh(*mesh);
 	}
 
+	//
+	// We are concatenating all the geometry into one big vertex/index buffer; the
+	// packer works out the region of the buffers each submesh covers.
+	//
 
-	std::vector<std::uint16_t> indices;
-	indices.insert(indices.end(), std::begin(box.GetIndices16()), std::end(box.GetIndices16()));
-	indices.insert(indices.end(), std::begin(grid.GetIndices16()), std::end(grid.GetIndices16()));
-	indices.insert(indices.end(), std::begin(sphere.GetIndices16()), std::end(sphere.GetIndices16()));
-	indices.insert(indices.end(), std::begin(cylinder.GetIndices16()), std::end(cylinder.GetIndices16()));
-	indices.insert(indices.end(), std::begin(diamond.GetIndices16()), std::end(diamond.GetIndices16()));
-	indices.insert(indices.end(), std::begin(wedge.GetIndices16()), std::end(wedge.GetIndices16()));
-	indices.insert(indices.end(), std::begin(octahedron.GetIndices16()), std::end(octahedron.GetIndices16()));
-	indices.insert(indices.end(), std::begin(triangularPrism.GetIndices16()), std::end(triangularPrism.GetIndices16()));
-	indices.insert(indices.end(), std::begin(hexagon.GetIndices16()), std::end(hexagon.GetIndices16()));
-	indices.insert(indices.end(), std::begin(octagon.GetIndices16()), std::end(octagon.GetIndices16()));
-	indices.insert(indices.end(), std::begin(cone.GetIndices16()), std::end(cone.GetIndices16()));
-	indices.insert(indices.end(), std::begin(pyramid.GetIndices16()), std::end(pyramid.GetIndices16()));
-	indices.insert(indices.end(), std::begin(container.GetIndices16()), std::end(container.GetIndices16()));
-	indices.insert(indices.end(), std::begin(star.GetIndices16()), std::end(star.GetIndices16()));
-
-	const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
-	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
+	MeshPacker packer;
+	packer.Add("box", box);
+	packer.Add("grid", grid);
+	packer.Add("sphere", sphere);
+	packer.Add("cylinder", cylinder);
+	packer.Add("diamond", diamond);
+	packer.Add("wedge", wedge);
+	packer.Add("octahedron", octahedron);
+	packer.Add("triangularPrism", triangularPrism);
+	packer.Add("hexagon", hexagon);
+	packer.Add("octagon", octagon);
+	packer.Add("cone", cone);
+	packer.Add("pyramid", pyramid);
+	packer.Add("container", container);
+	packer.Add("star", star);
+	packer.Pack();
+
+	const UINT vbByteSize = packer.VertexByteSize();
+	const UINT ibByteSize = packer.IndexByteSize();
 
 	auto geo = std::make_unique<MeshGeometry>();
 	geo->Name = "shapeGeo";
 
 	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
+	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), packer.Vertices().data(), vbByteSize);
 
 	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
+	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), packer.IndexData(), ibByteSize);
 
 	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
+		mCommandList.Get(), packer.Vertices().data(), vbByteSize, geo->VertexBufferUploader);
 
 	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
+		mCommandList.Get(), packer.IndexData(), ibByteSize, geo->IndexBufferUploader);
 
 	geo->VertexByteStride = sizeof(Vertex);
 	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
+	geo->IndexFormat = packer.Uses32BitIndices() ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_R16_UINT;
 	geo->IndexBufferByteSize = ibByteSize;
 
-	geo->DrawArgs["box"] = boxSubmesh;
-	geo->DrawArgs["grid"] = gridSubmesh;
-	geo->DrawArgs["sphere"] = sphereSubmesh;
-	geo->DrawArgs["cylinder"] = cylinderSubmesh;
-	geo->DrawArgs["diamond"] = diamondSubmesh;
-	geo->DrawArgs["wedge"] = wedgeSubmesh;
-	geo->DrawArgs["octahedron"] = octahedronSubmesh;
-	geo->DrawArgs["triangularPrism"] = triPrismSubmesh;
-	geo->DrawArgs["hexagon"] = hexagonSubmesh;
-	geo->DrawArgs["octagon"] = octagonSubmesh;
-	geo->DrawArgs["cone"] = coneSubmesh;
-	geo->DrawArgs["pyramid"] = pyramidSubmesh;
-	geo->DrawArgs["container"] = containerSubmesh;
-	geo->DrawArgs["star"] = starSubmesh;
+	for (const MeshPacker::PackedMesh& mesh : packer.Meshes())
+	{
+		SubmeshGeometry submesh;
+		submesh.IndexCount = mesh.IndexCount;
+		submesh.StartIndexLocation = mesh.StartIndexLocation;
+		submesh.BaseVertexLocation = mesh.BaseVertexLocation;
+		submesh.Bounds = BoundingBox(mesh.BoundsCenter, mesh.BoundsExtents);
+		geo->DrawArgs[mesh.Name] = submesh;
+	}
 
 	mGeometries[geo->Name] = std::move(geo);
 }
@@ -1165,15 +1205,63 @@ void i4CastleApp::BuildPSOs()
 	};
 	alphaTestedPsoDesc.RasterizerState.CullMode = D3D12_CULL_MODE_NONE;
 	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&alphaTestedPsoDesc, IID_PPV_ARGS(&mPSOs["alphaTested"])));
+
+	//
+	// The opaque and alpha tested ones again, for the instanced draws.
+	//
+
+	D3D12_SHADER_BYTECODE instancedVS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["instancedVS"]->GetBufferPointer()),
+		mShaders["instancedVS"]->GetBufferSize()
+	};
+	opaquePsoDesc.VS = instancedVS;
+	alphaTestedPsoDesc.VS = instancedVS;
+	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&opaquePsoDesc, IID_PPV_ARGS(&mPSOs["opaqueInstanced"])));
+	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&alphaTestedPsoDesc, IID_PPV_ARGS(&mPSOs["alphaTestedInstanced"])));
+
+	//
+	// PSO for the water, which is transparent and reads two vertex streams.
+	//
+
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC wavesPsoDesc = transparentPsoDesc;
+	wavesPsoDesc.InputLayout = { mWavesInputLayout.data(), (UINT)mWavesInputLayout.size() };
+	wavesPsoDesc.VS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["wavesVS"]->GetBufferPointer()),
+		mShaders["wavesVS"]->GetBufferSize()
+	};
+	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&wavesPsoDesc, IID_PPV_ARGS(&mPSOs["waves"])));
+
+	//
+	// PSO for the flat rings around the simulated water.
+	//
+
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC waterRingsPsoDesc = wavesPsoDesc;
+	waterRingsPsoDesc.InputLayout = { mWaterRingsInputLayout.data(), (UINT)mWaterRingsInputLayout.size() };
+	waterRingsPsoDesc.VS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["waterRingsVS"]->GetBufferPointer()),
+		mShaders["waterRingsVS"]->GetBufferSize()
+	};
+	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&waterRingsPsoDesc, IID_PPV_ARGS(&mPSOs["waterRings"])));
 }
 
 void i4CastleApp::BuildFrameResources()
 {
+	mRenderDevice = std::make_unique<D3D12RenderDevice>(md3dDevice.Get(), mCommandQueue.Get(), mFence.Get());
+
     for(int i = 0; i < gNumFrameResources; ++i)
     {
-        mFrameResources.push_back(std::make_unique<FrameResource>(md3dDevice.Get(),
-            1, (UINT)mAllRitems.size(), (UINT)mMaterials.size(), mWaves->VertexCount()));
+        mFrameResources.push_back(std::make_unique<FrameResource>(*mRenderDevice,
+            mWater->VertexCount(), mWater->BodyCount()));
     }
+
+	// A frame currently takes about 20 KB of constants (256 bytes per object and
+	// material, plus the pass); 1 MB leaves room for all frames in flight and for
+	// thousands more objects.
+	mUploadRing = std::make_unique<UploadRing>(*mRenderDevice, 1 << 20);
+	mFrameUpdater = std::make_unique<FrameUpdater>(*mUploadRing);
 }
 
 void i4CastleApp::BuildMaterials()
@@ -1236,542 +1324,177 @@ void i4CastleApp::BuildMaterials()
 }
 
 
+// The layer a scene object named layer is drawn in.
+static RenderLayer SceneLayer(const std::string& layer)
+{
+	if (layer == "opaque")
+		return RenderLayer::Opaque;
+	if (layer == "alphaTested")
+		return RenderLayer::AlphaTested;
+	if (layer == "transparent")
+		return RenderLayer::Transparent;
+	throw std::runtime_error("the scene uses an unknown layer: " + layer);
+}
+
 void i4CastleApp::BuildRenderItems()
 {
-	auto FountainBaseCylinderRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&FountainBaseCylinderRitem->World, XMMatrixScaling(4.3f, .3f, 4.3f)*XMMatrixTranslation(0.f, 0.3f, -8.f));
-	XMStoreFloat4x4(&FountainBaseCylinderRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	FountainBaseCylinderRitem->ObjCBIndex = 0;
-	FountainBaseCylinderRitem->Mat = mMaterials["stone0"].get();
-	FountainBaseCylinderRitem->Geo = mGeometries["shapeGeo"].get();
-	FountainBaseCylinderRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	FountainBaseCylinderRitem->IndexCount = FountainBaseCylinderRitem->Geo->DrawArgs["cylinder"].IndexCount;
-	FountainBaseCylinderRitem->StartIndexLocation = FountainBaseCylinderRitem->Geo->DrawArgs["cylinder"].StartIndexLocation;
-	FountainBaseCylinderRitem->BaseVertexLocation = FountainBaseCylinderRitem->Geo->DrawArgs["cylinder"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(FountainBaseCylinderRitem));
-
-	auto containerRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&containerRitem->World, XMMatrixScaling(1.3f, 1.f, 1.3f)*XMMatrixTranslation(0.f, 1.3f, -8.f));
-	XMStoreFloat4x4(&containerRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	containerRitem->ObjCBIndex = 1;
-	containerRitem->Mat = mMaterials["bricks0"].get();
-	containerRitem->Geo = mGeometries["shapeGeo"].get();
-	containerRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	containerRitem->IndexCount = containerRitem->Geo->DrawArgs["container"].IndexCount;
-	containerRitem->StartIndexLocation = containerRitem->Geo->DrawArgs["container"].StartIndexLocation;
-	containerRitem->BaseVertexLocation = containerRitem->Geo->DrawArgs["container"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(containerRitem));
-
-	auto pyramidRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&pyramidRitem->World, XMMatrixScaling(1.f, 1.5f, 1.f)*XMMatrixTranslation(-3.5f, .5f, -8.f));
-	XMStoreFloat4x4(&pyramidRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	pyramidRitem->ObjCBIndex = 2;
-	pyramidRitem->Mat = mMaterials["stone0"].get();
-	pyramidRitem->Geo = mGeometries["shapeGeo"].get();
-	pyramidRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	pyramidRitem->IndexCount = pyramidRitem->Geo->DrawArgs["pyramid"].IndexCount;
-	pyramidRitem->StartIndexLocation = pyramidRitem->Geo->DrawArgs["pyramid"].StartIndexLocation;
-	pyramidRitem->BaseVertexLocation = pyramidRitem->Geo->DrawArgs["pyramid"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(pyramidRitem));
-
-	auto pyramidRitem2 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&pyramidRitem2->World, XMMatrixScaling(1.f, 1.5f, 1.f)*XMMatrixTranslation(3.5f, .5f, -8.f));
-	XMStoreFloat4x4(&pyramidRitem2->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	pyramidRitem2->ObjCBIndex = 3;
-	pyramidRitem2->Mat = mMaterials["stone0"].get();
-	pyramidRitem2->Geo = mGeometries["shapeGeo"].get();
-	pyramidRitem2->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	pyramidRitem2->IndexCount = pyramidRitem2->Geo->DrawArgs["pyramid"].IndexCount;
-	pyramidRitem2->StartIndexLocation = pyramidRitem2->Geo->DrawArgs["pyramid"].StartIndexLocation;
-	pyramidRitem2->BaseVertexLocation = pyramidRitem2->Geo->DrawArgs["pyramid"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(pyramidRitem2));
-
-	auto coneRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&coneRitem->World, XMMatrixScaling(3.f, 2.f, 3.f)*XMMatrixTranslation(0.0f, 7.5f, 6.0f));
-	XMStoreFloat4x4(&coneRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	coneRitem->ObjCBIndex = 4;
-	coneRitem->Mat = mMaterials["bricks0"].get();
-	coneRitem->Geo = mGeometries["shapeGeo"].get();
-	coneRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	coneRitem->IndexCount = coneRitem->Geo->DrawArgs["cone"].IndexCount;
-	coneRitem->StartIndexLocation = coneRitem->Geo->DrawArgs["cone"].StartIndexLocation;
-	coneRitem->BaseVertexLocation = coneRitem->Geo->DrawArgs["cone"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(coneRitem));
-
-	auto cylinderRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&cylinderRitem->World, XMMatrixScaling(5.f, 1.f, 5.f)*XMMatrixTranslation(0.0f, 5.f, 6.0f));
-	XMStoreFloat4x4(&cylinderRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	cylinderRitem->ObjCBIndex = 5;
-	cylinderRitem->Mat = mMaterials["stone0"].get();
-	cylinderRitem->Geo = mGeometries["shapeGeo"].get();
-	cylinderRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	cylinderRitem->IndexCount = cylinderRitem->Geo->DrawArgs["cylinder"].IndexCount;
-	cylinderRitem->StartIndexLocation = cylinderRitem->Geo->DrawArgs["cylinder"].StartIndexLocation;
-	cylinderRitem->BaseVertexLocation = cylinderRitem->Geo->DrawArgs["cylinder"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(cylinderRitem));
-
-	auto HexagonRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&HexagonRitem->World, XMMatrixScaling(4.5f, 2.0f, 4.5f)*XMMatrixTranslation(0.0f, 2.0f, 6.0f));
-	XMStoreFloat4x4(&HexagonRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	HexagonRitem->ObjCBIndex = 6;
-	HexagonRitem->Mat = mMaterials["stone0"].get();
-	HexagonRitem->Geo = mGeometries["shapeGeo"].get();
-	HexagonRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	HexagonRitem->IndexCount = HexagonRitem->Geo->DrawArgs["hexagon"].IndexCount;
-	HexagonRitem->StartIndexLocation = HexagonRitem->Geo->DrawArgs["hexagon"].StartIndexLocation;
-	HexagonRitem->BaseVertexLocation = HexagonRitem->Geo->DrawArgs["hexagon"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(HexagonRitem));
-
-	auto triPrismRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&triPrismRitem->World, XMMatrixScaling(1.5f, 1.5f, 2.5f)*XMMatrixTranslation(0.0f, 0.5f, -2.5f));
-	XMStoreFloat4x4(&triPrismRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	triPrismRitem->ObjCBIndex = 7;
-	triPrismRitem->Mat = mMaterials["bricks0"].get();
-	triPrismRitem->Geo = mGeometries["shapeGeo"].get();
-	triPrismRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	triPrismRitem->IndexCount = triPrismRitem->Geo->DrawArgs["triangularPrism"].IndexCount;
-	triPrismRitem->StartIndexLocation = triPrismRitem->Geo->DrawArgs["triangularPrism"].StartIndexLocation;
-	triPrismRitem->BaseVertexLocation = triPrismRitem->Geo->DrawArgs["triangularPrism"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(triPrismRitem));
-
-	auto leftDoorRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&leftDoorRitem->World, XMMatrixScaling(.5f, 2.0f, .7f)*XMMatrixRotationX(XMConvertToRadians(-90))*XMMatrixRotationY(XMConvertToRadians(-30))*XMMatrixTranslation(-1.7f, 0.25f, -12.0f));
-	XMStoreFloat4x4(&leftDoorRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	leftDoorRitem->ObjCBIndex = 8;
-	leftDoorRitem->Mat = mMaterials["bricks0"].get();
-	leftDoorRitem->Geo = mGeometries["shapeGeo"].get();
-	leftDoorRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	leftDoorRitem->IndexCount = leftDoorRitem->Geo->DrawArgs["triangularPrism"].IndexCount;
-	leftDoorRitem->StartIndexLocation = leftDoorRitem->Geo->DrawArgs["triangularPrism"].StartIndexLocation;
-	leftDoorRitem->BaseVertexLocation = leftDoorRitem->Geo->DrawArgs["triangularPrism"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(leftDoorRitem));
-
-	auto rightDoorRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&rightDoorRitem->World, XMMatrixScaling(.5f, 2.0f, .7f)*XMMatrixRotationX(XMConvertToRadians(-90))*XMMatrixRotationY(XMConvertToRadians(60))*XMMatrixTranslation(1.5f, 0.25f, -12.0f));
-	XMStoreFloat4x4(&rightDoorRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	rightDoorRitem->ObjCBIndex = 9;
-	rightDoorRitem->Mat = mMaterials["bricks0"].get();
-	rightDoorRitem->Geo = mGeometries["shapeGeo"].get();
-	rightDoorRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	rightDoorRitem->IndexCount = rightDoorRitem->Geo->DrawArgs["triangularPrism"].IndexCount;
-	rightDoorRitem->StartIndexLocation = rightDoorRitem->Geo->DrawArgs["triangularPrism"].StartIndexLocation;
-	rightDoorRitem->BaseVertexLocation = rightDoorRitem->Geo->DrawArgs["triangularPrism"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(rightDoorRitem));
-
-	auto diamondRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&diamondRitem->World, XMMatrixScaling(.7f, .5f, .7f)*XMMatrixTranslation(0.0f, 2.f, -8.0f));
-	XMStoreFloat4x4(&diamondRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	diamondRitem->ObjCBIndex = 10;
-	diamondRitem->Mat = mMaterials["stone0"].get();
-	diamondRitem->Geo = mGeometries["shapeGeo"].get();
-	diamondRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	diamondRitem->IndexCount = diamondRitem->Geo->DrawArgs["diamond"].IndexCount;
-	diamondRitem->StartIndexLocation = diamondRitem->Geo->DrawArgs["diamond"].StartIndexLocation;
-	diamondRitem->BaseVertexLocation = diamondRitem->Geo->DrawArgs["diamond"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(diamondRitem));
-
-	auto boxRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&boxRitem->World, XMMatrixScaling(4.5f, 2.0f, 4.5f)*XMMatrixTranslation(0.0f, 0.5f, 6.0f));
-	XMStoreFloat4x4(&boxRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	boxRitem->ObjCBIndex = 11;
-	boxRitem->Mat = mMaterials["crate0"].get();
-	boxRitem->Geo = mGeometries["shapeGeo"].get();
-	boxRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	boxRitem->IndexCount = boxRitem->Geo->DrawArgs["box"].IndexCount;
-	boxRitem->StartIndexLocation = boxRitem->Geo->DrawArgs["box"].StartIndexLocation;
-	boxRitem->BaseVertexLocation = boxRitem->Geo->DrawArgs["box"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(boxRitem));
-
-	auto gridRitem = std::make_unique<RenderItem>();
-	gridRitem->World = MathHelper::Identity4x4();
-	XMStoreFloat4x4(&gridRitem->TexTransform, XMMatrixScaling(8.0f, 8.0f, 1.0f));
-	gridRitem->ObjCBIndex = 12;
-	gridRitem->Mat = mMaterials["tile0"].get();
-	gridRitem->Geo = mGeometries["shapeGeo"].get();
-	gridRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	gridRitem->IndexCount = gridRitem->Geo->DrawArgs["grid"].IndexCount;
-	gridRitem->StartIndexLocation = gridRitem->Geo->DrawArgs["grid"].StartIndexLocation;
-	gridRitem->BaseVertexLocation = gridRitem->Geo->DrawArgs["grid"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(gridRitem));
-
-	auto WedgeRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&WedgeRitem->World, XMMatrixScaling(.3f, .4f, 2.5f)*XMMatrixRotationY(XMConvertToRadians(-90))*XMMatrixTranslation(0.0f, .35f, 2.5f));
-	XMStoreFloat4x4(&WedgeRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	WedgeRitem->ObjCBIndex = 13;
-	WedgeRitem->Mat = mMaterials["bricks0"].get();
-	WedgeRitem->Geo = mGeometries["shapeGeo"].get();
-	WedgeRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	WedgeRitem->IndexCount = WedgeRitem->Geo->DrawArgs["wedge"].IndexCount;
-	WedgeRitem->StartIndexLocation = WedgeRitem->Geo->DrawArgs["wedge"].StartIndexLocation;
-	WedgeRitem->BaseVertexLocation = WedgeRitem->Geo->DrawArgs["wedge"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(WedgeRitem));
-
-	auto octahedronRitem1 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&octahedronRitem1->World, XMMatrixScaling(1.f, 1.f, 1.f)* XMMatrixTranslation(3.5f, 2.f, -8.f));
-	octahedronRitem1->TexTransform = MathHelper::Identity4x4();
-	octahedronRitem1->ObjCBIndex = 14;
-	octahedronRitem1->Mat = mMaterials["tile0"].get();
-	octahedronRitem1->Geo = mGeometries["shapeGeo"].get();
-	octahedronRitem1->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	octahedronRitem1->IndexCount = octahedronRitem1->Geo->DrawArgs["octahedron"].IndexCount;
-	octahedronRitem1->StartIndexLocation = octahedronRitem1->Geo->DrawArgs["octahedron"].StartIndexLocation;
-	octahedronRitem1->BaseVertexLocation = octahedronRitem1->Geo->DrawArgs["octahedron"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(octahedronRitem1));
-
-	auto octahedronRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&octahedronRitem->World, XMMatrixScaling(1.f, 1.f, 1.f)* XMMatrixTranslation(-3.5f, 2.f, -8.f));
-	octahedronRitem->TexTransform = MathHelper::Identity4x4();
-	octahedronRitem->ObjCBIndex = 15;
-	octahedronRitem->Mat = mMaterials["tile0"].get();
-	octahedronRitem->Geo = mGeometries["shapeGeo"].get();
-	octahedronRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	octahedronRitem->IndexCount = octahedronRitem->Geo->DrawArgs["octahedron"].IndexCount;
-	octahedronRitem->StartIndexLocation = octahedronRitem->Geo->DrawArgs["octahedron"].StartIndexLocation;
-	octahedronRitem->BaseVertexLocation = octahedronRitem->Geo->DrawArgs["octahedron"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(octahedronRitem));
-
-	XMMATRIX brickTexTransform = XMMatrixScaling(1.0f, 3.0f, 1.0f);
-	XMMATRIX sphereTransform = XMMatrixScaling(1.4f, 1.4f, 1.4f);
-	UINT objCBIndex = 16;
-	for (int i = 0; i < 2; ++i)
+	// The castle comes from the compiled scene (see Scene/Castle.scene.txt, built by
+	// SceneCompiler).  Its objects are drawn from shapeGeo, and numbered in the order
+	// the scene lists them.  Every item is culled by the bounds of the submesh it
+	// draws.
+	SceneFile scene("Scene\\Castle.scene");
+	MeshGeometry* shapeGeo = mGeometries["shapeGeo"].get();
+	UINT objCBIndex = 0;
+	for (int i = 0; i < scene.ObjectCount(); ++i)
 	{
-		auto leftCylRitem = std::make_unique<RenderItem>();
-		auto rightCylRitem = std::make_unique<RenderItem>();
-		auto leftSphereRitem = std::make_unique<RenderItem>();
-		auto rightSphereRitem = std::make_unique<RenderItem>();
-
-		XMMATRIX leftCylWorld = XMMatrixTranslation(-3.0f, 2.f, 1.5f + i * 8.9f);
-		XMMATRIX rightCylWorld = XMMatrixTranslation(+3.0f, 2.f, 1.5f + i * 8.9f);
-
-		XMMATRIX leftSphereWorld = XMMatrixTranslation(-3.0f, 5.f, 1.5f + i * 8.9f);
-		XMMATRIX rightSphereWorld = XMMatrixTranslation(+3.0f, 5.f, 1.5f + i * 8.9f);
-
-		XMStoreFloat4x4(&leftCylRitem->World, brickTexTransform * rightCylWorld);
-		XMStoreFloat4x4(&leftCylRitem->TexTransform, brickTexTransform);
-		leftCylRitem->ObjCBIndex = objCBIndex++;
-		leftCylRitem->Mat = mMaterials["tile0"].get();
-		leftCylRitem->Geo = mGeometries["shapeGeo"].get();
-		leftCylRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		leftCylRitem->IndexCount = leftCylRitem->Geo->DrawArgs["octagon"].IndexCount;
-		leftCylRitem->StartIndexLocation = leftCylRitem->Geo->DrawArgs["octagon"].StartIndexLocation;
-		leftCylRitem->BaseVertexLocation = leftCylRitem->Geo->DrawArgs["octagon"].BaseVertexLocation;
-
-		XMStoreFloat4x4(&rightCylRitem->World, brickTexTransform * leftCylWorld);
-		XMStoreFloat4x4(&rightCylRitem->TexTransform, brickTexTransform);
-		rightCylRitem->ObjCBIndex = objCBIndex++;
-		rightCylRitem->Mat = mMaterials["tile0"].get();
-		rightCylRitem->Geo = mGeometries["shapeGeo"].get();
-		rightCylRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		rightCylRitem->IndexCount = rightCylRitem->Geo->DrawArgs["octagon"].IndexCount;
-		rightCylRitem->StartIndexLocation = rightCylRitem->Geo->DrawArgs["octagon"].StartIndexLocation;
-		rightCylRitem->BaseVertexLocation = rightCylRitem->Geo->DrawArgs["octagon"].BaseVertexLocation;
-
-		XMStoreFloat4x4(&leftSphereRitem->World, sphereTransform*leftSphereWorld);
-		leftSphereRitem->ObjCBIndex = objCBIndex++;
-		leftSphereRitem->Mat = mMaterials["stone0"].get();
-		leftSphereRitem->Geo = mGeometries["shapeGeo"].get();
-		leftSphereRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		leftSphereRitem->IndexCount = leftSphereRitem->Geo->DrawArgs["sphere"].IndexCount;
-		leftSphereRitem->StartIndexLocation = leftSphereRitem->Geo->DrawArgs["sphere"].StartIndexLocation;
-		leftSphereRitem->BaseVertexLocation = leftSphereRitem->Geo->DrawArgs["sphere"].BaseVertexLocation;
-
-		XMStoreFloat4x4(&rightSphereRitem->World, sphereTransform*rightSphereWorld);
-		rightSphereRitem->TexTransform = MathHelper::Identity4x4();
-		rightSphereRitem->ObjCBIndex = objCBIndex++;
-		rightSphereRitem->Mat = mMaterials["stone0"].get();
-		rightSphereRitem->Geo = mGeometries["shapeGeo"].get();
-		rightSphereRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		rightSphereRitem->IndexCount = rightSphereRitem->Geo->DrawArgs["sphere"].IndexCount;
-		rightSphereRitem->StartIndexLocation = rightSphereRitem->Geo->DrawArgs["sphere"].StartIndexLocation;
-		rightSphereRitem->BaseVertexLocation = rightSphereRitem->Geo->DrawArgs["sphere"].BaseVertexLocation;
-
-		mAllRitems.push_back(std::move(leftCylRitem));
-		mAllRitems.push_back(std::move(rightCylRitem));
-		mAllRitems.push_back(std::move(leftSphereRitem));
-		mAllRitems.push_back(std::move(rightSphereRitem));
+		const SceneFileObject& object = scene.Objects()[i];
+		auto mesh = shapeGeo->DrawArgs.find(scene.MeshName(object.Mesh));
+		auto mat = mMaterials.find(scene.MaterialName(object.Material));
+		if (mesh == shapeGeo->DrawArgs.end() || mat == mMaterials.end())
+			throw std::runtime_error(std::string("the scene uses an unknown mesh or material: ") +
+				scene.MeshName(object.Mesh) + ", " + scene.MaterialName(object.Material));
+
+		auto ritem = std::make_unique<RenderItem>();
+		ritem->World = object.World;
+		ritem->TexTransform = object.TexTransform;
+		ritem->ObjCBIndex = objCBIndex++;
+		ritem->Mat = mat->second.get();
+		ritem->Geo = shapeGeo;
+		ritem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+		ritem->IndexCount = mesh->second.IndexCount;
+		ritem->StartIndexLocation = mesh->second.StartIndexLocation;
+		ritem->BaseVertexLocation = mesh->second.BaseVertexLocation;
+		ritem->Bounds = mesh->second.Bounds;
+		ritem->CullIndex = mCuller.Add(ritem->Bounds.Center, ritem->Bounds.Extents);
+
+		mRitemLayer[(int)SceneLayer(scene.LayerName(object.Layer))].push_back(ritem.get());
+		mAllRitems.push_back(std::move(ritem));
 	}
 
-	XMMATRIX hexTransform = XMMatrixScaling(.5f, 1.2f, .5f);
-	XMMATRIX coneTransform = XMMatrixScaling(.7f, .7f, .7f);
-	objCBIndex = 24;
-	for (int i = 0; i < 2; ++i)
+	// One render item per water body, at its position; UpdateWaves adds the
+	// body's origin.  The water texture coordinates are the world x and -z, so the
+	// texture stays put when the water moves.  Ten repeats every 128 m.
+	std::vector<std::unique_ptr<RenderItem>> waterBodyRitems;
+	for (int b = 0; b < mWater->BodyCount(); ++b)
 	{
-		auto leftHexRitem = std::make_unique<RenderItem>();
-		auto righHexRitem = std::make_unique<RenderItem>();
-		auto leftSphereRitem = std::make_unique<RenderItem>();
-		auto rightSphereRitem = std::make_unique<RenderItem>();
-
-		XMMATRIX leftHexWorld = XMMatrixTranslation(-7.0f, .6f, .5f + i * 12.f);
-		XMMATRIX rightHexWorld = XMMatrixTranslation(+7.0f, .6f, .5f + i * 12.f);
-
-		XMMATRIX leftSphereWorld = XMMatrixTranslation(-7.0f, 1.6f, .5f + i * 12.f);
-		XMMATRIX rightSphereWorld = XMMatrixTranslation(+7.0f, 1.6f, .5f + i * 12.f);
-
-		XMStoreFloat4x4(&leftHexRitem->World, hexTransform*leftHexWorld);
-		XMStoreFloat4x4(&leftHexRitem->TexTransform, brickTexTransform);
-		leftHexRitem->ObjCBIndex = objCBIndex++;
-		leftHexRitem->Mat = mMaterials["stone0"].get();
-		leftHexRitem->Geo = mGeometries["shapeGeo"].get();
-		leftHexRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		leftHexRitem->IndexCount = leftHexRitem->Geo->DrawArgs["hexagon"].IndexCount;
-		leftHexRitem->StartIndexLocation = leftHexRitem->Geo->DrawArgs["hexagon"].StartIndexLocation;
-		leftHexRitem->BaseVertexLocation = leftHexRitem->Geo->DrawArgs["hexagon"].BaseVertexLocation;
-
-		XMStoreFloat4x4(&righHexRitem->World, hexTransform*rightHexWorld);
-		XMStoreFloat4x4(&righHexRitem->TexTransform, brickTexTransform);
-		righHexRitem->ObjCBIndex = objCBIndex++;
-		righHexRitem->Mat = mMaterials["stone0"].get();
-		righHexRitem->Geo = mGeometries["shapeGeo"].get();
-		righHexRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		righHexRitem->IndexCount = righHexRitem->Geo->DrawArgs["hexagon"].IndexCount;
-		righHexRitem->StartIndexLocation = righHexRitem->Geo->DrawArgs["hexagon"].StartIndexLocation;
-		righHexRitem->BaseVertexLocation = righHexRitem->Geo->DrawArgs["hexagon"].BaseVertexLocation;
-
-		XMStoreFloat4x4(&leftSphereRitem->World, coneTransform*leftSphereWorld);
-		leftSphereRitem->ObjCBIndex = objCBIndex++;
-		leftSphereRitem->Mat = mMaterials["stone0"].get();
-		leftSphereRitem->Geo = mGeometries["shapeGeo"].get();
-		leftSphereRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		leftSphereRitem->IndexCount = leftSphereRitem->Geo->DrawArgs["cone"].IndexCount;
-		leftSphereRitem->StartIndexLocation = leftSphereRitem->Geo->DrawArgs["cone"].StartIndexLocation;
-		leftSphereRitem->BaseVertexLocation = leftSphereRitem->Geo->DrawArgs["cone"].BaseVertexLocation;
-
-		XMStoreFloat4x4(&rightSphereRitem->World, coneTransform*rightSphereWorld);
-		rightSphereRitem->TexTransform = MathHelper::Identity4x4();
-		rightSphereRitem->ObjCBIndex = objCBIndex++;
-		rightSphereRitem->Mat = mMaterials["stone0"].get();
-		rightSphereRitem->Geo = mGeometries["shapeGeo"].get();
-		rightSphereRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		rightSphereRitem->IndexCount = rightSphereRitem->Geo->DrawArgs["cone"].IndexCount;
-		rightSphereRitem->StartIndexLocation = rightSphereRitem->Geo->DrawArgs["cone"].StartIndexLocation;
-		rightSphereRitem->BaseVertexLocation = rightSphereRitem->Geo->DrawArgs["cone"].BaseVertexLocation;
-
-		mAllRitems.push_back(std::move(leftHexRitem));
-		mAllRitems.push_back(std::move(righHexRitem));
-		mAllRitems.push_back(std::move(leftSphereRitem));
-		mAllRitems.push_back(std::move(rightSphereRitem));
-	}
-
-	auto leftMainWedgeRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&leftMainWedgeRitem->World, XMMatrixScaling(.3f, .4f, 4.f)*XMMatrixTranslation(-3.65f, .35f, 6.f));
-	XMStoreFloat4x4(&leftMainWedgeRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	leftMainWedgeRitem->ObjCBIndex = 32;
-	leftMainWedgeRitem->Mat = mMaterials["bricks0"].get();
-	leftMainWedgeRitem->Geo = mGeometries["shapeGeo"].get();
-	leftMainWedgeRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	leftMainWedgeRitem->IndexCount = leftMainWedgeRitem->Geo->DrawArgs["wedge"].IndexCount;
-	leftMainWedgeRitem->StartIndexLocation = leftMainWedgeRitem->Geo->DrawArgs["wedge"].StartIndexLocation;
-	leftMainWedgeRitem->BaseVertexLocation = leftMainWedgeRitem->Geo->DrawArgs["wedge"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(leftMainWedgeRitem));
-
-	auto rightMainWedgeRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&rightMainWedgeRitem->World, XMMatrixScaling(.3f, .4f, 4.f)*XMMatrixRotationY(XMConvertToRadians(180))*XMMatrixTranslation(3.65f, .35f, 6.f));
-	XMStoreFloat4x4(&rightMainWedgeRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	rightMainWedgeRitem->ObjCBIndex = 33;
-	rightMainWedgeRitem->Mat = mMaterials["bricks0"].get();
-	rightMainWedgeRitem->Geo = mGeometries["shapeGeo"].get();
-	rightMainWedgeRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	rightMainWedgeRitem->IndexCount = rightMainWedgeRitem->Geo->DrawArgs["wedge"].IndexCount;
-	rightMainWedgeRitem->StartIndexLocation = rightMainWedgeRitem->Geo->DrawArgs["wedge"].StartIndexLocation;
-	rightMainWedgeRitem->BaseVertexLocation = rightMainWedgeRitem->Geo->DrawArgs["wedge"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(rightMainWedgeRitem));
-
-	auto backMainWedgeRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&backMainWedgeRitem->World, XMMatrixScaling(.3f, .4f, 2.5f)*XMMatrixRotationY(XMConvertToRadians(90))*XMMatrixTranslation(0.0f, .35f, 9.6f));
-	XMStoreFloat4x4(&backMainWedgeRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	backMainWedgeRitem->ObjCBIndex = 34;
-	backMainWedgeRitem->Mat = mMaterials["bricks0"].get();
-	backMainWedgeRitem->Geo = mGeometries["shapeGeo"].get();
-	backMainWedgeRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	backMainWedgeRitem->IndexCount = backMainWedgeRitem->Geo->DrawArgs["wedge"].IndexCount;
-	backMainWedgeRitem->StartIndexLocation = backMainWedgeRitem->Geo->DrawArgs["wedge"].StartIndexLocation;
-	backMainWedgeRitem->BaseVertexLocation = backMainWedgeRitem->Geo->DrawArgs["wedge"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(backMainWedgeRitem));
-
-	auto stickRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&stickRitem->World, XMMatrixScaling(.2f, 1.f, .2f)*XMMatrixTranslation(0.f, 8.3f, 6.f));
-	XMStoreFloat4x4(&stickRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	stickRitem->ObjCBIndex = 35;
-	stickRitem->Mat = mMaterials["crate0"].get();
-	stickRitem->Geo = mGeometries["shapeGeo"].get();
-	stickRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	stickRitem->IndexCount = stickRitem->Geo->DrawArgs["cylinder"].IndexCount;
-	stickRitem->StartIndexLocation = stickRitem->Geo->DrawArgs["cylinder"].StartIndexLocation;
-	stickRitem->BaseVertexLocation = stickRitem->Geo->DrawArgs["cylinder"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(stickRitem));
-
-	auto starRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&starRitem->World, XMMatrixScaling(.6f, 1.f, .6f)*XMMatrixTranslation(0.f, 9.5f, 6.f));
-	XMStoreFloat4x4(&starRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	starRitem->ObjCBIndex = 36;
-	starRitem->Mat = mMaterials["stone0"].get();
-	starRitem->Geo = mGeometries["shapeGeo"].get();
-	starRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	starRitem->IndexCount = starRitem->Geo->DrawArgs["star"].IndexCount;
-	starRitem->StartIndexLocation = starRitem->Geo->DrawArgs["star"].StartIndexLocation;
-	starRitem->BaseVertexLocation = starRitem->Geo->DrawArgs["star"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(starRitem));
-
-	auto wallsInBackRitem = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallsInBackRitem->World, XMMatrixScaling(.2f, 2.6f, 8.f)*XMMatrixTranslation(-7.0f, 0.5f, 6.5f));
-	XMStoreFloat4x4(&wallsInBackRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallsInBackRitem->ObjCBIndex = 37;
-	wallsInBackRitem->Mat = mMaterials["crate0"].get();
-	wallsInBackRitem->Geo = mGeometries["shapeGeo"].get();
-	wallsInBackRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallsInBackRitem->IndexCount = wallsInBackRitem->Geo->DrawArgs["box"].IndexCount;
-	wallsInBackRitem->StartIndexLocation = wallsInBackRitem->Geo->DrawArgs["box"].StartIndexLocation;
-	wallsInBackRitem->BaseVertexLocation = wallsInBackRitem->Geo->DrawArgs["box"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(wallsInBackRitem));
-
-	auto wallsInBackRitem2 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallsInBackRitem2->World, XMMatrixScaling(.2f, 2.6f, 9.f)*XMMatrixRotationY(XMConvertToRadians(90))*XMMatrixTranslation(0.0f, 0.5f, 12.5f));
-	XMStoreFloat4x4(&wallsInBackRitem2->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallsInBackRitem2->ObjCBIndex = 38;
-	wallsInBackRitem2->Mat = mMaterials["crate0"].get();
-	wallsInBackRitem2->Geo = mGeometries["shapeGeo"].get();
-	wallsInBackRitem2->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallsInBackRitem2->IndexCount = wallsInBackRitem2->Geo->DrawArgs["box"].IndexCount;
-	wallsInBackRitem2->StartIndexLocation = wallsInBackRitem2->Geo->DrawArgs["box"].StartIndexLocation;
-	wallsInBackRitem2->BaseVertexLocation = wallsInBackRitem2->Geo->DrawArgs["box"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(wallsInBackRitem2));
-
-	auto wallsInBackRitem3 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallsInBackRitem3->World, XMMatrixScaling(.2f, 2.6f, 8.f)*XMMatrixTranslation(7.0f, 0.5f, 6.5f));
-	XMStoreFloat4x4(&wallsInBackRitem3->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallsInBackRitem3->ObjCBIndex = 39;
-	wallsInBackRitem3->Mat = mMaterials["crate0"].get();
-	wallsInBackRitem3->Geo = mGeometries["shapeGeo"].get();
-	wallsInBackRitem3->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallsInBackRitem3->IndexCount = wallsInBackRitem3->Geo->DrawArgs["box"].IndexCount;
-	wallsInBackRitem3->StartIndexLocation = wallsInBackRitem3->Geo->DrawArgs["box"].StartIndexLocation;
-	wallsInBackRitem3->BaseVertexLocation = wallsInBackRitem3->Geo->DrawArgs["box"].BaseVertexLocation;
-	mAllRitems.push_back(std::move(wallsInBackRitem3));
-
-	objCBIndex = 40;
-	for (int i = 0; i < 2; ++i) {
-		auto wallsInMidRitem = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&wallsInMidRitem->World, XMMatrixScaling(.2f, 2.6f, 3.f)*XMMatrixRotationY(XMConvertToRadians(90))*XMMatrixTranslation(-5.f + 10.f*i, 0.5f, .5f));
-		XMStoreFloat4x4(&wallsInMidRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-		wallsInMidRitem->ObjCBIndex = objCBIndex++;
-		wallsInMidRitem->Mat = mMaterials["crate0"].get();
-		wallsInMidRitem->Geo = mGeometries["shapeGeo"].get();
-		wallsInMidRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		wallsInMidRitem->IndexCount = wallsInMidRitem->Geo->DrawArgs["box"].IndexCount;
-		wallsInMidRitem->StartIndexLocation = wallsInMidRitem->Geo->DrawArgs["box"].StartIndexLocation;
-		wallsInMidRitem->BaseVertexLocation = wallsInMidRitem->Geo->DrawArgs["box"].BaseVertexLocation;
-		mAllRitems.push_back(std::move(wallsInMidRitem));
+		auto wavesRitem = std::make_unique<RenderItem>();
+		XMFLOAT3 pos = mWaterBodyPositions[b];
+		XMStoreFloat4x4(&wavesRitem->World, XMMatrixTranslation(pos.x, pos.y, pos.z));
+		XMStoreFloat4x4(&wavesRitem->TexTransform, XMMatrixScaling(10.0f / 128.0f, 10.0f / 128.0f, 1.0f));
+		wavesRitem->ObjCBIndex = objCBIndex++;
+		wavesRitem->Mat = mMaterials["water"].get();
+		wavesRitem->Geo = mGeometries["waterGeo"].get();
+		wavesRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+		const SubmeshGeometry& submesh = wavesRitem->Geo->DrawArgs["body" + std::to_string(b)];
+		wavesRitem->IndexCount = submesh.IndexCount;
+		wavesRitem->StartIndexLocation = submesh.StartIndexLocation;
+		wavesRitem->BaseVertexLocation = submesh.BaseVertexLocation;
+		wavesRitem->Bounds = submesh.Bounds;
+		wavesRitem->CullIndex = mCuller.Add(wavesRitem->Bounds.Center, wavesRitem->Bounds.Extents);
+
+		mWaterBodyRitems.push_back(wavesRitem.get());
+		waterBodyRitems.push_back(std::move(wavesRitem));
 	}
 
-	objCBIndex = 42;
-	for (int i = 0; i < 2; ++i) {
-		auto wallsInMidRitem = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&wallsInMidRitem->World, XMMatrixScaling(.2f, 2.6f, 2.f)*XMMatrixRotationY(XMConvertToRadians(90))*XMMatrixTranslation(-4.f + 8.f*i, 0.5f, -5.5f));
-		XMStoreFloat4x4(&wallsInMidRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-		wallsInMidRitem->ObjCBIndex = objCBIndex++;
-		wallsInMidRitem->Mat = mMaterials["crate0"].get();
-		wallsInMidRitem->Geo = mGeometries["shapeGeo"].get();
-		wallsInMidRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		wallsInMidRitem->IndexCount = wallsInMidRitem->Geo->DrawArgs["box"].IndexCount;
-		wallsInMidRitem->StartIndexLocation = wallsInMidRitem->Geo->DrawArgs["box"].StartIndexLocation;
-		wallsInMidRitem->BaseVertexLocation = wallsInMidRitem->Geo->DrawArgs["box"].BaseVertexLocation;
-		mAllRitems.push_back(std::move(wallsInMidRitem));
-	}
-
-	objCBIndex = 44;
-	for (int i = 0; i < 2; ++i) {
-		auto wallsInMidRitem2 = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&wallsInMidRitem2->World, XMMatrixScaling(.2f, 2.6f, 4.f)*XMMatrixTranslation(-5.35f + 10.7f*i, 0.5f, -8.5f));
-		XMStoreFloat4x4(&wallsInMidRitem2->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-		wallsInMidRitem2->ObjCBIndex = objCBIndex++;
-		wallsInMidRitem2->Mat = mMaterials["crate0"].get();
-		wallsInMidRitem2->Geo = mGeometries["shapeGeo"].get();
-		wallsInMidRitem2->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		wallsInMidRitem2->IndexCount = wallsInMidRitem2->Geo->DrawArgs["box"].IndexCount;
-		wallsInMidRitem2->StartIndexLocation = wallsInMidRitem2->Geo->DrawArgs["box"].StartIndexLocation;
-		wallsInMidRitem2->BaseVertexLocation = wallsInMidRitem2->Geo->DrawArgs["box"].BaseVertexLocation;
-		mAllRitems.push_back(std::move(wallsInMidRitem2));
+	auto waterRingsRitem = std::make_unique<RenderItem>();
+	waterRingsRitem->World = mWaterBodyRitems[mLakeBody]->World;
+	waterRingsRitem->TexTransform = mWaterBodyRitems[mLakeBody]->TexTransform;
+	waterRingsRitem->ObjCBIndex = objCBIndex++;
+	waterRingsRitem->Mat = mMaterials["water"].get();
+	waterRingsRitem->Geo = mGeometries["waterRingsGeo"].get();
+	waterRingsRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	const SubmeshGeometry& rings = waterRingsRitem->Geo->DrawArgs["rings"];
+	waterRingsRitem->IndexCount = rings.IndexCount;
+	waterRingsRitem->StartIndexLocation = rings.StartIndexLocation;
+	waterRingsRitem->BaseVertexLocation = rings.BaseVertexLocation;
+	waterRingsRitem->Bounds = rings.Bounds;
+	waterRingsRitem->CullIndex = mCuller.Add(waterRingsRitem->Bounds.Center, waterRingsRitem->Bounds.Extents);
+
+	mWaterRingsRitem = waterRingsRitem.get();
+
+	for (auto& e : waterBodyRitems)
+	{
+		mRitemLayer[(int)RenderLayer::Waves].push_back(e.get());
+		mAllRitems.push_back(std::move(e));
 	}
 
-	objCBIndex = 46;
-	for (int i = 0; i < 2; ++i) {
-		auto frontWallsRitem = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&frontWallsRitem->World, XMMatrixScaling(.2f, 2.6f, 2.f)*XMMatrixRotationY(XMConvertToRadians(90))*XMMatrixTranslation(-4.f + 8.f*i, 0.5f, -11.5f));
-		XMStoreFloat4x4(&frontWallsRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-		frontWallsRitem->ObjCBIndex = objCBIndex++;
-		frontWallsRitem->Mat = mMaterials["crate0"].get();
-		frontWallsRitem->Geo = mGeometries["shapeGeo"].get();
-		frontWallsRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		frontWallsRitem->IndexCount = frontWallsRitem->Geo->DrawArgs["box"].IndexCount;
-		frontWallsRitem->StartIndexLocation = frontWallsRitem->Geo->DrawArgs["box"].StartIndexLocation;
-		frontWallsRitem->BaseVertexLocation = frontWallsRitem->Geo->DrawArgs["box"].BaseVertexLocation;
-		mAllRitems.push_back(std::move(frontWallsRitem));
-	}
+	mRitemLayer[(int)RenderLayer::WaterRings].push_back(waterRingsRitem.get());
+	mAllRitems.push_back(std::move(waterRingsRitem));
+}
 
-	objCBIndex = 48;
-	for (int i = 0; i < 2; ++i) {
-		auto CorridorWallsRitem = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&CorridorWallsRitem->World, XMMatrixScaling(.2f, 2.6f, 4.2f)*XMMatrixTranslation(-2.7f + 5.4f*i, 0.5f, -2.5f));
-		XMStoreFloat4x4(&CorridorWallsRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-		CorridorWallsRitem->ObjCBIndex = objCBIndex++;
-		CorridorWallsRitem->Mat = mMaterials["crate0"].get();
-		CorridorWallsRitem->Geo = mGeometries["shapeGeo"].get();
-		CorridorWallsRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		CorridorWallsRitem->IndexCount = CorridorWallsRitem->Geo->DrawArgs["box"].IndexCount;
-		CorridorWallsRitem->StartIndexLocation = CorridorWallsRitem->Geo->DrawArgs["box"].StartIndexLocation;
-		CorridorWallsRitem->BaseVertexLocation = CorridorWallsRitem->Geo->DrawArgs["box"].BaseVertexLocation;
-		mAllRitems.push_back(std::move(CorridorWallsRitem));
+void i4CastleApp::BuildInstanceBatches()
+{
+	// Items of the same layer drawing the same submesh with the same material only
+	// differ in their constants, so each such group is drawn as the instances of one
+	// draw call.  Blended items need drawing back to front, which a batch spread
+	// around the scene cannot be, so the transparent layer is left to DrawRenderItems.
+	for (RenderLayer layer : { RenderLayer::Opaque, RenderLayer::AlphaTested })
+	{
+		for (RenderItem* ri : mRitemLayer[(int)layer])
+		{
+			InstanceBatcher::BatchKey key;
+			key.Layer = (int)layer;
+			key.Geometry = ri->Geo;
+			key.PrimitiveType = ri->PrimitiveType;
+			key.IndexCount = ri->IndexCount;
+			key.StartIndexLocation = ri->StartIndexLocation;
+			key.BaseVertexLocation = ri->BaseVertexLocation;
+			key.Material = ri->Mat;
+			mBatcher.Add(key, ri->ObjCBIndex, ri->CullIndex);
+		}
 	}
+}
 
-	auto wavesRitem = std::make_unique<RenderItem>();
-	wavesRitem->World = MathHelper::Identity4x4();
-	XMStoreFloat4x4(&wavesRitem->TexTransform, XMMatrixScaling(10.0f, 10.0f, 5.5f));
-	wavesRitem->ObjCBIndex = 51;
-	wavesRitem->Mat = mMaterials["water"].get();
-	wavesRitem->Geo = mGeometries["waterGeo"].get();
-	wavesRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wavesRitem->IndexCount = wavesRitem->Geo->DrawArgs["grid"].IndexCount;
-	wavesRitem->StartIndexLocation = wavesRitem->Geo->DrawArgs["grid"].StartIndexLocation;
-	wavesRitem->BaseVertexLocation = wavesRitem->Geo->DrawArgs["grid"].BaseVertexLocation;
 
-	mWavesRitem = wavesRitem.get();
+void i4CastleApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, RenderLayer layer, const std::vector<RenderItem*>& ritems)
+{
+	const auto& objectCB = mCurrFrameResource->ObjectCB;
+	const auto& matCB = mCurrFrameResource->MaterialCB;
 
-	// All the render items are opaque.
-	for (auto& e : mAllRitems)
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(e.get());
-		//mOpaqueRitems.push_back(e.get());
+	// Sort the visible items by state and by the view depth of their bounds' center.
+	// Only the opaque and alpha tested layers are drawn without blending.
+	bool transparent = layer != RenderLayer::Opaque && layer != RenderLayer::AlphaTested;
+	XMMATRIX view = mCamera.GetView();
+	mDrawEntries.clear();
+	for (size_t i = 0; i < ritems.size(); ++i)
+	{
+		auto ri = ritems[i];
 
-	mRitemLayer[(int)RenderLayer::Transparent].push_back(wavesRitem.get());
-	mAllRitems.push_back(std::move(wavesRitem));
-}
+		// Skip the items outside the frustum; see UpdateCulling.
+		if (ri->CullIndex >= 0 && !mCuller.Visible(ri->CullIndex))
+			continue;
 
+		XMMATRIX worldView = XMMatrixMultiply(XMLoadFloat4x4(&ri->World), view);
+		XMVECTOR center = XMVector3TransformCoord(XMLoadFloat3(&ri->Bounds.Center), worldView);
 
-void i4CastleApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems)
-{
-    UINT objCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(ObjectConstants));
-	UINT matCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(MaterialConstants));
- 
-	auto objectCB = mCurrFrameResource->ObjectCB->Resource();
-	auto matCB = mCurrFrameResource->MaterialCB->Resource();
+		DrawSortEntry entry;
+		entry.Key = MakeDrawSortKey((UINT)layer, mGeometrySortIds[ri->Geo], ri->Mat->DiffuseSrvHeapIndex,
+			ri->Mat->MatCBIndex, XMVectorGetZ(center), transparent);
+		entry.Index = (UINT)i;
+		mDrawEntries.push_back(entry);
+	}
+	RadixSortDraws(mDrawEntries, mDrawSortScratch);
 
     // For each render item...
-    for(size_t i = 0; i < ritems.size(); ++i)
+    for (const DrawSortEntry& entry : mDrawEntries)
     {
-        auto ri = ritems[i];
+        auto ri = ritems[entry.Index];
 
-        cmdList->IASetVertexBuffers(0, 1, &ri->Geo->VertexBufferView());
-        cmdList->IASetIndexBuffer(&ri->Geo->IndexBufferView());
-        cmdList->IASetPrimitiveTopology(ri->PrimitiveType);
+		mBindCache.SetVertexBuffer(0, ri->Geo->VertexBufferView());
+		if (ri->DynamicVertexBufferView.BufferLocation != 0)
+			mBindCache.SetVertexBuffer(1, ri->DynamicVertexBufferView);
+		mBindCache.SetIndexBuffer(ri->Geo->IndexBufferView());
+		mBindCache.SetPrimitiveTopology(ri->PrimitiveType);
 
 		CD3DX12_GPU_DESCRIPTOR_HANDLE tex(mSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart());
 		tex.Offset(ri->Mat->DiffuseSrvHeapIndex, mCbvSrvDescriptorSize);
 
-        D3D12_GPU_VIRTUAL_ADDRESS objCBAddress = objectCB->GetGPUVirtualAddress() + ri->ObjCBIndex*objCBByteSize;
-		D3D12_GPU_VIRTUAL_ADDRESS matCBAddress = matCB->GetGPUVirtualAddress() + ri->Mat->MatCBIndex*matCBByteSize;
+        D3D12_GPU_VIRTUAL_ADDRESS objCBAddress = objectCB.Address(ri->ObjCBIndex);
+		D3D12_GPU_VIRTUAL_ADDRESS matCBAddress = matCB.Address(ri->Mat->MatCBIndex);
 
-		cmdList->SetGraphicsRootDescriptorTable(0, tex);
-		cmdList->SetGraphicsRootConstantBufferView(1, objCBAddress);
-		cmdList->SetGraphicsRootConstantBufferView(3, matCBAddress);
+		mBindCache.SetGraphicsRootDescriptorTable(0, tex);
+		mBindCache.SetGraphicsRootConstantBufferView(1, objCBAddress);
+		mBindCache.SetGraphicsRootConstantBufferView(3, matCBAddress);
 		
 		//cmdList->SetGraphicsRootConstantBufferView(0, objCBAddress);
 
@@ -1779,6 +1502,67 @@ void i4CastleApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std:
     }
 }
 
+void i4CastleApp::BuildDrawSortIds()
+{
+	// Only the first 256 geometries get a distinct id in the sort keys.
+	for (auto& e : mGeometries)
+	{
+		UINT id = (UINT)mGeometrySortIds.size();
+		mGeometrySortIds[e.second.get()] = id;
+	}
+}
+
+void i4CastleApp::DrawInstanceBatches(ID3D12GraphicsCommandList* cmdList, RenderLayer layer)
+{
+	const auto& instanceBuffer = mCurrFrameResource->InstanceBuffer;
+	const auto& matCB = mCurrFrameResource->MaterialCB;
+
+	// The instances of a batch are spread around the scene, so batches have no one
+	// depth and are sorted by state alone; only unblended layers are batched.
+	const std::vector<int>& batches = mBatcher.LayerBatches((int)layer);
+	mDrawEntries.clear();
+	for (int b : batches)
+	{
+		const InstanceBatcher::Batch& batch = mBatcher.Batches()[b];
+		if (batch.InstanceCount == 0)
+			continue;
+
+		auto mat = static_cast<const Material*>(batch.Key.Material);
+		DrawSortEntry entry;
+		entry.Key = MakeDrawSortKey((UINT)layer, mGeometrySortIds[static_cast<const MeshGeometry*>(batch.Key.Geometry)],
+			mat->DiffuseSrvHeapIndex, mat->MatCBIndex, 0.0f, false);
+		entry.Index = (UINT)b;
+		mDrawEntries.push_back(entry);
+	}
+	RadixSortDraws(mDrawEntries, mDrawSortScratch);
+
+	for (const DrawSortEntry& entry : mDrawEntries)
+	{
+		const InstanceBatcher::Batch& batch = mBatcher.Batches()[entry.Index];
+
+		// The key only identifies the geometry and material; these are the ones it was
+		// built from in BuildInstanceBatches.
+		auto geo = static_cast<const MeshGeometry*>(batch.Key.Geometry);
+		auto mat = static_cast<const Material*>(batch.Key.Material);
+
+		mBindCache.SetVertexBuffer(0, geo->VertexBufferView());
+		mBindCache.SetIndexBuffer(geo->IndexBufferView());
+		mBindCache.SetPrimitiveTopology((D3D12_PRIMITIVE_TOPOLOGY)batch.Key.PrimitiveType);
+
+		CD3DX12_GPU_DESCRIPTOR_HANDLE tex(mSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart());
+		tex.Offset(mat->DiffuseSrvHeapIndex, mCbvSrvDescriptorSize);
+
+		// SV_InstanceID starts at zero in every draw, so the shader sees the buffer from
+		// the batch's first instance on.
+		mBindCache.SetGraphicsRootDescriptorTable(0, tex);
+		mBindCache.SetGraphicsRootConstantBufferView(3, matCB.Address(mat->MatCBIndex));
+		mBindCache.SetGraphicsRootShaderResourceView(4, instanceBuffer.Address(batch.FirstInstance));
+
+		cmdList->DrawIndexedInstanced(batch.Key.IndexCount, batch.InstanceCount,
+			batch.Key.StartIndexLocation, batch.Key.BaseVertexLocation, 0);
+	}
+}
+
 std::array<const CD3DX12_STATIC_SAMPLER_DESC, 6> i4CastleApp::GetStaticSamplers()
 {
 	// Applications usually only need a handful of samplers.  So just define them all up front
@@ -0,0 +1,91 @@
+//***************************************************************************************
+// CommandBindCache.cpp
+//***************************************************************************************
+
+#include "CommandBindCache.h"
+
+void CommandBindCache::Reset(ID3D12GraphicsCommandList* cmdList)
+{
+	mCmdList = cmdList;
+	for(UINT i = 0; i < MaxVertexBuffers; ++i)
+		mVertexBufferValid[i] = false;
+	mIndexBufferValid = false;
+	mTopologyValid = false;
+	for(UINT i = 0; i < MaxRootParameters; ++i)
+		mRootArgumentValid[i] = false;
+}
+
+void CommandBindCache::ResetCounts()
+{
+	mIssuedCount = 0;
+	mAvoidedCount = 0;
+}
+
+bool CommandBindCache::Changed(UINT64& cache, bool& valid, UINT64 value)
+{
+	if(valid && cache == value)
+	{
+		++mAvoidedCount;
+		return false;
+	}
+
+	cache = value;
+	valid = true;
+	++mIssuedCount;
+	return true;
+}
+
+void CommandBindCache::SetVertexBuffer(UINT slot, const D3D12_VERTEX_BUFFER_VIEW& view)
+{
+	D3D12_VERTEX_BUFFER_VIEW& bound = mVertexBuffers[slot];
+	if(mVertexBufferValid[slot] && bound.BufferLocation == view.BufferLocation &&
+		bound.SizeInBytes == view.SizeInBytes && bound.StrideInBytes == view.StrideInBytes)
+	{
+		++mAvoidedCount;
+		return;
+	}
+
+	bound = view;
+	mVertexBufferValid[slot] = true;
+	++mIssuedCount;
+	mCmdList->IASetVertexBuffers(slot, 1, &view);
+}
+
+void CommandBindCache::SetIndexBuffer(const D3D12_INDEX_BUFFER_VIEW& view)
+{
+	if(mIndexBufferValid && mIndexBuffer.BufferLocation == view.BufferLocation &&
+		mIndexBuffer.SizeInBytes == view.SizeInBytes && mIndexBuffer.Format == view.Format)
+	{
+		++mAvoidedCount;
+		return;
+	}
+
+	mIndexBuffer = view;
+	mIndexBufferValid = true;
+	++mIssuedCount;
+	mCmdList->IASetIndexBuffer(&view);
+}
+
+void CommandBindCache::SetPrimitiveTopology(D3D12_PRIMITIVE_TOPOLOGY topology)
+{
+	if(Changed(mTopology, mTopologyValid, (UINT64)topology))
+		mCmdList->IASetPrimitiveTopology(topology);
+}
+
+void CommandBindCache::SetGraphicsRootDescriptorTable(UINT rootParameterIndex, D3D12_GPU_DESCRIPTOR_HANDLE baseDescriptor)
+{
+	if(Changed(mRootArguments[rootParameterIndex], mRootArgumentValid[rootParameterIndex], baseDescriptor.ptr))
+		mCmdList->SetGraphicsRootDescriptorTable(rootParameterIndex, baseDescriptor);
+}
+
+void CommandBindCache::SetGraphicsRootConstantBufferView(UINT rootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS address)
+{
+	if(Changed(mRootArguments[rootParameterIndex], mRootArgumentValid[rootParameterIndex], address))
+		mCmdList->SetGraphicsRootConstantBufferView(rootParameterIndex, address);
+}
+
+void CommandBindCache::SetGraphicsRootShaderResourceView(UINT rootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS address)
+{
+	if(Changed(mRootArguments[rootParameterIndex], mRootArgumentValid[rootParameterIndex], address))
+		mCmdList->SetGraphicsRootShaderResourceView(rootParameterIndex, address);
+}
@@ -0,0 +1,58 @@
+//***************************************************************************************
+// CommandBindCache.h
+//
+// Records input assembler and root argument bindings into a command list, skipping
+// the ones that set what is already bound.  Draws sorted by DrawSort keys mostly share
+// their bindings with the draw before them, so most calls are skipped; the counts of
+// calls made and skipped are kept for the stats.
+//***************************************************************************************
+
+#ifndef COMMANDBINDCACHE_H
+#define COMMANDBINDCACHE_H
+
+#include "d3dUtil.h"
+
+class CommandBindCache
+{
+public:
+	// Starts recording into cmdList.  Call again whenever the root signature is set,
+	// since that resets every root argument.  The counts are not reset.
+	void Reset(ID3D12GraphicsCommandList* cmdList);
+
+	void SetVertexBuffer(UINT slot, const D3D12_VERTEX_BUFFER_VIEW& view);
+	void SetIndexBuffer(const D3D12_INDEX_BUFFER_VIEW& view);
+	void SetPrimitiveTopology(D3D12_PRIMITIVE_TOPOLOGY topology);
+
+	void SetGraphicsRootDescriptorTable(UINT rootParameterIndex, D3D12_GPU_DESCRIPTOR_HANDLE baseDescriptor);
+	void SetGraphicsRootConstantBufferView(UINT rootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS address);
+	void SetGraphicsRootShaderResourceView(UINT rootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS address);
+
+	UINT64 IssuedCount()const { return mIssuedCount; }
+	UINT64 AvoidedCount()const { return mAvoidedCount; }
+	void ResetCounts();
+
+private:
+	// Whether value differs from what was last set in cache, which is then updated.
+	bool Changed(UINT64& cache, bool& valid, UINT64 value);
+
+private:
+	static const UINT MaxVertexBuffers = 2;
+	static const UINT MaxRootParameters = 8;
+
+	ID3D12GraphicsCommandList* mCmdList = nullptr;
+
+	// What was last bound; an entry is only meaningful while its flag is set.
+	D3D12_VERTEX_BUFFER_VIEW mVertexBuffers[MaxVertexBuffers] = {};
+	bool mVertexBufferValid[MaxVertexBuffers] = {};
+	D3D12_INDEX_BUFFER_VIEW mIndexBuffer = {};
+	bool mIndexBufferValid = false;
+	UINT64 mTopology = 0;
+	bool mTopologyValid = false;
+	UINT64 mRootArguments[MaxRootParameters] = {};
+	bool mRootArgumentValid[MaxRootParameters] = {};
+
+	UINT64 mIssuedCount = 0;
+	UINT64 mAvoidedCount = 0;
+};
+
+#endif // COMMANDBINDCACHE_H
@@ -0,0 +1,77 @@
+//***************************************************************************************
+// D3D12RenderDevice.cpp
+//***************************************************************************************
+
+#include "D3D12RenderDevice.h"
+
+D3D12UploadBuffer::D3D12UploadBuffer(ID3D12Device* device, UINT64 byteSize)
+	: mByteSize(byteSize)
+{
+	ThrowIfFailed(device->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(byteSize),
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(&mUploadBuffer)));
+
+	// We do not need to unmap until we are done with the resource.  However, we must not write to
+	// the resource while it is in use by the GPU (so we must use synchronization techniques).
+	ThrowIfFailed(mUploadBuffer->Map(0, nullptr, reinterpret_cast<void**>(&mMappedData)));
+}
+
+D3D12UploadBuffer::~D3D12UploadBuffer()
+{
+	if(mUploadBuffer != nullptr)
+		mUploadBuffer->Unmap(0, nullptr);
+
+	mMappedData = nullptr;
+}
+
+D3D12CommandAllocator::D3D12CommandAllocator(ID3D12Device* device)
+{
+	ThrowIfFailed(device->CreateCommandAllocator(
+		D3D12_COMMAND_LIST_TYPE_DIRECT,
+		IID_PPV_ARGS(mAllocator.GetAddressOf())));
+}
+
+void D3D12CommandAllocator::Reset()
+{
+	ThrowIfFailed(mAllocator->Reset());
+}
+
+D3D12RenderDevice::D3D12RenderDevice(ID3D12Device* device, ID3D12CommandQueue* commandQueue, ID3D12Fence* fence)
+	: mDevice(device), mCommandQueue(commandQueue), mFence(fence)
+{
+}
+
+std::unique_ptr<GpuUploadBuffer> D3D12RenderDevice::CreateUploadBuffer(std::uint64_t byteSize)
+{
+	return std::make_unique<D3D12UploadBuffer>(mDevice, byteSize);
+}
+
+std::unique_ptr<GpuCommandAllocator> D3D12RenderDevice::CreateCommandAllocator()
+{
+	return std::make_unique<D3D12CommandAllocator>(mDevice);
+}
+
+std::uint64_t D3D12RenderDevice::CompletedFenceValue()
+{
+	return mFence->GetCompletedValue();
+}
+
+void D3D12RenderDevice::WaitForFence(std::uint64_t fenceValue)
+{
+	if(mFence->GetCompletedValue() < fenceValue)
+	{
+		HANDLE eventHandle = CreateEventEx(nullptr, false, false, EVENT_ALL_ACCESS);
+		ThrowIfFailed(mFence->SetEventOnCompletion(fenceValue, eventHandle));
+		WaitForSingleObject(eventHandle, INFINITE);
+		CloseHandle(eventHandle);
+	}
+}
+
+void D3D12RenderDevice::Signal(std::uint64_t fenceValue)
+{
+	ThrowIfFailed(mCommandQueue->Signal(mFence, fenceValue));
+}
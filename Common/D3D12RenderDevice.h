@@ -0,0 +1,73 @@
+//***************************************************************************************
+// D3D12RenderDevice.h
+//
+// RenderDevice on top of a D3D12 device, command queue and fence.  It does not own
+// them; D3DApp does.
+//***************************************************************************************
+
+#ifndef D3D12RENDERDEVICE_H
+#define D3D12RENDERDEVICE_H
+
+#include "d3dUtil.h"
+#include "RenderDevice.h"
+
+class D3D12UploadBuffer : public GpuUploadBuffer
+{
+public:
+	D3D12UploadBuffer(ID3D12Device* device, UINT64 byteSize);
+	D3D12UploadBuffer(const D3D12UploadBuffer& rhs) = delete;
+	D3D12UploadBuffer& operator=(const D3D12UploadBuffer& rhs) = delete;
+	~D3D12UploadBuffer();
+
+	virtual std::uint8_t* MappedData()override { return mMappedData; }
+	virtual std::uint64_t GpuAddress()const override { return mUploadBuffer->GetGPUVirtualAddress(); }
+	virtual std::uint64_t ByteSize()const override { return mByteSize; }
+
+	ID3D12Resource* Resource()const { return mUploadBuffer.Get(); }
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12Resource> mUploadBuffer;
+	BYTE* mMappedData = nullptr;
+	UINT64 mByteSize = 0;
+};
+
+class D3D12CommandAllocator : public GpuCommandAllocator
+{
+public:
+	explicit D3D12CommandAllocator(ID3D12Device* device);
+
+	virtual void Reset()override;
+
+	ID3D12CommandAllocator* Get()const { return mAllocator.Get(); }
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12CommandAllocator> mAllocator;
+};
+
+class D3D12RenderDevice : public RenderDevice
+{
+public:
+	D3D12RenderDevice(ID3D12Device* device, ID3D12CommandQueue* commandQueue, ID3D12Fence* fence);
+
+	virtual std::unique_ptr<GpuUploadBuffer> CreateUploadBuffer(std::uint64_t byteSize)override;
+	virtual std::unique_ptr<GpuCommandAllocator> CreateCommandAllocator()override;
+
+	virtual std::uint64_t CompletedFenceValue()override;
+	virtual void WaitForFence(std::uint64_t fenceValue)override;
+	virtual void Signal(std::uint64_t fenceValue)override;
+
+	// The D3D12 objects behind the interface, for the command lists that record with them.
+	static ID3D12CommandAllocator* Native(GpuCommandAllocator& allocator)
+	{
+		return static_cast<D3D12CommandAllocator&>(allocator).Get();
+	}
+
+	ID3D12Device* Device()const { return mDevice; }
+
+private:
+	ID3D12Device* mDevice = nullptr;
+	ID3D12CommandQueue* mCommandQueue = nullptr;
+	ID3D12Fence* mFence = nullptr;
+};
+
+#endif // D3D12RENDERDEVICE_H
@@ -0,0 +1,72 @@
+//***************************************************************************************
+// DrawSort.cpp
+//***************************************************************************************
+
+#include "DrawSort.h"
+#include <cstring>
+
+std::uint64_t MakeDrawSortKey(std::uint32_t pipeline, std::uint32_t geometry, std::uint32_t texture,
+	std::uint32_t material, float depth, bool transparent)
+{
+	// The bits of a non-negative float order the same way as the float itself.
+	std::uint32_t depthBits = 0;
+	if(depth > 0.0f)
+		std::memcpy(&depthBits, &depth, sizeof(depthBits));
+
+	std::uint64_t state = ((std::uint64_t)(geometry & 0xff) << 16) |
+		((std::uint64_t)(texture & 0xff) << 8) | (std::uint64_t)(material & 0xff);
+
+	std::uint64_t key = (std::uint64_t)(pipeline & 0xff) << 56;
+	if(transparent)
+		key |= ((std::uint64_t)~depthBits << 24) | state;
+	else
+		key |= (state << 32) | depthBits;
+	return key;
+}
+
+void RadixSortDraws(std::vector<DrawSortEntry>& entries, std::vector<DrawSortEntry>& scratch)
+{
+	const size_t n = entries.size();
+	if(n < 2)
+		return;
+
+	// The counts of every byte position in one pass over the keys.
+	std::uint32_t counts[8][256] = {};
+	for(const DrawSortEntry& e : entries)
+	{
+		for(int pass = 0; pass < 8; ++pass)
+			++counts[pass][(e.Key >> (8*pass)) & 0xff];
+	}
+
+	scratch.resize(n);
+	DrawSortEntry* src = entries.data();
+	DrawSortEntry* dst = scratch.data();
+	for(int pass = 0; pass < 8; ++pass)
+	{
+		std::uint32_t* count = counts[pass];
+		int shift = 8*pass;
+
+		// Every key has the same byte here, so this pass would not move anything.
+		if(count[(src[0].Key >> shift) & 0xff] == n)
+			continue;
+
+		std::uint32_t offsets[256];
+		std::uint32_t sum = 0;
+		for(int d = 0; d < 256; ++d)
+		{
+			offsets[d] = sum;
+			sum += count[d];
+		}
+
+		for(size_t i = 0; i < n; ++i)
+			dst[offsets[(src[i].Key >> shift) & 0xff]++] = src[i];
+
+		DrawSortEntry* t = src;
+		src = dst;
+		dst = t;
+	}
+
+	// After an odd number of passes the sorted entries are in scratch.
+	if(src != entries.data())
+		entries.swap(scratch);
+}
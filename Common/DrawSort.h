@@ -0,0 +1,41 @@
+//***************************************************************************************
+// DrawSort.h
+//
+// Orders the draws of a layer by a 64-bit key, so the draws sharing the pipeline state,
+// geometry, texture and material end up next to each other and each binding is set
+// once per run instead of once per draw.  The key packs, from the most significant bit:
+//
+//   opaque:       pipeline (8) | geometry (8) | texture (8) | material (8) | depth (32)
+//   transparent:  pipeline (8) | depth (32)   | geometry (8) | texture (8) | material (8)
+//
+// Opaque draws are sorted by state, and within the same state front to back, which
+// lets early depth rejection skip the most pixels.  Transparent draws must blend back
+// to front, so depth (inverted) comes before the state there.
+//***************************************************************************************
+
+#ifndef DRAWSORT_H
+#define DRAWSORT_H
+
+#include <cstdint>
+#include <vector>
+
+struct DrawSortEntry
+{
+	std::uint64_t Key = 0;
+
+	// What the caller sorts: an index into its own list of draws.
+	std::uint32_t Index = 0;
+};
+
+// Builds a key; ids above 255 are wrapped.  depth is the view-space depth of the draw,
+// and anything behind the eye counts as zero.
+std::uint64_t MakeDrawSortKey(std::uint32_t pipeline, std::uint32_t geometry, std::uint32_t texture,
+	std::uint32_t material, float depth, bool transparent);
+
+// Sorts entries by key, least significant byte first; the order of equal keys is kept.
+// scratch is resized as needed and can be kept between calls to save allocations.
+// Passes over a byte that is the same in every key are skipped, so a layer whose
+// draws differ only in depth costs four passes, not eight.
+void RadixSortDraws(std::vector<DrawSortEntry>& entries, std::vector<DrawSortEntry>& scratch);
+
+#endif // DRAWSORT_H
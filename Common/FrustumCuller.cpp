@@ -0,0 +1,137 @@
+//***************************************************************************************
+// FrustumCuller.cpp
+//***************************************************************************************
+
+#include "FrustumCuller.h"
+
+using namespace DirectX;
+
+int FrustumCuller::Add(const XMFLOAT3& center, const XMFLOAT3& extents)
+{
+	Box box;
+	box.Center = center;
+	box.Extents = extents;
+	mLocalBoxes.push_back(box);
+	mVisible.push_back(1);
+
+	int object = Count() - 1;
+	if(object % 4 == 0)
+		mWorldBoxes.push_back(BoxGroup());
+
+	XMFLOAT4X4 identity(
+		1.0f, 0.0f, 0.0f, 0.0f,
+		0.0f, 1.0f, 0.0f, 0.0f,
+		0.0f, 0.0f, 1.0f, 0.0f,
+		0.0f, 0.0f, 0.0f, 1.0f);
+	SetWorld(object, identity);
+
+	return object;
+}
+
+void FrustumCuller::SetWorld(int object, const XMFLOAT4X4& world)
+{
+	// The box around a transformed box: the center is transformed as a point, and each
+	// world-space half extent is the sum of the local ones weighted by the absolute
+	// values of the matrix entries.
+	const Box& local = mLocalBoxes[object];
+	XMMATRIX W = XMLoadFloat4x4(&world);
+
+	XMVECTOR center = XMVectorMultiplyAdd(XMVectorReplicate(local.Center.x), W.r[0], W.r[3]);
+	center = XMVectorMultiplyAdd(XMVectorReplicate(local.Center.y), W.r[1], center);
+	center = XMVectorMultiplyAdd(XMVectorReplicate(local.Center.z), W.r[2], center);
+
+	XMVECTOR extents = XMVectorMultiply(XMVectorReplicate(local.Extents.x), XMVectorAbs(W.r[0]));
+	extents = XMVectorMultiplyAdd(XMVectorReplicate(local.Extents.y), XMVectorAbs(W.r[1]), extents);
+	extents = XMVectorMultiplyAdd(XMVectorReplicate(local.Extents.z), XMVectorAbs(W.r[2]), extents);
+
+	XMFLOAT3 c, e;
+	XMStoreFloat3(&c, center);
+	XMStoreFloat3(&e, extents);
+
+	BoxGroup& group = mWorldBoxes[object / 4];
+	int lane = object % 4;
+	(&group.CenterX.x)[lane] = c.x;
+	(&group.CenterY.x)[lane] = c.y;
+	(&group.CenterZ.x)[lane] = c.z;
+	(&group.ExtentX.x)[lane] = e.x;
+	(&group.ExtentY.x)[lane] = e.y;
+	(&group.ExtentZ.x)[lane] = e.z;
+}
+
+void FrustumCuller::Cull(FXMMATRIX viewProj)
+{
+	// With row vectors, clip space coordinate k is the dot product of the point with
+	// column k of viewProj, i.e. with row k of its transpose.  A point is inside when
+	// -w <= x <= w, -w <= y <= w and 0 <= z <= w.
+	XMMATRIX T = XMMatrixTranspose(viewProj);
+	XMVECTOR planes[6] =
+	{
+		XMVectorAdd(T.r[3], T.r[0]),      // left
+		XMVectorSubtract(T.r[3], T.r[0]), // right
+		XMVectorAdd(T.r[3], T.r[1]),      // bottom
+		XMVectorSubtract(T.r[3], T.r[1]), // top
+		T.r[2],                           // near
+		XMVectorSubtract(T.r[3], T.r[2])  // far
+	};
+
+	// Each plane's coefficients, and their absolute values, splatted across the four lanes.
+	struct SplatPlane
+	{
+		XMVECTOR A, B, C, D;
+		XMVECTOR AbsA, AbsB, AbsC;
+	};
+	SplatPlane splat[6];
+	for(int p = 0; p < 6; ++p)
+	{
+		splat[p].A = XMVectorSplatX(planes[p]);
+		splat[p].B = XMVectorSplatY(planes[p]);
+		splat[p].C = XMVectorSplatZ(planes[p]);
+		splat[p].D = XMVectorSplatW(planes[p]);
+		splat[p].AbsA = XMVectorAbs(splat[p].A);
+		splat[p].AbsB = XMVectorAbs(splat[p].B);
+		splat[p].AbsC = XMVectorAbs(splat[p].C);
+	}
+
+	const XMVECTOR zero = XMVectorZero();
+	const int count = Count();
+	mCulledCount = 0;
+	for(int g = 0; g < (int)mWorldBoxes.size(); ++g)
+	{
+		const BoxGroup& group = mWorldBoxes[g];
+		XMVECTOR cx = XMLoadFloat4(&group.CenterX);
+		XMVECTOR cy = XMLoadFloat4(&group.CenterY);
+		XMVECTOR cz = XMLoadFloat4(&group.CenterZ);
+		XMVECTOR ex = XMLoadFloat4(&group.ExtentX);
+		XMVECTOR ey = XMLoadFloat4(&group.ExtentY);
+		XMVECTOR ez = XMLoadFloat4(&group.ExtentZ);
+
+		// A box is outside a plane when even its corner farthest along the plane
+		// normal is behind it: distance of the center plus the projected radius < 0.
+		XMVECTOR outside = XMVectorFalseInt();
+		for(int p = 0; p < 6; ++p)
+		{
+			const SplatPlane& s = splat[p];
+			XMVECTOR distance = XMVectorMultiplyAdd(s.A, cx, s.D);
+			distance = XMVectorMultiplyAdd(s.B, cy, distance);
+			distance = XMVectorMultiplyAdd(s.C, cz, distance);
+
+			XMVECTOR radius = XMVectorMultiply(s.AbsA, ex);
+			radius = XMVectorMultiplyAdd(s.AbsB, ey, radius);
+			radius = XMVectorMultiplyAdd(s.AbsC, ez, radius);
+
+			outside = XMVectorOrInt(outside, XMVectorLess(XMVectorAdd(distance, radius), zero));
+		}
+
+		std::uint32_t mask[4];
+		XMStoreInt4(mask, outside);
+
+		int first = 4*g;
+		int last = count < first + 4 ? count : first + 4;
+		for(int object = first; object < last; ++object)
+		{
+			bool visible = mask[object - first] == 0;
+			mVisible[object] = visible ? 1 : 0;
+			mCulledCount += visible ? 0 : 1;
+		}
+	}
+}
@@ -0,0 +1,67 @@
+//***************************************************************************************
+// FrustumCuller.h
+//
+// Tests a set of objects against the view frustum, four at a time.  Each object has an
+// axis-aligned box in its local space; the world-space box that encloses it is cached
+// and only recomputed when the object's world matrix changes.  The cached boxes are
+// kept in groups of four, one array per coordinate, so a plane is tested against four
+// boxes with a handful of vector instructions.
+//***************************************************************************************
+
+#ifndef FRUSTUMCULLER_H
+#define FRUSTUMCULLER_H
+
+#include <DirectXMath.h>
+#include <cstdint>
+#include <vector>
+
+class FrustumCuller
+{
+public:
+	// Adds an object whose local-space box has the given center and half extents, and
+	// returns its index.  Its world matrix starts as the identity.
+	int Add(const DirectX::XMFLOAT3& center, const DirectX::XMFLOAT3& extents);
+
+	int Count()const { return (int)mLocalBoxes.size(); }
+
+	// Recomputes the cached world-space box of an object for a new world matrix.
+	void SetWorld(int object, const DirectX::XMFLOAT4X4& world);
+
+	// Tests every object against the frustum of viewProj, a row-vector view-projection
+	// matrix with D3D clip space (0 <= z <= w).  An object is visible unless its world
+	// box is entirely outside one of the six planes, so a few objects just outside a
+	// corner of the frustum are kept.
+	void Cull(DirectX::FXMMATRIX viewProj);
+
+	// Whether the object passed the last call to Cull.
+	bool Visible(int object)const { return mVisible[object] != 0; }
+
+	// Objects tested and rejected by the last call to Cull.
+	int TestedCount()const { return Count(); }
+	int CulledCount()const { return mCulledCount; }
+
+private:
+	struct Box
+	{
+		DirectX::XMFLOAT3 Center;
+		DirectX::XMFLOAT3 Extents;
+	};
+
+	// World-space boxes of four objects, lane k belonging to object 4*group + k.
+	struct BoxGroup
+	{
+		DirectX::XMFLOAT4 CenterX = { 0.0f, 0.0f, 0.0f, 0.0f };
+		DirectX::XMFLOAT4 CenterY = { 0.0f, 0.0f, 0.0f, 0.0f };
+		DirectX::XMFLOAT4 CenterZ = { 0.0f, 0.0f, 0.0f, 0.0f };
+		DirectX::XMFLOAT4 ExtentX = { 0.0f, 0.0f, 0.0f, 0.0f };
+		DirectX::XMFLOAT4 ExtentY = { 0.0f, 0.0f, 0.0f, 0.0f };
+		DirectX::XMFLOAT4 ExtentZ = { 0.0f, 0.0f, 0.0f, 0.0f };
+	};
+
+	std::vector<Box> mLocalBoxes;
+	std::vector<BoxGroup> mWorldBoxes;
+	std::vector<std::uint8_t> mVisible;
+	int mCulledCount = 0;
+};
+
+#endif // FRUSTUMCULLER_H
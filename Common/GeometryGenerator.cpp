@@ -4,6 +4,9 @@
 
 #include "GeometryGenerator.h"
 #include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <unordered_map>
 
 using namespace DirectX;
 
@@ -812,12 +815,10 @@ GeometryGenerator::MeshData GeometryGenerator::CreateHexagon(float width, float
 
 void GeometryGenerator::Subdivide(MeshData& meshData)
 {
-	// Save a copy of the input geometry.
-	MeshData inputCopy = meshData;
-
-
-	meshData.Vertices.resize(0);
-	meshData.Indices32.resize(0);
+	// The input vertices are kept as they are, and a vertex is added at the midpoint
+	// of every edge.  Triangles sharing an edge share its midpoint, so the new
+	// vertices are looked up by the edge's two vertex indices.  Hard edges stay hard,
+	// since the faces on either side of them have their own vertices.
 
 	//       v1
 	//       *
@@ -829,47 +830,64 @@ void GeometryGenerator::Subdivide(MeshData& meshData)
 	// *-----*-----*
 	// v0    m2     v2
 
-	uint32 numTris = (uint32)inputCopy.Indices32.size()/3;
+	std::vector<uint32> inputIndices;
+	inputIndices.swap(meshData.Indices32);
+
+	uint32 numTris = (uint32)inputIndices.size()/3;
+	meshData.Indices32.reserve(numTris*12);
+
+	// A closed mesh has one and a half edges per triangle.
+	std::unordered_map<std::uint64_t, uint32> midpoints;
+	midpoints.reserve(numTris*3/2);
+	meshData.Vertices.reserve(meshData.Vertices.size() + numTris*3/2);
+
+	auto midpoint = [&](uint32 a, uint32 b)
+	{
+		std::uint64_t edge = a < b ? ((std::uint64_t)a << 32) | b : ((std::uint64_t)b << 32) | a;
+		auto it = midpoints.find(edge);
+		if(it != midpoints.end())
+			return it->second;
+
+		Vertex m = MidPoint(meshData.Vertices[a], meshData.Vertices[b]);
+		uint32 index = (uint32)meshData.Vertices.size();
+		meshData.Vertices.push_back(m);
+		midpoints.insert(std::make_pair(edge, index));
+		return index;
+	};
+
 	for(uint32 i = 0; i < numTris; ++i)
 	{
-		Vertex v0 = inputCopy.Vertices[ inputCopy.Indices32[i*3+0] ];
-		Vertex v1 = inputCopy.Vertices[ inputCopy.Indices32[i*3+1] ];
-		Vertex v2 = inputCopy.Vertices[ inputCopy.Indices32[i*3+2] ];
+		uint32 v0 = inputIndices[i*3+0];
+		uint32 v1 = inputIndices[i*3+1];
+		uint32 v2 = inputIndices[i*3+2];
 
 		//
 		// Generate the midpoints.
 		//
 
-        Vertex m0 = MidPoint(v0, v1);
-        Vertex m1 = MidPoint(v1, v2);
-        Vertex m2 = MidPoint(v0, v2);
+		uint32 m0 = midpoint(v0, v1);
+		uint32 m1 = midpoint(v1, v2);
+		uint32 m2 = midpoint(v0, v2);
 
 		//
 		// Add new geometry.
 		//
 
-		meshData.Vertices.push_back(v0); // 0
-		meshData.Vertices.push_back(v1); // 1
-		meshData.Vertices.push_back(v2); // 2
-		meshData.Vertices.push_back(m0); // 3
-		meshData.Vertices.push_back(m1); // 4
-		meshData.Vertices.push_back(m2); // 5
- 
-		meshData.Indices32.push_back(i*6+0);
-		meshData.Indices32.push_back(i*6+3);
-		meshData.Indices32.push_back(i*6+5);
+		meshData.Indices32.push_back(v0);
+		meshData.Indices32.push_back(m0);
+		meshData.Indices32.push_back(m2);
 
-		meshData.Indices32.push_back(i*6+3);
-		meshData.Indices32.push_back(i*6+4);
-		meshData.Indices32.push_back(i*6+5);
+		meshData.Indices32.push_back(m0);
+		meshData.Indices32.push_back(m1);
+		meshData.Indices32.push_back(m2);
 
-		meshData.Indices32.push_back(i*6+5);
-		meshData.Indices32.push_back(i*6+4);
-		meshData.Indices32.push_back(i*6+2);
+		meshData.Indices32.push_back(m2);
+		meshData.Indices32.push_back(m1);
+		meshData.Indices32.push_back(v2);
 
-		meshData.Indices32.push_back(i*6+3);
-		meshData.Indices32.push_back(i*6+1);
-		meshData.Indices32.push_back(i*6+4);
+		meshData.Indices32.push_back(m0);
+		meshData.Indices32.push_back(v1);
+		meshData.Indices32.push_back(m1);
 	}
 }
 
@@ -1322,6 +1340,78 @@ GeometryGenerator::MeshData GeometryGenerator::CreateGrid(float width, float dep
     return meshData;
 }
 
+GeometryGenerator::MeshData GeometryGenerator::CreateClipmapRings(float width, uint32 n, uint32 levelCount)
+{
+    MeshData meshData;
+
+	// The hole is the middle half of each ring, so its edges fall on the ring's
+	// lattice as long as n is a multiple of 4.
+	assert(n % 4 == 0);
+	uint32 holeFirst = n / 4;
+	uint32 holeLast = 3 * n / 4;
+
+	// Vertex index of each lattice point of the current ring.
+	std::vector<uint32> lattice((n+1)*(n+1));
+
+	for(uint32 level = 1; level <= levelCount; ++level)
+	{
+		float size = std::ldexp(width, (int)level);
+		float halfSize = 0.5f*size;
+		float dx = size / n;
+
+		//
+		// Create the vertices, skipping the lattice points inside the hole.
+		//
+
+		for(uint32 i = 0; i <= n; ++i)
+		{
+			float z = halfSize - i*dx;
+			for(uint32 j = 0; j <= n; ++j)
+			{
+				if(i > holeFirst && i < holeLast && j > holeFirst && j < holeLast)
+					continue;
+
+				float x = -halfSize + j*dx;
+
+				lattice[i*(n+1)+j] = (uint32)meshData.Vertices.size();
+				meshData.Vertices.push_back(Vertex(
+					x, 0.0f, z,
+					0.0f, 1.0f, 0.0f,
+					1.0f, 0.0f, 0.0f,
+					(float)j / n, (float)i / n));
+			}
+		}
+
+		//
+		// Create the indices of every quad outside the hole.
+		//
+
+		for(uint32 i = 0; i < n; ++i)
+		{
+			for(uint32 j = 0; j < n; ++j)
+			{
+				if(i >= holeFirst && i < holeLast && j >= holeFirst && j < holeLast)
+					continue;
+
+				uint32 v00 = lattice[i*(n+1)+j];
+				uint32 v01 = lattice[i*(n+1)+j+1];
+				uint32 v10 = lattice[(i+1)*(n+1)+j];
+				uint32 v11 = lattice[(i+1)*(n+1)+j+1];
+
+				meshData.Indices32.push_back(v00);
+				meshData.Indices32.push_back(v01);
+				meshData.Indices32.push_back(v10);
+
+				meshData.Indices32.push_back(v10);
+				meshData.Indices32.push_back(v01);
+				meshData.Indices32.push_back(v11);
+			}
+		}
+	}
+
+    return meshData;
+}
+
 GeometryGenerator::MeshData GeometryGenerator::CreateQuad(float x, float y, float w, float h, float depth)
 {
     MeshData meshData;
@@ -110,6 +110,14 @@ public:
 	///</summary>
     MeshData CreateGrid(float width, float depth, uint32 m, uint32 n);
 
+	///<summary>
+	/// Creates levelCount square rings in the xz-plane, centered at the origin, that
+	/// extend a width x width grid as a geometry clipmap.  Ring L (starting at 1) is
+	/// width*2^L wide with n quads per side, and leaves a hole width*2^(L-1) wide for
+	/// the ring inside it, or the grid itself, to fill.  n must be a multiple of 4.
+	///</summary>
+    MeshData CreateClipmapRings(float width, uint32 n, uint32 levelCount);
+
 	///<summary>
 	/// Creates a quad aligned with the screen.  This is useful for postprocessing and screen effects.
 	///</summary>
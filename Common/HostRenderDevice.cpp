@@ -0,0 +1,72 @@
+//***************************************************************************************
+// HostRenderDevice.cpp
+//***************************************************************************************
+
+#include "HostRenderDevice.h"
+#include <cassert>
+
+HostUploadBuffer::HostUploadBuffer(std::uint64_t byteSize, std::uint64_t gpuAddress)
+	: mGpuAddress(gpuAddress), mByteSize(byteSize)
+{
+	// Over-allocate so the mapped pointer can be placement aligned, like a mapped
+	// upload heap is.
+	const std::uint64_t alignment = RenderDevice::BufferPlacementAlignment;
+	mMemory.resize((size_t)(byteSize + alignment));
+
+	std::uintptr_t p = reinterpret_cast<std::uintptr_t>(mMemory.data());
+	mMappedData = reinterpret_cast<std::uint8_t*>((p + alignment - 1) & ~(std::uintptr_t)(alignment - 1));
+}
+
+HostRenderDevice::HostRenderDevice(int framesInFlight)
+	: mFramesInFlight(framesInFlight > 0 ? framesInFlight : 1)
+{
+	// Start the made-up addresses away from zero so a null address stays invalid.
+	mNextGpuAddress = RenderDevice::BufferPlacementAlignment;
+}
+
+std::unique_ptr<GpuUploadBuffer> HostRenderDevice::CreateUploadBuffer(std::uint64_t byteSize)
+{
+	const std::uint64_t alignment = RenderDevice::BufferPlacementAlignment;
+	std::uint64_t size = (byteSize + alignment - 1) & ~(alignment - 1);
+
+	std::uint64_t gpuAddress = mNextGpuAddress;
+	mNextGpuAddress += size > 0 ? size : alignment;
+	return std::make_unique<HostUploadBuffer>(byteSize, gpuAddress);
+}
+
+std::unique_ptr<GpuCommandAllocator> HostRenderDevice::CreateCommandAllocator()
+{
+	return std::make_unique<HostCommandAllocator>();
+}
+
+void HostRenderDevice::WaitForFence(std::uint64_t fenceValue)
+{
+	if(mCompletedValue >= fenceValue)
+		return;
+
+	// A real GPU would never get there, and the wait would never return.
+	assert(fenceValue <= mSignalledValue);
+
+	++mStallCount;
+	Complete(fenceValue);
+}
+
+void HostRenderDevice::Signal(std::uint64_t fenceValue)
+{
+	assert(fenceValue > mSignalledValue);
+	mSignalledValue = fenceValue;
+	mPending.push_back(fenceValue);
+
+	// The pretend GPU finishes a frame for every frame the CPU queues past the limit.
+	if((int)mPending.size() > mFramesInFlight)
+		Complete(mPending[mPending.size() - mFramesInFlight - 1]);
+}
+
+void HostRenderDevice::Complete(std::uint64_t fenceValue)
+{
+	while(!mPending.empty() && mPending.front() <= fenceValue)
+	{
+		mCompletedValue = mPending.front();
+		mPending.pop_front();
+	}
+}
@@ -0,0 +1,74 @@
+//***************************************************************************************
+// HostRenderDevice.h
+//
+// RenderDevice in plain host memory, for running and timing the per-frame CPU work
+// without a GPU.  Upload buffers are ordinary cached allocations with made-up GPU
+// addresses, both placement aligned like D3D12's.  The fence stands in for a GPU that
+// always runs a fixed number of frames behind: a signalled value completes once that
+// many later signals have been queued, or at once when the CPU waits for it.
+//***************************************************************************************
+
+#ifndef HOSTRENDERDEVICE_H
+#define HOSTRENDERDEVICE_H
+
+#include "RenderDevice.h"
+#include <deque>
+#include <vector>
+
+class HostUploadBuffer : public GpuUploadBuffer
+{
+public:
+	HostUploadBuffer(std::uint64_t byteSize, std::uint64_t gpuAddress);
+	HostUploadBuffer(const HostUploadBuffer& rhs) = delete;
+	HostUploadBuffer& operator=(const HostUploadBuffer& rhs) = delete;
+
+	virtual std::uint8_t* MappedData()override { return mMappedData; }
+	virtual std::uint64_t GpuAddress()const override { return mGpuAddress; }
+	virtual std::uint64_t ByteSize()const override { return mByteSize; }
+
+private:
+	std::vector<std::uint8_t> mMemory;
+	std::uint8_t* mMappedData = nullptr;
+	std::uint64_t mGpuAddress = 0;
+	std::uint64_t mByteSize = 0;
+};
+
+class HostCommandAllocator : public GpuCommandAllocator
+{
+public:
+	virtual void Reset()override {}
+};
+
+class HostRenderDevice : public RenderDevice
+{
+public:
+	// framesInFlight is how many signals the pretend GPU lags behind the CPU.
+	explicit HostRenderDevice(int framesInFlight = 2);
+
+	virtual std::unique_ptr<GpuUploadBuffer> CreateUploadBuffer(std::uint64_t byteSize)override;
+	virtual std::unique_ptr<GpuCommandAllocator> CreateCommandAllocator()override;
+
+	virtual std::uint64_t CompletedFenceValue()override { return mCompletedValue; }
+	virtual void WaitForFence(std::uint64_t fenceValue)override;
+	virtual void Signal(std::uint64_t fenceValue)override;
+
+	// How many calls to WaitForFence had to complete a value early, i.e. would have
+	// stalled the CPU on a real GPU.
+	int StallCount()const { return mStallCount; }
+
+private:
+	void Complete(std::uint64_t fenceValue);
+
+private:
+	int mFramesInFlight = 0;
+
+	// Signalled values the pretend GPU has not reached yet, oldest first.
+	std::deque<std::uint64_t> mPending;
+	std::uint64_t mCompletedValue = 0;
+	std::uint64_t mSignalledValue = 0;
+	int mStallCount = 0;
+
+	std::uint64_t mNextGpuAddress = 0;
+};
+
+#endif // HOSTRENDERDEVICE_H
@@ -0,0 +1,392 @@
+//***************************************************************************************
+// MeshOptimizer.cpp
+//***************************************************************************************
+
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace DirectX;
+
+namespace
+{
+	// The cache OptimizeVertexCache scores against.  It is larger than the FIFO most
+	// hardware has, which the scores only approximate anyway.
+	const int kScoreCacheSize = 32;
+
+	// The vertices a triangle uses and the triangles a vertex is used by.
+	struct Adjacency
+	{
+		std::vector<std::uint32_t> Offsets;	// vertexCount + 1 of them
+		std::vector<std::uint32_t> Triangles;
+	};
+
+	void BuildAdjacency(const std::uint32_t* indices, std::size_t indexCount, std::size_t vertexCount,
+		Adjacency& adjacency)
+	{
+		adjacency.Offsets.assign(vertexCount + 1, 0);
+		for(std::size_t i = 0; i < indexCount; ++i)
+			++adjacency.Offsets[indices[i] + 1];
+		for(std::size_t v = 0; v < vertexCount; ++v)
+			adjacency.Offsets[v + 1] += adjacency.Offsets[v];
+
+		std::vector<std::uint32_t> next(adjacency.Offsets.begin(), adjacency.Offsets.end() - 1);
+		adjacency.Triangles.resize(indexCount);
+		for(std::size_t i = 0; i < indexCount; ++i)
+			adjacency.Triangles[next[indices[i]]++] = (std::uint32_t)(i/3);
+	}
+
+	// Forsyth's vertex score: high for vertices near the front of the cache, and for
+	// vertices with few triangles left, which are best finished off.  Both parts are
+	// tabulated, the second up to the valence most vertices have.
+	const std::uint32_t kValenceTableSize = 32;
+
+	struct ScoreTables
+	{
+		float Cache[kScoreCacheSize];
+		float Valence[kValenceTableSize];
+
+		ScoreTables()
+		{
+			for(int k = 0; k < kScoreCacheSize; ++k)
+			{
+				// The last triangle's vertices score the same whatever their order.
+				Cache[k] = k < 3 ? 0.75f : std::pow(1.0f - (k - 3)*(1.0f/(kScoreCacheSize - 3)), 1.5f);
+			}
+			for(std::uint32_t r = 1; r < kValenceTableSize; ++r)
+				Valence[r] = 2.0f/std::sqrt((float)r);
+			Valence[0] = 0.0f;
+		}
+	};
+
+	float VertexScore(const ScoreTables& tables, int cachePosition, std::uint32_t remaining)
+	{
+		if(remaining == 0)
+			return -1.0f;
+
+		float score = cachePosition >= 0 ? tables.Cache[cachePosition] : 0.0f;
+		return score + (remaining < kValenceTableSize ? tables.Valence[remaining] : 2.0f/std::sqrt((float)remaining));
+	}
+
+	// A FIFO post-transform cache.  A vertex is in it while at most cacheSize
+	// vertices have been transformed since it was; Flush skips the clock past that.
+	class FifoCache
+	{
+	public:
+		FifoCache(std::size_t vertexCount, int cacheSize) :
+			mStamps(vertexCount, 0), mClock(cacheSize + 1), mCacheSize(cacheSize)
+		{
+		}
+
+		// The number of a triangle's vertices transformed to draw it.
+		int Draw(const std::uint32_t* tri)
+		{
+			int misses = 0;
+			for(int k = 0; k < 3; ++k)
+			{
+				if(mClock - mStamps[tri[k]] > (std::uint32_t)mCacheSize)
+				{
+					mStamps[tri[k]] = mClock++;
+					++misses;
+				}
+			}
+			return misses;
+		}
+
+		void Flush() { mClock += mCacheSize + 1; }
+
+	private:
+		std::vector<std::uint32_t> mStamps;
+		std::uint32_t mClock;
+		int mCacheSize;
+	};
+}
+
+VertexCacheStats AnalyzeVertexCache(const std::uint32_t* indices, std::size_t indexCount,
+	std::size_t vertexCount, int cacheSize)
+{
+	VertexCacheStats stats;
+	if(indexCount < 3)
+		return stats;
+
+	FifoCache cache(vertexCount, cacheSize);
+	for(std::size_t i = 0; i + 2 < indexCount; i += 3)
+		stats.Transformed += cache.Draw(indices + i);
+
+	std::vector<bool> used(vertexCount, false);
+	std::size_t usedCount = 0;
+	for(std::size_t i = 0; i < indexCount; ++i)
+	{
+		if(!used[indices[i]])
+		{
+			used[indices[i]] = true;
+			++usedCount;
+		}
+	}
+
+	stats.Acmr = (float)stats.Transformed/(float)(indexCount/3);
+	stats.Atvr = (float)stats.Transformed/(float)usedCount;
+	return stats;
+}
+
+void OptimizeVertexCache(std::uint32_t* indices, std::size_t indexCount, std::size_t vertexCount)
+{
+	const std::size_t triCount = indexCount/3;
+	if(triCount == 0)
+		return;
+
+	static const ScoreTables tables;
+	Adjacency adjacency;
+	BuildAdjacency(indices, triCount*3, vertexCount, adjacency);
+
+	// Each vertex's triangles not yet emitted are the first remaining[v] of its list.
+	std::vector<std::uint32_t> remaining(vertexCount);
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	for(std::size_t v = 0; v < vertexCount; ++v)
+	{
+		remaining[v] = adjacency.Offsets[v + 1] - adjacency.Offsets[v];
+		vertexScore[v] = VertexScore(tables, -1, remaining[v]);
+	}
+
+	std::vector<float> triScore(triCount);
+	std::vector<char> emitted(triCount, 0);
+	int best = -1;
+	for(std::size_t t = 0; t < triCount; ++t)
+	{
+		const std::uint32_t* tri = indices + t*3;
+		triScore[t] = vertexScore[tri[0]] + vertexScore[tri[1]] + vertexScore[tri[2]];
+		if(best < 0 || triScore[t] > triScore[best])
+			best = (int)t;
+	}
+
+	// The cache holds the last triangle's vertices in front of the ones before them,
+	// three more than kScoreCacheSize while it is being updated.
+	int cache[kScoreCacheSize + 3];
+	int cacheCount = 0;
+
+	std::vector<std::uint32_t> output;
+	output.reserve(triCount*3);
+	std::size_t nextUnemitted = 0;
+	while(output.size() < triCount*3)
+	{
+		// When no triangle touches the cache, start over from the first left.
+		if(best < 0)
+		{
+			while(emitted[nextUnemitted])
+				++nextUnemitted;
+			best = (int)nextUnemitted;
+		}
+
+		const std::uint32_t* tri = indices + best*3;
+		output.insert(output.end(), tri, tri + 3);
+		emitted[best] = 1;
+
+		for(int k = 0; k < 3; ++k)
+		{
+			std::uint32_t v = tri[k];
+			std::uint32_t* first = &adjacency.Triangles[adjacency.Offsets[v]];
+			std::uint32_t* last = first + remaining[v] - 1;
+			std::iter_swap(std::find(first, last + 1, (std::uint32_t)best), last);
+			--remaining[v];
+		}
+
+		int newCache[kScoreCacheSize + 3];
+		int newCount = 0;
+		for(int k = 0; k < 3; ++k)
+			newCache[newCount++] = (int)tri[k];
+		for(int k = 0; k < cacheCount; ++k)
+		{
+			if(cache[k] != (int)tri[0] && cache[k] != (int)tri[1] && cache[k] != (int)tri[2])
+				newCache[newCount++] = cache[k];
+		}
+
+		// Rescore the cached vertices, including the ones just pushed out, and pass
+		// the change on to their triangles.
+		for(int k = 0; k < newCount; ++k)
+		{
+			int v = newCache[k];
+			cachePosition[v] = k < kScoreCacheSize ? k : -1;
+			float score = VertexScore(tables, cachePosition[v], remaining[v]);
+			float delta = score - vertexScore[v];
+			vertexScore[v] = score;
+
+			const std::uint32_t* adjacent = &adjacency.Triangles[adjacency.Offsets[v]];
+			for(std::uint32_t a = 0; a < remaining[v]; ++a)
+				triScore[adjacent[a]] += delta;
+		}
+
+		cacheCount = std::min<int>(newCount, kScoreCacheSize);
+		for(int k = 0; k < cacheCount; ++k)
+			cache[k] = newCache[k];
+
+		best = -1;
+		for(int k = 0; k < cacheCount; ++k)
+		{
+			int v = cache[k];
+			const std::uint32_t* adjacent = &adjacency.Triangles[adjacency.Offsets[v]];
+			for(std::uint32_t a = 0; a < remaining[v]; ++a)
+			{
+				if(best < 0 || triScore[adjacent[a]] > triScore[best])
+					best = (int)adjacent[a];
+			}
+		}
+	}
+
+	std::copy(output.begin(), output.end(), indices);
+}
+
+void OptimizeOverdraw(std::uint32_t* indices, std::size_t indexCount,
+	const XMFLOAT3* positions, std::size_t stride, std::size_t vertexCount, float threshold)
+{
+	const std::size_t triCount = indexCount/3;
+	if(triCount == 0)
+		return;
+
+	auto position = [&](std::uint32_t v)
+	{
+		return XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(reinterpret_cast<const char*>(positions) + v*stride));
+	};
+
+	// The order is first cut where the cache starts over anyway, at triangles whose
+	// three vertices are all transformed; moving those runs around costs nothing.
+	std::vector<std::uint32_t> hardStarts;
+	{
+		FifoCache cache(vertexCount, 16);
+		for(std::size_t t = 0; t < triCount; ++t)
+		{
+			if(cache.Draw(indices + t*3) == 3)
+				hardStarts.push_back((std::uint32_t)t);
+		}
+	}
+	if(hardStarts.empty() || hardStarts[0] != 0)
+		hardStarts.insert(hardStarts.begin(), 0);
+	hardStarts.push_back((std::uint32_t)triCount);
+
+	// Then each run is cut again wherever the part of it so far transforms no more
+	// than threshold times the vertices per triangle the whole run does, counting
+	// the part from an empty cache, as it will be drawn after the reordering.
+	std::vector<std::uint32_t> clusterStarts;
+	for(std::size_t h = 0; h + 1 < hardStarts.size(); ++h)
+	{
+		std::uint32_t start = hardStarts[h];
+		std::uint32_t end = hardStarts[h + 1];
+
+		FifoCache cache(vertexCount, 16);
+		std::uint32_t runMisses = 0;
+		for(std::uint32_t t = start; t < end; ++t)
+			runMisses += cache.Draw(indices + t*3);
+		float limit = threshold*(float)runMisses/(float)(end - start);
+
+		cache.Flush();
+		clusterStarts.push_back(start);
+		std::uint32_t misses = 0;
+		std::uint32_t size = 0;
+		for(std::uint32_t t = start; t < end; ++t)
+		{
+			misses += cache.Draw(indices + t*3);
+			++size;
+			if(t + 1 < end && (float)misses <= limit*(float)size)
+			{
+				clusterStarts.push_back(t + 1);
+				cache.Flush();
+				misses = 0;
+				size = 0;
+			}
+		}
+	}
+	clusterStarts.push_back((std::uint32_t)triCount);
+	const std::size_t clusterCount = clusterStarts.size() - 1;
+	if(clusterCount < 2)
+		return;
+
+	// Each run's area-weighted centroid and normal, and the mesh's centroid.
+	std::vector<XMFLOAT3> clusterCentroids(clusterCount);
+	std::vector<XMFLOAT3> clusterNormals(clusterCount);
+	XMVECTOR meshCentroid = XMVectorZero();
+	float meshArea = 0.0f;
+	for(std::size_t c = 0; c < clusterCount; ++c)
+	{
+		XMVECTOR centroid = XMVectorZero();
+		XMVECTOR normal = XMVectorZero();
+		float area = 0.0f;
+		for(std::uint32_t t = clusterStarts[c]; t < clusterStarts[c + 1]; ++t)
+		{
+			XMVECTOR p0 = position(indices[t*3 + 0]);
+			XMVECTOR p1 = position(indices[t*3 + 1]);
+			XMVECTOR p2 = position(indices[t*3 + 2]);
+			XMVECTOR n = XMVector3Cross(p1 - p0, p2 - p0);
+			float a = XMVectorGetX(XMVector3Length(n));
+
+			centroid += (a/3.0f)*(p0 + p1 + p2);
+			normal += n;
+			area += a;
+		}
+
+		meshCentroid += centroid;
+		meshArea += area;
+		XMStoreFloat3(&clusterCentroids[c], area > 0.0f ? centroid/area : position(indices[clusterStarts[c]*3]));
+		XMStoreFloat3(&clusterNormals[c], normal);
+	}
+	if(meshArea > 0.0f)
+		meshCentroid /= meshArea;
+
+	// The further a run faces out from the middle of the mesh, the more of the mesh
+	// it tends to hide, so those runs go first.
+	std::vector<float> keys(clusterCount);
+	std::vector<std::uint32_t> order(clusterCount);
+	for(std::size_t c = 0; c < clusterCount; ++c)
+	{
+		XMVECTOR n = XMLoadFloat3(&clusterNormals[c]);
+		float length = XMVectorGetX(XMVector3Length(n));
+		XMVECTOR d = XMLoadFloat3(&clusterCentroids[c]) - meshCentroid;
+		keys[c] = length > 0.0f ? XMVectorGetX(XMVector3Dot(d, n))/length : 0.0f;
+		order[c] = (std::uint32_t)c;
+	}
+	std::stable_sort(order.begin(), order.end(),
+		[&](std::uint32_t a, std::uint32_t b) { return keys[a] > keys[b]; });
+
+	std::vector<std::uint32_t> output;
+	output.reserve(triCount*3);
+	for(std::uint32_t c : order)
+		output.insert(output.end(), indices + clusterStarts[c]*3, indices + clusterStarts[c + 1]*3);
+	std::copy(output.begin(), output.end(), indices);
+}
+
+void OptimizeVertexFetch(GeometryGenerator::MeshData& mesh)
+{
+	const std::uint32_t unassigned = 0xffffffff;
+	std::vector<std::uint32_t> remap(mesh.Vertices.size(), unassigned);
+	std::uint32_t next = 0;
+	for(std::uint32_t& index : mesh.Indices32)
+	{
+		if(remap[index] == unassigned)
+			remap[index] = next++;
+		index = remap[index];
+	}
+	for(std::uint32_t& r : remap)
+	{
+		if(r == unassigned)
+			r = next++;
+	}
+
+	std::vector<GeometryGenerator::Vertex> vertices(mesh.Vertices.size());
+	for(std::size_t v = 0; v < mesh.Vertices.size(); ++v)
+		vertices[remap[v]] = mesh.Vertices[v];
+	mesh.Vertices.swap(vertices);
+}
+
+void OptimizeMesh(GeometryGenerator::MeshData& mesh, bool reduceOverdraw)
+{
+	if(mesh.Indices32.size() < 3)
+		return;
+
+	OptimizeVertexCache(mesh.Indices32.data(), mesh.Indices32.size(), mesh.Vertices.size());
+	if(reduceOverdraw)
+	{
+		OptimizeOverdraw(mesh.Indices32.data(), mesh.Indices32.size(), &mesh.Vertices[0].Position,
+			sizeof(GeometryGenerator::Vertex), mesh.Vertices.size());
+	}
+	OptimizeVertexFetch(mesh);
+}
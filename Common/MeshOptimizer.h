@@ -0,0 +1,59 @@
+//***************************************************************************************
+// MeshOptimizer.h
+//
+// Reorders the triangles and vertices of indexed triangle lists for the GPU:
+//
+//   OptimizeVertexCache  orders the triangles so that vertices are reused while they
+//                        are still in the post-transform cache (Forsyth, "Linear-Speed
+//                        Vertex Cache Optimisation").
+//   OptimizeOverdraw     then moves whole runs of that order around so that the
+//                        outward-facing parts of the mesh tend to be drawn first,
+//                        without breaking up the runs (Sander, Nehab and Barczak, "Fast
+//                        Triangle Reordering for Vertex Locality and Reduced Overdraw").
+//   OptimizeVertexFetch  renumbers the vertices in the order the triangles first use
+//                        them, so the vertex fetches walk through memory.
+//
+// AnalyzeVertexCache measures the result on a FIFO cache: the average number of
+// vertices transformed per triangle (ACMR; 0.5 at best for a large closed mesh, 3 at
+// worst) and per vertex (ATVR; 1 at best).
+//
+// Only the index order changes the image: the triangles keep their winding.
+//***************************************************************************************
+
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include "GeometryGenerator.h"
+#include <cstddef>
+#include <cstdint>
+
+struct VertexCacheStats
+{
+	std::uint32_t Transformed = 0;
+	float Acmr = 0.0f;
+	float Atvr = 0.0f;
+};
+
+// Simulates a FIFO post-transform cache of cacheSize vertices over the triangles.
+// Vertices no triangle uses are left out of the ATVR.
+VertexCacheStats AnalyzeVertexCache(const std::uint32_t* indices, std::size_t indexCount,
+	std::size_t vertexCount, int cacheSize = 16);
+
+// Reorders the triangles of indices, which refer to vertexCount vertices.
+void OptimizeVertexCache(std::uint32_t* indices, std::size_t indexCount, std::size_t vertexCount);
+
+// Reorders the runs of triangles OptimizeVertexCache produced, outward-facing first.
+// The positions are read stride bytes apart.  The runs are cut finer the more the
+// ACMR is allowed to grow: by up to threshold times, less the gains from the new order.
+void OptimizeOverdraw(std::uint32_t* indices, std::size_t indexCount,
+	const DirectX::XMFLOAT3* positions, std::size_t stride, std::size_t vertexCount,
+	float threshold = 1.05f);
+
+// Renumbers mesh's vertices in the order its triangles first use them.  Vertices no
+// triangle uses go last.
+void OptimizeVertexFetch(GeometryGenerator::MeshData& mesh);
+
+// All three on a generated mesh, whose GetIndices16 must not have been called yet.
+void OptimizeMesh(GeometryGenerator::MeshData& mesh, bool reduceOverdraw = true);
+
+#endif // MESHOPTIMIZER_H
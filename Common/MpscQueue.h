@@ -0,0 +1,106 @@
+//***************************************************************************************
+// MpscQueue.h
+//
+// Bounded lock-free queue for many producer threads and a single consumer thread
+// (Dmitry Vyukov's bounded queue).  Each cell carries a sequence number that tells a
+// producer whether the cell is free and tells the consumer whether it has been
+// written, so neither side ever takes a lock.
+//***************************************************************************************
+
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+template<typename T>
+class MpscQueue
+{
+public:
+	// The capacity is rounded up to a power of two.
+	explicit MpscQueue(std::size_t capacity)
+	{
+		std::size_t size = 2;
+		while(size < capacity)
+			size *= 2;
+
+		mCells = std::make_unique<Cell[]>(size);
+		mMask = size - 1;
+		for(std::size_t i = 0; i < size; ++i)
+			mCells[i].Sequence.store(i, std::memory_order_relaxed);
+
+		mEnqueuePos.store(0, std::memory_order_relaxed);
+	}
+
+	MpscQueue(const MpscQueue& rhs) = delete;
+	MpscQueue& operator=(const MpscQueue& rhs) = delete;
+
+	std::size_t Capacity()const { return mMask + 1; }
+
+	// May be called from any thread.  Returns false if the queue is full.
+	bool TryPush(const T& item)
+	{
+		std::size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+		Cell* cell = nullptr;
+		for(;;)
+		{
+			cell = &mCells[pos & mMask];
+			std::size_t seq = cell->Sequence.load(std::memory_order_acquire);
+			std::ptrdiff_t dif = (std::ptrdiff_t)seq - (std::ptrdiff_t)pos;
+			if(dif == 0)
+			{
+				// The cell is free; claim it.
+				if(mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if(dif < 0)
+			{
+				// The consumer has not freed this cell yet.
+				return false;
+			}
+			else
+			{
+				// Another producer claimed it first.
+				pos = mEnqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		cell->Data = item;
+		cell->Sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Must only be called from the consumer thread.  Returns false if the queue is
+	// empty, or if the next item has been claimed but not yet written.
+	bool TryPop(T& item)
+	{
+		Cell* cell = &mCells[mDequeuePos & mMask];
+		std::size_t seq = cell->Sequence.load(std::memory_order_acquire);
+		if((std::ptrdiff_t)seq - (std::ptrdiff_t)(mDequeuePos + 1) < 0)
+			return false;
+
+		item = cell->Data;
+		cell->Sequence.store(mDequeuePos + mMask + 1, std::memory_order_release);
+		++mDequeuePos;
+		return true;
+	}
+
+private:
+	struct Cell
+	{
+		std::atomic<std::size_t> Sequence;
+		T Data;
+	};
+
+	std::unique_ptr<Cell[]> mCells;
+	std::size_t mMask = 0;
+
+	// Keep the producers' counter and the consumer's counter on separate cache lines.
+	char mPad0[64];
+	std::atomic<std::size_t> mEnqueuePos;
+	char mPad1[64];
+	std::size_t mDequeuePos = 0;
+};
+
+#endif // MPSCQUEUE_H
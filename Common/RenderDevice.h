@@ -0,0 +1,73 @@
+//***************************************************************************************
+// RenderDevice.h
+//
+// The small part of the graphics device that the per-frame CPU work needs: persistently
+// mapped upload memory, the frame fence, and a command allocator per frame resource.
+// UploadBuffer, UploadRing and FrameResource only use the device through this interface,
+// so the same code runs on D3D12 (D3D12RenderDevice) and, headless, in plain host memory
+// (HostRenderDevice).  This header, and everything the headless tools (WavesBench,
+// SceneCompiler, MeshStats) build from Common and i4CastleApp, includes no D3D or
+// Windows header.
+//***************************************************************************************
+
+#ifndef RENDERDEVICE_H
+#define RENDERDEVICE_H
+
+#include <cstdint>
+#include <memory>
+
+// One buffer in upload memory, mapped for its whole lifetime.  The GPU reads it at
+// GpuAddress(); the CPU writes it through MappedData().  As with any upload heap, the
+// CPU must not write what the GPU may still be reading; use the device's fence.
+class GpuUploadBuffer
+{
+public:
+	virtual ~GpuUploadBuffer() = default;
+
+	virtual std::uint8_t* MappedData() = 0;
+	virtual std::uint64_t GpuAddress()const = 0;
+	virtual std::uint64_t ByteSize()const = 0;
+};
+
+// The memory command lists are recorded into.  It may only be reset once the GPU has
+// finished the commands recorded into it.
+class GpuCommandAllocator
+{
+public:
+	virtual ~GpuCommandAllocator() = default;
+
+	virtual void Reset() = 0;
+};
+
+class RenderDevice
+{
+public:
+	// Constant buffer data must start on, and be viewed in multiples of, 256 bytes.
+	static const std::uint64_t ConstantBufferAlignment = 256;
+
+	// Buffers are placed in memory at this granularity.
+	static const std::uint64_t BufferPlacementAlignment = 65536;
+
+	// Rounds byteSize up to a whole number of constant buffer slots.
+	static std::uint32_t CalcConstantBufferByteSize(std::uint32_t byteSize)
+	{
+		return (byteSize + (std::uint32_t)ConstantBufferAlignment - 1) & ~((std::uint32_t)ConstantBufferAlignment - 1);
+	}
+
+	virtual ~RenderDevice() = default;
+
+	// A mapped upload buffer of byteSize bytes.  Its GPU address is placement aligned.
+	virtual std::unique_ptr<GpuUploadBuffer> CreateUploadBuffer(std::uint64_t byteSize) = 0;
+
+	virtual std::unique_ptr<GpuCommandAllocator> CreateCommandAllocator() = 0;
+
+	// The frame fence: the last value the GPU has passed, and a blocking wait for the
+	// GPU to pass the given value.
+	virtual std::uint64_t CompletedFenceValue() = 0;
+	virtual void WaitForFence(std::uint64_t fenceValue) = 0;
+
+	// Queues a fence signal behind the work submitted so far.
+	virtual void Signal(std::uint64_t fenceValue) = 0;
+};
+
+#endif // RENDERDEVICE_H
@@ -0,0 +1,224 @@
+//***************************************************************************************
+// SceneFile.cpp
+//***************************************************************************************
+
+#include "SceneFile.h"
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(SceneFileHeader) == 64, "SceneFileHeader is part of the file format");
+static_assert(sizeof(SceneFileObject) == 144, "SceneFileObject is part of the file format");
+
+SceneFile::SceneFile(const std::string& filename)
+{
+	Map(filename);
+	try
+	{
+		Validate(filename);
+	}
+	catch(...)
+	{
+		Unmap();
+		throw;
+	}
+}
+
+SceneFile::~SceneFile()
+{
+	Unmap();
+}
+
+const char* SceneFile::Name(std::uint32_t tableOffset, int index)const
+{
+	const std::uint32_t* table = reinterpret_cast<const std::uint32_t*>(mData + tableOffset);
+	return reinterpret_cast<const char*>(mData + Header().NamesOffset + table[index]);
+}
+
+#ifdef _WIN32
+
+void SceneFile::Map(const std::string& filename)
+{
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(file == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("cannot open scene file " + filename);
+	mFile = file;
+
+	LARGE_INTEGER size;
+	HANDLE mapping = nullptr;
+	if(GetFileSizeEx(file, &size) && size.QuadPart > 0)
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if(mapping != nullptr)
+	{
+		mMapping = mapping;
+		mData = static_cast<const std::uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		mSize = (std::uint64_t)size.QuadPart;
+	}
+
+	if(mData == nullptr)
+	{
+		Unmap();
+		throw std::runtime_error("cannot map scene file " + filename);
+	}
+}
+
+void SceneFile::Unmap()
+{
+	if(mData != nullptr)
+		UnmapViewOfFile(mData);
+	if(mMapping != nullptr)
+		CloseHandle(mMapping);
+	if(mFile != nullptr)
+		CloseHandle(mFile);
+	mData = nullptr;
+	mMapping = nullptr;
+	mFile = nullptr;
+}
+
+#else
+
+void SceneFile::Map(const std::string& filename)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if(fd < 0)
+		throw std::runtime_error("cannot open scene file " + filename);
+
+	// The mapping keeps the file open by itself.
+	struct stat st;
+	void* data = MAP_FAILED;
+	if(fstat(fd, &st) == 0 && st.st_size > 0)
+		data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if(data == MAP_FAILED)
+		throw std::runtime_error("cannot map scene file " + filename);
+	mData = static_cast<const std::uint8_t*>(data);
+	mSize = (std::uint64_t)st.st_size;
+}
+
+void SceneFile::Unmap()
+{
+	if(mData != nullptr)
+		munmap(const_cast<std::uint8_t*>(mData), (size_t)mSize);
+	mData = nullptr;
+}
+
+#endif
+
+void SceneFile::Validate(const std::string& filename)const
+{
+	auto fail = [&](const char* what)
+	{
+		throw std::runtime_error("bad scene file " + filename + ": " + what);
+	};
+
+	if(mSize < sizeof(SceneFileHeader))
+		fail("too small");
+	const SceneFileHeader& h = Header();
+	if(h.Magic != SceneFileHeader::MagicValue)
+		fail("not a scene file");
+	if(h.Version != SceneFileHeader::CurrentVersion)
+		fail("unsupported version");
+	if(h.FileSize != mSize)
+		fail("truncated");
+
+	// Every section lies inside the file on a 16-byte boundary.  The counts are
+	// checked against the file size first, so the products cannot overflow.
+	auto checkSection = [&](std::uint32_t offset, std::uint64_t count, std::uint64_t elementSize)
+	{
+		if(offset % 16 != 0 || offset < sizeof(SceneFileHeader) || count > mSize ||
+			offset + count*elementSize > mSize)
+		{
+			fail("section out of range");
+		}
+	};
+	checkSection(h.NamesOffset, h.NamesSize, 1);
+	checkSection(h.MeshesOffset, h.MeshCount, sizeof(std::uint32_t));
+	checkSection(h.MaterialsOffset, h.MaterialCount, sizeof(std::uint32_t));
+	checkSection(h.LayersOffset, h.LayerCount, sizeof(std::uint32_t));
+	checkSection(h.ObjectsOffset, h.ObjectCount, sizeof(SceneFileObject));
+
+	// Since the names end with a NUL, every name starting inside them ends inside them.
+	if(h.NamesSize == 0 || mData[h.NamesOffset + h.NamesSize - 1] != '\0')
+		fail("names not terminated");
+	auto checkNames = [&](std::uint32_t tableOffset, std::uint32_t count)
+	{
+		const std::uint32_t* table = reinterpret_cast<const std::uint32_t*>(mData + tableOffset);
+		for(std::uint32_t i = 0; i < count; ++i)
+		{
+			if(table[i] >= h.NamesSize)
+				fail("name out of range");
+		}
+	};
+	checkNames(h.MeshesOffset, h.MeshCount);
+	checkNames(h.MaterialsOffset, h.MaterialCount);
+	checkNames(h.LayersOffset, h.LayerCount);
+
+	const SceneFileObject* objects = Objects();
+	for(std::uint32_t i = 0; i < h.ObjectCount; ++i)
+	{
+		if(objects[i].Mesh >= h.MeshCount || objects[i].Material >= h.MaterialCount ||
+			objects[i].Layer >= h.LayerCount)
+		{
+			fail("object refers to a missing mesh, material or layer");
+		}
+	}
+}
+
+std::vector<std::uint8_t> SceneFile::Build(const std::vector<std::string>& meshes,
+	const std::vector<std::string>& materials, const std::vector<std::string>& layers,
+	const std::vector<SceneFileObject>& objects)
+{
+	auto align = [](std::uint32_t offset) { return (offset + 15) & ~15u; };
+
+	// All the names, and each one's offset, table by table.
+	std::string names;
+	std::vector<std::uint32_t> nameOffsets[3];
+	const std::vector<std::string>* tables[3] = { &meshes, &materials, &layers };
+	for(int t = 0; t < 3; ++t)
+	{
+		for(const std::string& name : *tables[t])
+		{
+			nameOffsets[t].push_back((std::uint32_t)names.size());
+			names.append(name.c_str(), name.size() + 1);
+		}
+	}
+	if(names.empty())
+		names.push_back('\0');
+
+	SceneFileHeader h;
+	h.NamesOffset = sizeof(SceneFileHeader);
+	h.NamesSize = (std::uint32_t)names.size();
+	h.MeshesOffset = align(h.NamesOffset + h.NamesSize);
+	h.MeshCount = (std::uint32_t)meshes.size();
+	h.MaterialsOffset = align(h.MeshesOffset + h.MeshCount*sizeof(std::uint32_t));
+	h.MaterialCount = (std::uint32_t)materials.size();
+	h.LayersOffset = align(h.MaterialsOffset + h.MaterialCount*sizeof(std::uint32_t));
+	h.LayerCount = (std::uint32_t)layers.size();
+	h.ObjectsOffset = align(h.LayersOffset + h.LayerCount*sizeof(std::uint32_t));
+	h.ObjectCount = (std::uint32_t)objects.size();
+	h.FileSize = h.ObjectsOffset + h.ObjectCount*(std::uint32_t)sizeof(SceneFileObject);
+
+	std::vector<std::uint8_t> file(h.FileSize, 0);
+	std::memcpy(&file[0], &h, sizeof(h));
+	std::memcpy(&file[h.NamesOffset], names.data(), names.size());
+	std::uint32_t tableOffsets[3] = { h.MeshesOffset, h.MaterialsOffset, h.LayersOffset };
+	for(int t = 0; t < 3; ++t)
+	{
+		if(!nameOffsets[t].empty())
+			std::memcpy(&file[tableOffsets[t]], nameOffsets[t].data(), nameOffsets[t].size()*sizeof(std::uint32_t));
+	}
+	if(!objects.empty())
+		std::memcpy(&file[h.ObjectsOffset], objects.data(), objects.size()*sizeof(SceneFileObject));
+
+	return file;
+}
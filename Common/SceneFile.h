@@ -0,0 +1,112 @@
+//***************************************************************************************
+// SceneFile.h
+//
+// A compiled scene: the objects to draw, each a mesh, a material and a layer referred
+// to by name, with its world and texture transforms.  The file is written offline by
+// SceneCompiler from a text description and read here by mapping it into memory; the
+// records are used in place, so loading costs a few range checks and no parsing.
+//
+// Layout, little endian, every section starting on a 16-byte boundary:
+//
+//   SceneFileHeader
+//   names       NUL-terminated strings, one after the other
+//   meshes      std::uint32_t offset into names, per mesh
+//   materials   std::uint32_t offset into names, per material
+//   layers      std::uint32_t offset into names, per layer
+//   objects     SceneFileObject, per object
+//
+// What the names mean is up to the application: SceneCompiler only checks that every
+// object refers to a mesh, a material and a layer listed in the file.
+//***************************************************************************************
+
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include <DirectXMath.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct SceneFileHeader
+{
+	static const std::uint32_t MagicValue = 0x4e435353; // "SSCN"
+	static const std::uint32_t CurrentVersion = 1;
+
+	std::uint32_t Magic = MagicValue;
+	std::uint32_t Version = CurrentVersion;
+	std::uint32_t FileSize = 0;
+	std::uint32_t NamesOffset = 0;
+	std::uint32_t NamesSize = 0;
+	std::uint32_t MeshesOffset = 0;
+	std::uint32_t MeshCount = 0;
+	std::uint32_t MaterialsOffset = 0;
+	std::uint32_t MaterialCount = 0;
+	std::uint32_t LayersOffset = 0;
+	std::uint32_t LayerCount = 0;
+	std::uint32_t ObjectsOffset = 0;
+	std::uint32_t ObjectCount = 0;
+	std::uint32_t Pad0 = 0;
+	std::uint32_t Pad1 = 0;
+	std::uint32_t Pad2 = 0;
+};
+
+struct SceneFileObject
+{
+	DirectX::XMFLOAT4X4 World;
+	DirectX::XMFLOAT4X4 TexTransform;
+
+	// Indices into the file's meshes, materials and layers.
+	std::uint32_t Mesh = 0;
+	std::uint32_t Material = 0;
+	std::uint32_t Layer = 0;
+	std::uint32_t Pad0 = 0;
+};
+
+class SceneFile
+{
+public:
+	// Maps the file and checks that it is a scene this code can read.  Throws
+	// std::runtime_error if it cannot be opened or is not one.
+	explicit SceneFile(const std::string& filename);
+	SceneFile(const SceneFile& rhs) = delete;
+	SceneFile& operator=(const SceneFile& rhs) = delete;
+	~SceneFile();
+
+	int MeshCount()const { return (int)Header().MeshCount; }
+	int MaterialCount()const { return (int)Header().MaterialCount; }
+	int LayerCount()const { return (int)Header().LayerCount; }
+	int ObjectCount()const { return (int)Header().ObjectCount; }
+
+	const char* MeshName(int mesh)const { return Name(Header().MeshesOffset, mesh); }
+	const char* MaterialName(int material)const { return Name(Header().MaterialsOffset, material); }
+	const char* LayerName(int layer)const { return Name(Header().LayersOffset, layer); }
+
+	// The objects, in the order they were described in.
+	const SceneFileObject* Objects()const
+	{
+		return reinterpret_cast<const SceneFileObject*>(mData + Header().ObjectsOffset);
+	}
+
+	// Lays out a scene file's contents; SceneCompiler writes the result to disk.
+	static std::vector<std::uint8_t> Build(const std::vector<std::string>& meshes,
+		const std::vector<std::string>& materials, const std::vector<std::string>& layers,
+		const std::vector<SceneFileObject>& objects);
+
+private:
+	const SceneFileHeader& Header()const { return *reinterpret_cast<const SceneFileHeader*>(mData); }
+	const char* Name(std::uint32_t tableOffset, int index)const;
+
+	void Map(const std::string& filename);
+	void Unmap();
+	void Validate(const std::string& filename)const;
+
+private:
+	const std::uint8_t* mData = nullptr;
+	std::uint64_t mSize = 0;
+
+	// The file and file mapping handles on Windows; unused elsewhere.
+	void* mFile = nullptr;
+	void* mMapping = nullptr;
+};
+
+#endif // SCENEFILE_H
@@ -0,0 +1,199 @@
+//***************************************************************************************
+// TaskScheduler.cpp
+//***************************************************************************************
+
+#include "TaskScheduler.h"
+#include <algorithm>
+#include <cassert>
+
+#if defined(_MSC_VER)
+#include <ppl.h>
+#endif
+
+namespace
+{
+	// Lets a thread find its own deque when it enters ParallelFor from inside a task.
+	thread_local const void* tPool = nullptr;
+	thread_local int tWorkerIndex = -1;
+}
+
+TaskScheduler& TaskScheduler::Default()
+{
+	static ThreadPoolScheduler scheduler;
+	return scheduler;
+}
+
+ThreadPoolScheduler::ThreadPoolScheduler(int threadCount)
+	: mQueuedTasks(0), mNextQueue(0)
+{
+	if(threadCount <= 0)
+		threadCount = (int)std::max<unsigned>(1u, std::thread::hardware_concurrency());
+
+	int workerCount = threadCount - 1;
+	for(int i = 0; i < workerCount; ++i)
+		mQueues.push_back(std::make_unique<WorkQueue>());
+
+	for(int i = 0; i < workerCount; ++i)
+		mWorkers.emplace_back(&ThreadPoolScheduler::WorkerMain, this, i);
+}
+
+ThreadPoolScheduler::~ThreadPoolScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+		mStop = true;
+	}
+	mWake.notify_all();
+
+	for(auto& w : mWorkers)
+		w.join();
+}
+
+int ThreadPoolScheduler::ThreadCount()const
+{
+	return (int)mWorkers.size() + 1;
+}
+
+void ThreadPoolScheduler::ParallelFor(int begin, int end, int grain, const RangeFn& body)
+{
+	if(begin >= end)
+		return;
+
+	grain = std::max<int>(1, grain);
+	int chunkCount = (end - begin + grain - 1) / grain;
+
+	// Nothing to share; avoid the queue traffic.
+	if(chunkCount == 1 || mWorkers.empty())
+	{
+		for(int first = begin; first < end; first += grain)
+			body(first, std::min<int>(first + grain, end));
+		return;
+	}
+
+	Job job;
+	job.Body = &body;
+	job.Pending = chunkCount;
+
+	// A worker keeps nested work in its own deque so it stays cache-warm; any other
+	// thread deals the chunks out round-robin.
+	int self = (tPool == this) ? tWorkerIndex : -1;
+	mQueuedTasks += chunkCount;
+	for(int first = begin; first < end; first += grain)
+	{
+		Task task;
+		task.Owner = &job;
+		task.First = first;
+		task.Last = std::min<int>(first + grain, end);
+
+		int q = (self >= 0) ? self : (int)(mNextQueue++ % mQueues.size());
+		std::lock_guard<std::mutex> lock(mQueues[q]->Mutex);
+		mQueues[q]->Tasks.push_back(task);
+	}
+
+	{
+		// Take the lock so a worker between its predicate check and its wait
+		// cannot miss the notification.
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+	}
+	mWake.notify_all();
+
+	// The calling thread helps until its own job is done.  It may run chunks that
+	// belong to other jobs; that is fine since they would have to run anyway.
+	while(job.Pending.load(std::memory_order_acquire) > 0)
+	{
+		Task task;
+		if((self >= 0 && TryPop(self, task)) || TrySteal(self, task))
+			Run(task);
+		else
+			std::this_thread::yield();
+	}
+}
+
+void ThreadPoolScheduler::WorkerMain(int index)
+{
+	tPool = this;
+	tWorkerIndex = index;
+
+	for(;;)
+	{
+		Task task;
+		if(TryPop(index, task) || TrySteal(index, task))
+		{
+			Run(task);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mSleepMutex);
+		mWake.wait(lock, [this]() { return mStop || mQueuedTasks.load() > 0; });
+		if(mStop)
+			return;
+	}
+}
+
+bool ThreadPoolScheduler::TryPop(int index, Task& task)
+{
+	WorkQueue& q = *mQueues[index];
+	std::lock_guard<std::mutex> lock(q.Mutex);
+	if(q.Tasks.empty())
+		return false;
+
+	task = q.Tasks.back();
+	q.Tasks.pop_back();
+	--mQueuedTasks;
+	return true;
+}
+
+bool ThreadPoolScheduler::TrySteal(int thief, Task& task)
+{
+	int count = (int)mQueues.size();
+	int start = (thief >= 0) ? thief + 1 : 0;
+	for(int k = 0; k < count; ++k)
+	{
+		int victim = (start + k) % count;
+		if(victim == thief)
+			continue;
+
+		WorkQueue& q = *mQueues[victim];
+		std::lock_guard<std::mutex> lock(q.Mutex);
+		if(q.Tasks.empty())
+			continue;
+
+		task = q.Tasks.front();
+		q.Tasks.pop_front();
+		--mQueuedTasks;
+		return true;
+	}
+
+	return false;
+}
+
+void ThreadPoolScheduler::Run(const Task& task)
+{
+	Job* job = task.Owner;
+	(*job->Body)(task.First, task.Last);
+
+	// This must be the last access to the job; the owner may return as soon as
+	// the count reaches zero.
+	job->Pending.fetch_sub(1, std::memory_order_release);
+}
+
+#if defined(_MSC_VER)
+int PplScheduler::ThreadCount()const
+{
+	return (int)concurrency::GetProcessorCount();
+}
+
+void PplScheduler::ParallelFor(int begin, int end, int grain, const RangeFn& body)
+{
+	if(begin >= end)
+		return;
+
+	grain = std::max<int>(1, grain);
+	int chunkCount = (end - begin + grain - 1) / grain;
+	concurrency::parallel_for(0, chunkCount, [&](int c)
+	{
+		int first = begin + c*grain;
+		body(first, std::min<int>(first + grain, end));
+	});
+}
+#endif
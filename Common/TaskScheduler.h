@@ -0,0 +1,101 @@
+//***************************************************************************************
+// TaskScheduler.h
+//
+// Minimal interface for running data-parallel loops.  ThreadPoolScheduler is a portable
+// work-stealing pool built on std::thread; PplScheduler forwards to the Microsoft
+// Parallel Patterns Library when it is available.
+//***************************************************************************************
+
+#ifndef TASKSCHEDULER_H
+#define TASKSCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskScheduler
+{
+public:
+	using RangeFn = std::function<void(int first, int last)>;
+
+	virtual ~TaskScheduler() = default;
+
+	// Number of threads that execute work, counting the calling thread.
+	virtual int ThreadCount()const = 0;
+
+	// Splits [begin, end) into chunks of at most grain elements and calls body(first, last)
+	// for each chunk, possibly concurrently.  Returns once every chunk has finished.
+	// Calls may be nested from inside body.
+	virtual void ParallelFor(int begin, int end, int grain, const RangeFn& body) = 0;
+
+	// The scheduler shared by the application.  Created on first use with one
+	// thread per hardware thread.
+	static TaskScheduler& Default();
+};
+
+class ThreadPoolScheduler : public TaskScheduler
+{
+public:
+	// threadCount includes the calling thread, so threadCount - 1 workers are started.
+	// A count of 0 uses one thread per hardware thread.
+	explicit ThreadPoolScheduler(int threadCount = 0);
+	ThreadPoolScheduler(const ThreadPoolScheduler& rhs) = delete;
+	ThreadPoolScheduler& operator=(const ThreadPoolScheduler& rhs) = delete;
+	~ThreadPoolScheduler();
+
+	virtual int ThreadCount()const override;
+	virtual void ParallelFor(int begin, int end, int grain, const RangeFn& body) override;
+
+private:
+	struct Job
+	{
+		const RangeFn* Body = nullptr;
+		std::atomic<int> Pending;
+	};
+
+	struct Task
+	{
+		Job* Owner = nullptr;
+		int First = 0;
+		int Last = 0;
+	};
+
+	// Each worker owns a deque.  The owner pushes and pops at the back; idle threads
+	// steal from the front of other deques.
+	struct WorkQueue
+	{
+		std::mutex Mutex;
+		std::deque<Task> Tasks;
+	};
+
+	void WorkerMain(int index);
+	bool TryPop(int index, Task& task);
+	bool TrySteal(int thief, Task& task);
+	void Run(const Task& task);
+
+private:
+	std::vector<std::unique_ptr<WorkQueue>> mQueues;
+	std::vector<std::thread> mWorkers;
+
+	std::mutex mSleepMutex;
+	std::condition_variable mWake;
+	std::atomic<int> mQueuedTasks;
+	std::atomic<unsigned> mNextQueue;
+	bool mStop = false;
+};
+
+#if defined(_MSC_VER)
+class PplScheduler : public TaskScheduler
+{
+public:
+	virtual int ThreadCount()const override;
+	virtual void ParallelFor(int begin, int end, int grain, const RangeFn& body) override;
+};
+#endif
+
+#endif // TASKSCHEDULER_H
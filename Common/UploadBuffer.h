@@ -1,12 +1,15 @@
 #pragma once
 
-#include "d3dUtil.h"
+#include "RenderDevice.h"
+#include <cassert>
+#include <cstring>
 
+// Upload memory for elementCount elements of type T, created on any RenderDevice.
 template<typename T>
 class UploadBuffer
 {
 public:
-    UploadBuffer(ID3D12Device* device, UINT elementCount, bool isConstantBuffer) : 
+    UploadBuffer(RenderDevice& device, std::uint32_t elementCount, bool isConstantBuffer) : 
         mIsConstantBuffer(isConstantBuffer)
     {
         mElementByteSize = sizeof(T);
@@ -19,46 +22,55 @@ public:
         // UINT   SizeInBytes;   // multiple of 256
         // } D3D12_CONSTANT_BUFFER_VIEW_DESC;
         if(isConstantBuffer)
-            mElementByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(T));
+            mElementByteSize = RenderDevice::CalcConstantBufferByteSize(sizeof(T));
 
-        ThrowIfFailed(device->CreateCommittedResource(
-            &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
-            D3D12_HEAP_FLAG_NONE,
-            &CD3DX12_RESOURCE_DESC::Buffer(mElementByteSize*elementCount),
-			D3D12_RESOURCE_STATE_GENERIC_READ,
-            nullptr,
-            IID_PPV_ARGS(&mUploadBuffer)));
-
-        ThrowIfFailed(mUploadBuffer->Map(0, nullptr, reinterpret_cast<void**>(&mMappedData)));
-
-        // We do not need to unmap until we are done with the resource.  However, we must not write to
-        // the resource while it is in use by the GPU (so we must use synchronization techniques).
+        // The buffer stays mapped until it is destroyed.  However, we must not write to
+        // it while it is in use by the GPU (so we must use synchronization techniques).
+        mUploadBuffer = device.CreateUploadBuffer((std::uint64_t)mElementByteSize*elementCount);
+        mMappedData = mUploadBuffer->MappedData();
     }
 
     UploadBuffer(const UploadBuffer& rhs) = delete;
     UploadBuffer& operator=(const UploadBuffer& rhs) = delete;
-    ~UploadBuffer()
+    ~UploadBuffer() = default;
+
+    // Address of the first element, for views and root descriptors.
+    std::uint64_t GpuAddress()const
     {
-        if(mUploadBuffer != nullptr)
-            mUploadBuffer->Unmap(0, nullptr);
+        return mUploadBuffer->GpuAddress();
+    }
 
-        mMappedData = nullptr;
+    void CopyData(int elementIndex, const T& data)
+    {
+        memcpy(&mMappedData[elementIndex*mElementByteSize], &data, sizeof(T));
     }
 
-    ID3D12Resource* Resource()const
+    // Copies count consecutive elements starting at elementIndex.
+    void CopyData(int elementIndex, const T* data, int count)
     {
-        return mUploadBuffer.Get();
+        if(mElementByteSize == sizeof(T))
+        {
+            memcpy(&mMappedData[elementIndex*mElementByteSize], data, count*sizeof(T));
+            return;
+        }
+
+        for(int i = 0; i < count; ++i)
+            CopyData(elementIndex + i, data[i]);
     }
 
-    void CopyData(int elementIndex, const T& data)
+    // The mapped elements, for writing in place.  Only for buffers whose elements are
+    // not padded, i.e. not constant buffers.  The memory is write-combined: write it
+    // sequentially and never read it back.
+    T* MappedData()
     {
-        memcpy(&mMappedData[elementIndex*mElementByteSize], &data, sizeof(T));
+        assert(mElementByteSize == sizeof(T));
+        return reinterpret_cast<T*>(mMappedData);
     }
 
 private:
-    Microsoft::WRL::ComPtr<ID3D12Resource> mUploadBuffer;
-    BYTE* mMappedData = nullptr;
+    std::unique_ptr<GpuUploadBuffer> mUploadBuffer;
+    std::uint8_t* mMappedData = nullptr;
 
-    UINT mElementByteSize = 0;
+    std::uint32_t mElementByteSize = 0;
     bool mIsConstantBuffer = false;
 };
\ No newline at end of file
@@ -0,0 +1,72 @@
+//***************************************************************************************
+// UploadRing.cpp
+//***************************************************************************************
+
+#include "UploadRing.h"
+#include <cassert>
+#include <new>
+
+UploadRing::UploadRing(RenderDevice& device, std::uint64_t capacity)
+	: mDevice(&device)
+{
+	const std::uint64_t granularity = RenderDevice::BufferPlacementAlignment;
+	mCapacity = (std::max<std::uint64_t>(capacity, 1) + granularity - 1) & ~(granularity - 1);
+
+	// Mapped for the lifetime of the ring; the fences keep the CPU from writing
+	// anything the GPU may still read.
+	mBuffer = device.CreateUploadBuffer(mCapacity);
+	mMappedData = mBuffer->MappedData();
+	mGpuBase = mBuffer->GpuAddress();
+}
+
+UploadRing::Allocation UploadRing::Allocate(std::uint64_t size, std::uint64_t alignment)
+{
+	assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+	assert(alignment <= RenderDevice::BufferPlacementAlignment);
+
+	for(;;)
+	{
+		std::uint64_t start = (mHead + alignment - 1) & ~(alignment - 1);
+
+		// An allocation never wraps around the end of the buffer; skip to the start.
+		if(start % mCapacity + size > mCapacity)
+			start = (start / mCapacity + 1)*mCapacity;
+
+		if(start + size - mTail <= mCapacity)
+		{
+			mHead = start + size;
+
+			Allocation a;
+			a.Cpu = mMappedData + start % mCapacity;
+			a.Gpu = mGpuBase + start % mCapacity;
+			a.Size = size;
+			return a;
+		}
+
+		// Only the current frame is left, so waiting would not help.
+		if(mFrames.empty())
+			throw std::bad_alloc();
+
+		// Wait for the GPU to finish the oldest frame, then take its space back.
+		std::uint64_t fenceValue = mFrames.front().FenceValue;
+		mDevice->WaitForFence(fenceValue);
+		Reclaim(fenceValue);
+	}
+}
+
+void UploadRing::EndFrame(std::uint64_t fenceValue)
+{
+	Frame frame;
+	frame.FenceValue = fenceValue;
+	frame.End = mHead;
+	mFrames.push_back(frame);
+}
+
+void UploadRing::Reclaim(std::uint64_t completedFenceValue)
+{
+	while(!mFrames.empty() && mFrames.front().FenceValue <= completedFenceValue)
+	{
+		mTail = mFrames.front().End;
+		mFrames.pop_front();
+	}
+}
@@ -0,0 +1,111 @@
+//***************************************************************************************
+// UploadRing.h
+//
+// One large, persistently mapped upload heap buffer used as a ring.  Per-frame data
+// (constants and the like) is bump-allocated from the head; whole frames are returned
+// at the tail once the GPU has passed the fence value they were submitted with.  Unlike
+// a set of fixed-size UploadBuffers per frame resource, the amount of data per frame
+// can change from frame to frame without recreating anything.
+//***************************************************************************************
+
+#ifndef UPLOADRING_H
+#define UPLOADRING_H
+
+#include "RenderDevice.h"
+#include <algorithm>
+#include <cstring>
+#include <deque>
+
+class UploadRing
+{
+public:
+	struct Allocation
+	{
+		std::uint8_t* Cpu = nullptr;
+		std::uint64_t Gpu = 0;
+		std::uint64_t Size = 0;
+	};
+
+	// count elements of type T, each Stride bytes apart.  Mirrors UploadBuffer: the
+	// elements of a constant buffer array are 256-byte aligned so each one can be
+	// bound as a root CBV.
+	template<typename T>
+	struct Array
+	{
+		std::uint8_t* Cpu = nullptr;
+		std::uint64_t Gpu = 0;
+		std::uint32_t Stride = 0;
+		std::uint32_t Count = 0;
+
+		void CopyData(int elementIndex, const T& data)
+		{
+			memcpy(Cpu + (std::uint64_t)elementIndex*Stride, &data, sizeof(T));
+		}
+
+		std::uint64_t Address(int elementIndex)const
+		{
+			return Gpu + (std::uint64_t)elementIndex*Stride;
+		}
+	};
+
+	// capacity is rounded up to a multiple of 64 KB.  The frames are signalled on the
+	// device's fence, which is used to wait when the ring is full.
+	UploadRing(RenderDevice& device, std::uint64_t capacity);
+	UploadRing(const UploadRing& rhs) = delete;
+	UploadRing& operator=(const UploadRing& rhs) = delete;
+	~UploadRing() = default;
+
+	// Returns size bytes at the given power-of-two alignment (at most 64 KB).  If the
+	// ring is full this waits for the GPU to finish the oldest frames.  Throws
+	// std::bad_alloc if the current frame alone would overflow it.
+	Allocation Allocate(std::uint64_t size, std::uint64_t alignment = RenderDevice::ConstantBufferAlignment);
+
+	template<typename T>
+	Array<T> AllocateArray(std::uint32_t count, bool isConstantBuffer)
+	{
+		Array<T> a;
+		a.Stride = isConstantBuffer ? RenderDevice::CalcConstantBufferByteSize(sizeof(T)) : (std::uint32_t)sizeof(T);
+		a.Count = count;
+
+		Allocation mem = Allocate((std::uint64_t)a.Stride*std::max<std::uint32_t>(count, 1),
+			isConstantBuffer ? RenderDevice::ConstantBufferAlignment : 16);
+		a.Cpu = mem.Cpu;
+		a.Gpu = mem.Gpu;
+		return a;
+	}
+
+	// Closes the current frame: everything allocated since the last call stays in use
+	// until the fence reaches fenceValue.
+	void EndFrame(std::uint64_t fenceValue);
+
+	// Frees every closed frame whose fence value is at most completedFenceValue.
+	void Reclaim(std::uint64_t completedFenceValue);
+
+	std::uint64_t Capacity()const { return mCapacity; }
+
+	// Bytes between the tail and the head, i.e. not yet reclaimed.
+	std::uint64_t UsedBytes()const { return mHead - mTail; }
+
+private:
+	struct Frame
+	{
+		std::uint64_t FenceValue = 0;
+		std::uint64_t End = 0;
+	};
+
+	RenderDevice* mDevice = nullptr;
+	std::unique_ptr<GpuUploadBuffer> mBuffer;
+	std::uint8_t* mMappedData = nullptr;
+	std::uint64_t mGpuBase = 0;
+	std::uint64_t mCapacity = 0;
+
+	// Byte positions that only ever grow; the buffer offset is the position modulo
+	// the capacity.  [mTail, mHead) is in use.
+	std::uint64_t mHead = 0;
+	std::uint64_t mTail = 0;
+
+	// Frames closed by EndFrame that the GPU may still be reading, oldest first.
+	std::deque<Frame> mFrames;
+};
+
+#endif // UPLOADRING_H